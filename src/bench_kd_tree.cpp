@@ -0,0 +1,162 @@
+#include "bench_util.h"
+#include "plan_io.h"
+
+#include <ros/ros.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+// Usage: bench_kd_tree [plans=N] [clusters=N] [spread=RAD] [wpts=N] [queries=N] [hits=K] [reps=N] [seed=N] [file=PATH]
+static double elapsedSec(const ros::WallTime& since)
+{
+    return (ros::WallTime::now() - since).toSec();
+}
+
+static KDTreePtr makeKDTree(robot_model::RobotModelPtr& rmodel)
+{
+    // Same layout as TrajectoryLibrary uses
+    std::vector<double> low_bounds(2*UR5_DOF, -M_PI-KDTREE_BOUND_MARGIN);
+    std::vector<double> high_bounds(2*UR5_DOF, M_PI+KDTREE_BOUND_MARGIN);
+    std::vector<std::size_t> res(2*UR5_DOF, KDTREE_RESOLUTION);
+    return KDTreePtr(new KDTree(rmodel, low_bounds, high_bounds, res));
+}
+
+int main(int argc, char** argv)
+{
+    synthetic_params lib_params;
+    lib_params.num_plans = 10000;
+    lib_params.num_clusters = 50;
+    lib_params.cluster_spread = 0.2;
+    lib_params.num_wpts = 20;
+    lib_params.joint_speed = 1.0;
+    lib_params.seed = 1;
+    int num_queries = 1000;
+    int num_hits = 5;
+    int num_reps = 3;
+    std::string filename = "/tmp/bench_kd_tree.dat";
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string value;
+        if (parseBenchArg(argv[i], "plans", value)) lib_params.num_plans = atoi(value.c_str());
+        else if (parseBenchArg(argv[i], "clusters", value)) lib_params.num_clusters = atoi(value.c_str());
+        else if (parseBenchArg(argv[i], "spread", value)) lib_params.cluster_spread = atof(value.c_str());
+        else if (parseBenchArg(argv[i], "wpts", value)) lib_params.num_wpts = atoi(value.c_str());
+        else if (parseBenchArg(argv[i], "queries", value)) num_queries = atoi(value.c_str());
+        else if (parseBenchArg(argv[i], "hits", value)) num_hits = atoi(value.c_str());
+        else if (parseBenchArg(argv[i], "reps", value)) num_reps = atoi(value.c_str());
+        else if (parseBenchArg(argv[i], "seed", value)) lib_params.seed = atoi(value.c_str());
+        else if (parseBenchArg(argv[i], "file", value)) filename = value;
+        else
+        {
+            std::cerr << "Unknown argument " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    // No master needed: the model comes from the bundled description
+    robot_model::RobotModelPtr rmodel;
+    try { rmodel = loadRobotModel(BENCH_URDF_FILE, BENCH_SRDF_FILE); }
+    catch (std::string& s)
+    {
+        std::cerr << "Robot model: " << s << std::endl;
+        return 1;
+    }
+
+    std::vector<ur5_motion_plan> plans;
+    generateSyntheticPlans(plans, rmodel, lib_params);
+
+    // Queries come from the same distribution as the library, but are not library plans
+    synthetic_params query_params = lib_params;
+    query_params.num_plans = num_queries;
+    query_params.num_wpts = 2;
+    query_params.seed = lib_params.seed + 1;
+    std::vector<ur5_motion_plan> queries;
+    generateSyntheticPlans(queries, rmodel, query_params);
+
+    std::cout << "Library: " << plans.size() << " plans, " << lib_params.num_clusters << " clusters, spread "
+              << lib_params.cluster_spread << " rad, " << lib_params.num_wpts << " waypoints." << std::endl;
+    std::cout << "Queries: " << queries.size() << ", hits per query: " << num_hits << std::endl;
+
+    LatencyStats add_stats("add");
+    LatencyStats target_stats("setTargets");
+    std::vector<LatencyStats> lookup_stats;
+    for (int k = 0; k < num_hits; k++)
+    {
+        std::stringstream name;
+        name << "lookup(" << k << ")";
+        lookup_stats.push_back(LatencyStats(name.str()));
+    }
+    LatencyStats read_stats("readPlanFile");
+    LatencyStats import_stats("import");
+
+    // Insertion
+    KDTreePtr kdtree = makeKDTree(rmodel);
+    for (std::size_t i = 0; i < plans.size(); i++)
+    {
+        ros::WallTime start = ros::WallTime::now();
+        kdtree->add(plans[i]);
+        add_stats.add(elapsedSec(start));
+    }
+    kdtree->printInfo(std::cout);
+
+    // Proximity queries
+    for (std::size_t q = 0; q < queries.size(); q++)
+    {
+        ScopedQuiet quiet;
+        const joint_values_t& start_jvals = queries[q].start_state.joint_state.position;
+        const joint_values_t& end_jvals = queries[q].end_state.joint_state.position;
+
+        ros::WallTime start = ros::WallTime::now();
+        kdtree->setTargets(start_jvals, end_jvals);
+        target_stats.add(elapsedSec(start));
+
+        plan_handle_t plan;
+        for (int k = 0; k < num_hits; k++)
+        {
+            start = ros::WallTime::now();
+            bool found = kdtree->lookup(plan, k);
+            lookup_stats[k].add(elapsedSec(start));
+            if (!found)
+            {
+                break;
+            }
+        }
+    }
+
+    // Library import: file read, then the tree rebuild that importFromFile does
+    if (!writePlanFile(plans, filename.c_str()))
+    {
+        std::cerr << "Could not write " << filename << std::endl;
+        return 1;
+    }
+    for (int r = 0; r < num_reps; r++)
+    {
+        ScopedQuiet quiet;
+        std::vector<ur5_motion_plan> loaded;
+        KDTreePtr imported = makeKDTree(rmodel);
+
+        ros::WallTime start = ros::WallTime::now();
+        readPlanFile(loaded, filename.c_str());
+        read_stats.add(elapsedSec(start));
+        for (std::size_t i = 0; i < loaded.size(); i++)
+        {
+            imported->add(loaded[i]);
+        }
+        import_stats.add(elapsedSec(start));
+    }
+    remove(filename.c_str());
+
+    std::cout << std::endl;
+    add_stats.printInfo(std::cout);
+    target_stats.printInfo(std::cout);
+    for (int k = 0; k < num_hits; k++)
+    {
+        lookup_stats[k].printInfo(std::cout);
+    }
+    read_stats.printInfo(std::cout);
+    import_stats.printInfo(std::cout);
+
+    return 0;
+}
@@ -0,0 +1,582 @@
+#include "bench_util.h"
+#include "query_trace.h"
+#include "trajectory_library.h"
+
+#include <ros/ros.h>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+
+// Usage: bench_primitives [bush_radius=M] [trace=PATH] [wpts=N] [res=N] [reps=N] [comparisons=N] [only=NAME]
+//
+// Runs offline against the bundled model, so it can be profiled directly, e.g.
+//   perf record -g bench_primitives only=segmentValid reps=20
+// Primitive names for only=: isStateValid, segmentValid, pathValid, ikValidityCallback, optimizeTrajectory, computeTimeStamps,
+// calculateGradients, racePlanners
+
+#define GRADIENT_NOISE 0.05     // rad added to interior waypoints, so straight trajectories have gradients to find
+#define RACE_FAST_DELAY 0.005   // s the detour planner takes, so it always finishes first
+#define RACE_SLOW_DELAY 0.02    // s the straight planner takes
+
+static double elapsedSec(const ros::WallTime& since)
+{
+    return (ros::WallTime::now() - since).toSec();
+}
+
+// Cost of the underlying collision checks, as opposed to whole calls
+static void printCheckRate(const std::string& name, double total_sec, std::size_t checks, std::ostream& cout)
+{
+    double ns = (checks > 0) ? total_sec * 1e9 / checks : 0;
+    cout << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(2)
+         << " checks=" << std::setw(9) << checks
+         << "  " << std::setw(10) << ns << " ns/check"
+         << "  " << std::setw(12) << ((total_sec > 0) ? checks / total_sec : 0) << " checks/s" << std::endl;
+    return;
+}
+
+// Straight joint-space trajectory, like the ones the library warps
+static robot_trajectory::RobotTrajectoryPtr makeStraightTrajectory(const robot_model::RobotModelPtr& rmodel, const trace_query& query, int num_wpts)
+{
+    robot_trajectory::RobotTrajectoryPtr traj(new robot_trajectory::RobotTrajectory(rmodel, UR5_GROUP_NAME));
+    const robot_model::JointModelGroup* jmg = rmodel->getJointModelGroup(UR5_GROUP_NAME);
+
+    joint_values_t jvals(query.start_jvals.size());
+    for (int i = 0; i < num_wpts; i++)
+    {
+        double t = (double) i / (num_wpts - 1);
+        for (std::size_t j = 0; j < jvals.size(); j++)
+        {
+            jvals[j] = query.start_jvals[j] + t * (query.end_jvals[j] - query.start_jvals[j]);
+        }
+        robot_state::RobotStatePtr state(new robot_state::RobotState(rmodel));
+        state->setToDefaultValues();
+        state->setJointGroupPositions(jmg, jvals);
+        state->update();
+        traj->addSuffixWayPoint(state, 0.1);
+    }
+    return traj;
+}
+
+// Stand-in planner that returns a fixed path after a fixed time, so races have a known outcome
+class ReplayContext : public planning_interface::PlanningContext
+{
+    robot_trajectory::RobotTrajectoryPtr _traj;
+    double _delay;
+    boost::atomic<bool> _terminated;
+
+public:
+    ReplayContext(const std::string& name, const robot_trajectory::RobotTrajectoryPtr& traj, double delay)
+        : planning_interface::PlanningContext(name, UR5_GROUP_NAME)
+    {
+        _traj = traj;
+        _delay = delay;
+        _terminated.store(false);
+        return;
+    }
+
+    bool solve(planning_interface::MotionPlanResponse& res)
+    {
+        ros::WallTime start = ros::WallTime::now();
+        while (elapsedSec(start) < _delay)
+        {
+            if (_terminated.load())
+            {
+                res.error_code_.val = moveit_msgs::MoveItErrorCodes::PREEMPTED;
+                return false;
+            }
+            ros::WallDuration(0.001).sleep();
+        }
+        res.trajectory_ = _traj;
+        res.planning_time_ = elapsedSec(start);
+        res.error_code_.val = moveit_msgs::MoveItErrorCodes::SUCCESS;
+        return true;
+    }
+
+    bool solve(planning_interface::MotionPlanDetailedResponse& res)
+    {
+        return false;
+    }
+
+    bool terminate()
+    {
+        _terminated.store(true);
+        return true;
+    }
+
+    void clear()
+    {
+        _terminated.store(false);
+        return;
+    }
+};
+
+// Calls into the library's private primitives on its weeding scene
+class PrimitiveBench
+{
+    TrajectoryLibrary* _lib;
+    std::vector<robot_trajectory::RobotTrajectoryPtr> _trajs;
+    int _res;
+    int _reps;
+
+public:
+    PrimitiveBench(TrajectoryLibrary* lib, const std::vector<robot_trajectory::RobotTrajectoryPtr>& trajs, int res, int reps)
+    {
+        _lib = lib;
+        _trajs = trajs;
+        _res = res;
+        _reps = reps;
+        return;
+    }
+
+    // Raw planning scene check, no cache in front
+    void benchStateValid(std::ostream& cout)
+    {
+        LatencyStats stats("isStateValid");
+        double total = 0;
+        std::size_t num_valid = 0;
+        for (int r = 0; r < _reps; r++)
+        {
+            for (std::size_t t = 0; t < _trajs.size(); t++)
+            {
+                for (std::size_t i = 0; i < _trajs[t]->getWayPointCount(); i++)
+                {
+                    const robot_state::RobotState& state = _trajs[t]->getWayPoint(i);
+                    ros::WallTime start = ros::WallTime::now();
+                    bool valid = _lib->_plan_scene->isStateValid(state, UR5_GROUP_NAME);
+                    double sec = elapsedSec(start);
+                    stats.add(sec);
+                    total += sec;
+                    num_valid += valid;
+                }
+            }
+        }
+        stats.printInfo(cout);
+        printCheckRate("isStateValid", total, stats.size(), cout);
+        cout << "  " << num_valid << "/" << stats.size() << " states valid" << std::endl;
+        return;
+    }
+
+    // Segments between consecutive waypoints; cold runs clear the cache first, warm runs hit it
+    void benchSegmentValid(std::ostream& cout)
+    {
+        LatencyStats cold_stats("segmentValid");
+        LatencyStats warm_stats("segmentValid hit");
+        robot_state::RobotState inter_state(_lib->_rmodel);
+        double total = 0;
+        std::size_t checks = 0;
+        for (int r = 0; r < _reps; r++)
+        {
+            _lib->_validity_cache->clear();
+            _lib->_validity_cache->resetCounters();
+            for (int pass = 0; pass < 2; pass++)
+            {
+                LatencyStats& stats = (pass == 0) ? cold_stats : warm_stats;
+                for (std::size_t t = 0; t < _trajs.size(); t++)
+                {
+                    for (std::size_t i = 1; i < _trajs[t]->getWayPointCount(); i++)
+                    {
+                        ros::WallTime start = ros::WallTime::now();
+                        _lib->segmentValid(_trajs[t]->getWayPoint(i-1), _trajs[t]->getWayPoint(i), _res, inter_state);
+                        double sec = elapsedSec(start);
+                        stats.add(sec);
+                        if (pass == 0)
+                        {
+                            total += sec;
+                        }
+                    }
+                }
+                if (pass == 0)
+                {
+                    // Every state miss is one real collision check
+                    checks += _lib->_validity_cache->getStateMisses();
+                }
+            }
+        }
+        cold_stats.printInfo(cout);
+        warm_stats.printInfo(cout);
+        printCheckRate("segmentValid", total, checks, cout);
+        return;
+    }
+
+    void benchPathValid(std::ostream& cout)
+    {
+        LatencyStats stats("pathValid");
+        robot_state::RobotState inter_state(_lib->_rmodel);
+        double total = 0;
+        std::size_t checks = 0;
+        std::size_t num_valid = 0;
+        for (int r = 0; r < _reps; r++)
+        {
+            for (std::size_t t = 0; t < _trajs.size(); t++)
+            {
+                _lib->_validity_cache->clear();
+                _lib->_validity_cache->resetCounters();
+                ros::WallTime start = ros::WallTime::now();
+                bool valid = _lib->pathValid(_trajs[t], _res, inter_state);
+                double sec = elapsedSec(start);
+                stats.add(sec);
+                total += sec;
+                checks += _lib->_validity_cache->getStateMisses();
+                num_valid += valid;
+            }
+        }
+        stats.printInfo(cout);
+        printCheckRate("pathValid", total, checks, cout);
+        cout << "  " << num_valid << "/" << stats.size() << " paths valid" << std::endl;
+        return;
+    }
+
+    // IK solution filter: one collision check plus a distance to each earlier solution
+    void benchIkValidity(std::size_t num_comparisons, std::ostream& cout)
+    {
+        const robot_model::JointModelGroup* jmg = _lib->_jmg;
+        boost::random::mt19937 rng(1);
+        boost::random::uniform_real_distribution<double> uniform(-M_PI, M_PI);
+        std::vector<joint_values_t> comparison_values(num_comparisons, joint_values_t(UR5_DOF));
+        for (std::size_t c = 0; c < num_comparisons; c++)
+        {
+            for (std::size_t j = 0; j < UR5_DOF; j++)
+            {
+                comparison_values[c][j] = uniform(rng);
+            }
+        }
+
+        LatencyStats stats("ikValidity");
+        robot_state::RobotState state(_lib->_rmodel);
+        state.setToDefaultValues();
+        joint_values_t jvals;
+        double total = 0;
+        for (int r = 0; r < _reps; r++)
+        {
+            for (std::size_t t = 0; t < _trajs.size(); t++)
+            {
+                for (std::size_t i = 0; i < _trajs[t]->getWayPointCount(); i++)
+                {
+                    _trajs[t]->getWayPoint(i).copyJointGroupPositions(jmg, jvals);
+                    ros::WallTime start = ros::WallTime::now();
+                    _lib->ikValidityCallback(comparison_values, &state, jmg, &jvals[0]);
+                    double sec = elapsedSec(start);
+                    stats.add(sec);
+                    total += sec;
+                }
+            }
+        }
+        stats.printInfo(cout);
+        printCheckRate("ikValidity", total, stats.size(), cout);
+        cout << "  " << num_comparisons << " comparison solutions" << std::endl;
+        return;
+    }
+
+    // Shortcutting, from a cold cache each time as after a fresh warp
+    void benchOptimize(std::ostream& cout)
+    {
+        LatencyStats stats("optimizeTraj");
+        robot_trajectory::RobotTrajectoryPtr traj_opt(new robot_trajectory::RobotTrajectory(_lib->_rmodel, UR5_GROUP_NAME));
+        double total = 0;
+        std::size_t checks = 0;
+        std::size_t trimmed = 0;
+        for (int r = 0; r < _reps; r++)
+        {
+            for (std::size_t t = 0; t < _trajs.size(); t++)
+            {
+                _lib->_validity_cache->clear();
+                _lib->_validity_cache->resetCounters();
+                ros::WallTime start = ros::WallTime::now();
+                _lib->optimizeTrajectory(traj_opt, _trajs[t]);
+                double sec = elapsedSec(start);
+                stats.add(sec);
+                total += sec;
+                checks += _lib->_validity_cache->getStateMisses();
+                trimmed += _trajs[t]->getWayPointCount() - traj_opt->getWayPointCount();
+            }
+        }
+        stats.printInfo(cout);
+        printCheckRate("optimizeTraj", total, checks, cout);
+        cout << "  " << std::setprecision(1) << (double) trimmed / std::max((std::size_t) 1, stats.size()) << " waypoints trimmed per trajectory" << std::endl;
+        return;
+    }
+
+    // Reference for calculateGradients: re-parameterizes a copy of the whole trajectory per perturbation
+    double fullGradients(double* gradient_array, robot_trajectory::RobotTrajectoryPtr traj)
+    {
+        int num_wpts = traj->getWayPointCount();
+        int num_joints = _lib->_rmodel->getVariableCount();
+        double max = 0;
+
+        robot_trajectory::RobotTrajectory full(_lib->_rmodel, UR5_GROUP_NAME);
+        for (int k=0; k < num_wpts; k++)
+        {
+            full.addSuffixWayPoint(robot_state::RobotStatePtr(new robot_state::RobotState(traj->getWayPoint(k))), 0);
+        }
+        _lib->_time_parametizer->computeTimeStamps(full);
+        double duration_old = full.getWaypointDurationFromStart(num_wpts-1);
+
+        for (int j=0; j < num_joints; j++)
+        {
+            gradient_array[j] = 0;
+            gradient_array[((num_wpts-1)*num_joints) + j] = 0;
+        }
+        for (int i=1; i < num_wpts-1; i++)
+        {
+            double* gtstate = full.getWayPointPtr(i)->getVariablePositions();
+            for (int j=0; j < num_joints; j++)
+            {
+                double jval = gtstate[j];
+                gtstate[j] = jval + GRADIENT_DELTA;
+                _lib->_time_parametizer->computeTimeStamps(full);
+                double gradient = (full.getWaypointDurationFromStart(num_wpts-1) - duration_old) / GRADIENT_DELTA;
+                max = std::max(max, fabs(gradient));
+                gradient_array[(i*num_joints) + j] = gradient;
+                gtstate[j] = jval;
+            }
+        }
+        return max;
+    }
+
+    // Segment-local GDW gradients against the full-trajectory finite difference: agreement and cost
+    void benchGradients(std::ostream& cout)
+    {
+        LatencyStats local_stats("calculateGradients");
+        LatencyStats full_stats("fullGradients");
+        WarpWorkspace workspace(_lib->_rmodel, UR5_GROUP_NAME, 0);
+        boost::random::mt19937 rng(1);
+        boost::random::uniform_real_distribution<double> noise(-GRADIENT_NOISE, GRADIENT_NOISE);
+        int num_joints = _lib->_rmodel->getVariableCount();
+        double local_total = 0;
+        double full_total = 0;
+        double cosine_sum = 0;
+        double worst_cosine = 1;
+        std::size_t num_compared = 0;
+        std::size_t num_agree = 0;
+        for (int r = 0; r < _reps; r++)
+        {
+            for (std::size_t t = 0; t < _trajs.size(); t++)
+            {
+                int num_wpts = _trajs[t]->getWayPointCount();
+                robot_trajectory::RobotTrajectoryPtr traj(new robot_trajectory::RobotTrajectory(_lib->_rmodel, UR5_GROUP_NAME));
+                for (int i = 0; i < num_wpts; i++)
+                {
+                    robot_state::RobotStatePtr state(new robot_state::RobotState(_trajs[t]->getWayPoint(i)));
+                    for (int j = 0; i > 0 && i < num_wpts-1 && j < num_joints; j++)
+                    {
+                        state->getVariablePositions()[j] += noise(rng);
+                    }
+                    state->update();
+                    traj->addSuffixWayPoint(state, 0);
+                }
+                _lib->_time_parametizer->computeTimeStamps(*traj);
+
+                std::vector<double> local_grad(num_wpts * num_joints);
+                std::vector<double> full_grad(num_wpts * num_joints);
+                ros::WallTime start = ros::WallTime::now();
+                _lib->calculateGradients(&local_grad[0], traj, workspace);
+                double sec = elapsedSec(start);
+                local_stats.add(sec);
+                local_total += sec;
+                start = ros::WallTime::now();
+                fullGradients(&full_grad[0], traj);
+                sec = elapsedSec(start);
+                full_stats.add(sec);
+                full_total += sec;
+
+                double dot = 0;
+                double local_norm = 0;
+                double full_norm = 0;
+                for (std::size_t k = 0; k < full_grad.size(); k++)
+                {
+                    dot += local_grad[k] * full_grad[k];
+                    local_norm += local_grad[k] * local_grad[k];
+                    full_norm += full_grad[k] * full_grad[k];
+                    if (fabs(full_grad[k]) > 1e-6)
+                    {
+                        num_compared++;
+                        num_agree += (local_grad[k] * full_grad[k] > 0);
+                    }
+                }
+                double cosine = (local_norm > 0 && full_norm > 0) ? dot / sqrt(local_norm * full_norm) : 0;
+                cosine_sum += cosine;
+                worst_cosine = std::min(worst_cosine, cosine);
+            }
+        }
+        local_stats.printInfo(cout);
+        full_stats.printInfo(cout);
+        std::size_t num_grads = local_stats.size();
+        cout << "  " << std::setprecision(3) << "cosine to full gradient: mean " << cosine_sum / std::max((std::size_t) 1, num_grads)
+             << ", worst " << worst_cosine << "; sign agreement " << 100.0 * num_agree / std::max((std::size_t) 1, num_compared) << "%"
+             << "; cost " << ((full_total > 0) ? local_total / full_total : 0) << " of full" << std::endl;
+        return;
+    }
+
+    // Two planners per query: a detour that returns first and the straight path that returns later.
+    // Best-of mode must keep the straight path, first-wins mode the detour.
+    void benchRace(std::ostream& cout)
+    {
+        LatencyStats best_stats("raceBestOf");
+        LatencyStats first_stats("raceFirstWins");
+        boost::random::mt19937 rng(1);
+        boost::random::uniform_real_distribution<double> noise(-GRADIENT_NOISE, GRADIENT_NOISE);
+        int num_joints = _lib->_rmodel->getVariableCount();
+        std::size_t best_correct = 0;
+        std::size_t first_correct = 0;
+        std::size_t skipped = 0;
+        for (int r = 0; r < _reps; r++)
+        {
+            for (std::size_t t = 0; t < _trajs.size(); t++)
+            {
+                int num_wpts = _trajs[t]->getWayPointCount();
+                robot_trajectory::RobotTrajectoryPtr detour(new robot_trajectory::RobotTrajectory(_lib->_rmodel, UR5_GROUP_NAME));
+                for (int i = 0; i < num_wpts; i++)
+                {
+                    robot_state::RobotStatePtr state(new robot_state::RobotState(_trajs[t]->getWayPoint(i)));
+                    for (int j = 0; i > 0 && i < num_wpts-1 && j < num_joints; j++)
+                    {
+                        state->getVariablePositions()[j] += noise(rng);
+                    }
+                    state->update();
+                    detour->addSuffixWayPoint(state, 0.1);
+                }
+
+                // The race validates paths, so both must be collision free for the outcome to be known
+                if (!_lib->_plan_scene->isPathValid(*_trajs[t], UR5_GROUP_NAME) || !_lib->_plan_scene->isPathValid(*detour, UR5_GROUP_NAME))
+                {
+                    skipped++;
+                    continue;
+                }
+
+                std::vector<planning_interface::PlanningContextPtr> contexts;
+                contexts.push_back(planning_interface::PlanningContextPtr(new ReplayContext("detour", detour, RACE_FAST_DELAY)));
+                contexts.push_back(planning_interface::PlanningContextPtr(new ReplayContext("straight", _trajs[t], RACE_SLOW_DELAY)));
+                planning_interface::MotionPlanResponse res;
+                int best;
+
+                ros::WallTime start = ros::WallTime::now();
+                bool found = _lib->racePlanners(contexts, false, 1.0, res, best, NULL);
+                best_stats.add(elapsedSec(start));
+                best_correct += (found && best == 1 && res.trajectory_ == _trajs[t]);
+
+                for (std::size_t c = 0; c < contexts.size(); c++)
+                {
+                    contexts[c]->clear();
+                }
+                start = ros::WallTime::now();
+                found = _lib->racePlanners(contexts, true, 1.0, res, best, NULL);
+                first_stats.add(elapsedSec(start));
+                first_correct += (found && best == 0 && res.trajectory_ == detour);
+            }
+        }
+        best_stats.printInfo(cout);
+        first_stats.printInfo(cout);
+        std::size_t num_races = best_stats.size();
+        cout << "  best-of kept the shortest path in " << best_correct << "/" << num_races
+             << ", first-wins kept the first path in " << first_correct << "/" << num_races
+             << " (" << skipped << " queries skipped, path in collision)" << std::endl;
+        if (best_correct < num_races || first_correct < num_races)
+        {
+            cout << "  FAILED: race kept the wrong path" << std::endl;
+        }
+        return;
+    }
+
+    void benchTimeStamps(std::ostream& cout)
+    {
+        LatencyStats stats("computeTimeStamps");
+        robot_trajectory::RobotTrajectory traj(_lib->_rmodel, UR5_GROUP_NAME);
+        std::size_t num_wpts = 0;
+        double total = 0;
+        for (int r = 0; r < _reps; r++)
+        {
+            for (std::size_t t = 0; t < _trajs.size(); t++)
+            {
+                // Parameterization rewrites the timing, so work on a copy
+                traj = *_trajs[t];
+                ros::WallTime start = ros::WallTime::now();
+                _lib->_time_parametizer->computeTimeStamps(traj);
+                double sec = elapsedSec(start);
+                stats.add(sec);
+                total += sec;
+                num_wpts += traj.getWayPointCount();
+            }
+        }
+        stats.printInfo(cout);
+        double ns = (num_wpts > 0) ? total * 1e9 / num_wpts : 0;
+        cout << "  " << std::setprecision(2) << ns << " ns/waypoint" << std::endl;
+        return;
+    }
+};
+
+int main(int argc, char** argv)
+{
+    double bush_radius = 0.15;
+    std::string trace_file = APPLE_CRUSHER_CONFIG_DIR "/weeding_trace.txt";
+    int num_wpts = 20;
+    int res = PATH_VALIDITY_CHECKER_RES;
+    int num_reps = 5;
+    int num_comparisons = MAX_IK_SOLUTIONS;
+    std::string only;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string value;
+        if (parseBenchArg(argv[i], "bush_radius", value)) bush_radius = atof(value.c_str());
+        else if (parseBenchArg(argv[i], "trace", value)) trace_file = value;
+        else if (parseBenchArg(argv[i], "wpts", value)) num_wpts = std::max(2, atoi(value.c_str()));
+        else if (parseBenchArg(argv[i], "res", value)) res = std::max(1, atoi(value.c_str()));
+        else if (parseBenchArg(argv[i], "reps", value)) num_reps = atoi(value.c_str());
+        else if (parseBenchArg(argv[i], "comparisons", value)) num_comparisons = atoi(value.c_str());
+        else if (parseBenchArg(argv[i], "only", value)) only = value;
+        else
+        {
+            std::cerr << "Unknown argument " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    // The primitives log every call at info level
+    ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Warn);
+    ros::console::notifyLoggerLevelsChanged();
+
+    robot_model::RobotModelPtr rmodel;
+    try { rmodel = loadRobotModel(BENCH_URDF_FILE, BENCH_SRDF_FILE); }
+    catch (std::string& s)
+    {
+        std::cerr << "Robot model: " << s << std::endl;
+        return 1;
+    }
+
+    std::vector<trace_query> queries;
+    if (!readQueryTrace(queries, trace_file.c_str()) || queries.empty())
+    {
+        std::cerr << "Could not read queries from " << trace_file << std::endl;
+        return 1;
+    }
+    std::vector<robot_trajectory::RobotTrajectoryPtr> trajs;
+    for (std::size_t q = 0; q < queries.size(); q++)
+    {
+        trajs.push_back(makeStraightTrajectory(rmodel, queries[q], num_wpts));
+    }
+
+    // Same scene as the weeding demo
+    TrajectoryLibrary lib(rmodel);
+    lib.initWorkspaceBounds();
+    lib.addSphereCollisionObject(bush_radius);
+    lib.printCollisionWorldInfo(std::cout);
+
+    std::cout << "Trajectories: " << trajs.size() << " x " << num_wpts << " waypoints, checker resolution " << res
+              << ", bush radius " << bush_radius << " m, " << num_reps << " reps." << std::endl << std::endl;
+
+    PrimitiveBench bench(&lib, trajs, res, num_reps);
+    if (only.empty() || only == "isStateValid") bench.benchStateValid(std::cout);
+    if (only.empty() || only == "segmentValid") bench.benchSegmentValid(std::cout);
+    if (only.empty() || only == "pathValid") bench.benchPathValid(std::cout);
+    if (only.empty() || only == "ikValidityCallback") bench.benchIkValidity(num_comparisons, std::cout);
+    if (only.empty() || only == "optimizeTrajectory") bench.benchOptimize(std::cout);
+    if (only.empty() || only == "computeTimeStamps") bench.benchTimeStamps(std::cout);
+    if (only.empty() || only == "calculateGradients") bench.benchGradients(std::cout);
+    if (only.empty() || only == "racePlanners") bench.benchRace(std::cout);
+
+    return 0;
+}
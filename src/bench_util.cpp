@@ -0,0 +1,200 @@
+#include "bench_util.h"
+
+#include <urdf_parser/urdf_parser.h>
+#include <srdfdom/model.h>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+static bool readWholeFile(const std::string& filename, std::string& contents)
+{
+    std::ifstream file(filename.c_str());
+    if (!file.is_open())
+    {
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    contents = buffer.str();
+    return true;
+}
+
+bool parseBenchArg(const char* arg, const char* key, std::string& value)
+{
+    std::size_t len = strlen(key);
+    if (strncmp(arg, key, len) == 0 && arg[len] == '=')
+    {
+        value = arg + len + 1;
+        return true;
+    }
+    return false;
+}
+
+robot_model::RobotModelPtr loadRobotModel(const std::string& urdf_file, const std::string& srdf_file)
+{
+    std::string urdf_string;
+    std::string srdf_string;
+    if (!readWholeFile(urdf_file, urdf_string))
+    {
+        throw std::string("Could not read ") + urdf_file;
+    }
+    if (!readWholeFile(srdf_file, srdf_string))
+    {
+        throw std::string("Could not read ") + srdf_file;
+    }
+
+    boost::shared_ptr<urdf::ModelInterface> urdf_model = urdf::parseURDF(urdf_string);
+    if (!urdf_model)
+    {
+        throw std::string("Could not parse ") + urdf_file;
+    }
+    boost::shared_ptr<srdf::Model> srdf_model(new srdf::Model());
+    if (!srdf_model->initString(*urdf_model, srdf_string))
+    {
+        throw std::string("Could not parse ") + srdf_file;
+    }
+
+    return robot_model::RobotModelPtr(new robot_model::RobotModel(urdf_model, srdf_model));
+}
+
+void generateSyntheticPlans(std::vector<ur5_motion_plan>& plans, const robot_model::RobotModelPtr& rmodel, const synthetic_params& params)
+{
+    const std::vector<std::string>& names = rmodel->getVariableNames();
+    std::size_t num_joints = names.size();
+
+    boost::random::mt19937 rng(params.seed);
+    boost::random::uniform_real_distribution<double> uniform(-M_PI, M_PI);
+    boost::random::normal_distribution<double> spread(0.0, params.cluster_spread);
+
+    // Cluster centres in the combined start/end space
+    std::vector<joint_values_t> centres(params.num_clusters, joint_values_t(2 * num_joints));
+    for (std::size_t c = 0; c < params.num_clusters; c++)
+    {
+        for (std::size_t j = 0; j < 2 * num_joints; j++)
+        {
+            centres[c][j] = uniform(rng);
+        }
+    }
+    boost::random::uniform_int_distribution<std::size_t> pick(0, std::max((std::size_t) 1, params.num_clusters) - 1);
+
+    plans.clear();
+    plans.reserve(params.num_plans);
+    joint_values_t point(2 * num_joints);
+    for (std::size_t n = 0; n < params.num_plans; n++)
+    {
+        // Draw start and end joint values, kept inside the joint limits
+        if (params.num_clusters == 0)
+        {
+            for (std::size_t j = 0; j < point.size(); j++)
+            {
+                point[j] = uniform(rng);
+            }
+        }
+        else
+        {
+            const joint_values_t& centre = centres[ pick(rng) ];
+            for (std::size_t j = 0; j < point.size(); j++)
+            {
+                point[j] = std::max(-M_PI, std::min(M_PI, centre[j] + spread(rng)));
+            }
+        }
+
+        ur5_motion_plan plan;
+        plan.start_state.joint_state.name = names;
+        plan.end_state.joint_state.name = names;
+        plan.start_state.joint_state.position.assign(point.begin(), point.begin() + num_joints);
+        plan.end_state.joint_state.position.assign(point.begin() + num_joints, point.end());
+
+        // Straight line, timed by the joint that moves furthest
+        double max_dist = 0;
+        for (std::size_t j = 0; j < num_joints; j++)
+        {
+            max_dist = std::max(max_dist, fabs(point[j + num_joints] - point[j]));
+        }
+        plan.duration = max_dist / params.joint_speed;
+        plan.num_wpts = std::max((std::size_t) 2, params.num_wpts);
+        plan.start_target_index = PLAN_NO_TARGET;
+        plan.end_target_index = PLAN_NO_TARGET;
+
+        plan.trajectory.joint_trajectory.joint_names = names;
+        plan.trajectory.joint_trajectory.points.resize(plan.num_wpts);
+        for (int i = 0; i < plan.num_wpts; i++)
+        {
+            double t = (double) i / (plan.num_wpts - 1);
+            trajectory_msgs::JointTrajectoryPoint& wpt = plan.trajectory.joint_trajectory.points[i];
+            wpt.positions.resize(num_joints);
+            wpt.velocities.resize(num_joints);
+            for (std::size_t j = 0; j < num_joints; j++)
+            {
+                double dist = point[j + num_joints] - point[j];
+                wpt.positions[j] = point[j] + t * dist;
+                wpt.velocities[j] = (plan.duration > 0) ? dist / plan.duration : 0;
+            }
+            wpt.time_from_start = ros::Duration(t * plan.duration);
+        }
+
+        plans.push_back(plan);
+    }
+    return;
+}
+
+LatencyStats::LatencyStats(const std::string& name)
+{
+    _name = name;
+    return;
+}
+
+void LatencyStats::clear()
+{
+    _samples.clear();
+    return;
+}
+
+double LatencyStats::percentile(double p)
+{
+    if (_samples.empty())
+    {
+        return 0;
+    }
+    std::vector<double> sorted = _samples;
+    std::size_t k = std::min(sorted.size() - 1, (std::size_t) (p / 100.0 * sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    return sorted[k];
+}
+
+double LatencyStats::mean()
+{
+    if (_samples.empty())
+    {
+        return 0;
+    }
+    double sum = 0;
+    for (std::size_t i = 0; i < _samples.size(); i++)
+    {
+        sum += _samples[i];
+    }
+    return sum / _samples.size();
+}
+
+void LatencyStats::printInfo(std::ostream& cout)
+{
+    double avg = mean();
+    cout << std::left << std::setw(16) << _name << std::right << std::fixed << std::setprecision(2)
+         << " n=" << std::setw(7) << _samples.size()
+         << "  mean " << std::setw(10) << avg * 1e6
+         << "  p50 " << std::setw(10) << percentile(50) * 1e6
+         << "  p90 " << std::setw(10) << percentile(90) * 1e6
+         << "  p99 " << std::setw(10) << percentile(99) * 1e6
+         << "  max " << std::setw(10) << percentile(100) * 1e6 << " us"
+         << "  " << std::setw(12) << ((avg > 0) ? 1.0 / avg : 0) << " ops/s" << std::endl;
+    return;
+}
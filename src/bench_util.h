@@ -0,0 +1,70 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include "kd_tree.h"
+
+#include <moveit/robot_model/robot_model.h>
+
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Bundled robot description, so benchmarks run without a ROS master
+#define BENCH_URDF_FILE APPLE_CRUSHER_CONFIG_DIR "/ur5.urdf"
+#define BENCH_SRDF_FILE APPLE_CRUSHER_CONFIG_DIR "/ur5.srdf"
+
+typedef struct {
+    std::size_t num_plans;
+    std::size_t num_clusters;   // 0 for plans spread uniformly over the joint space
+    double cluster_spread;      // std dev of joint values around their cluster centre (rad)
+    std::size_t num_wpts;
+    double joint_speed;         // sets plan durations (rad/s)
+    unsigned int seed;
+} synthetic_params;
+
+// Matches a key=value command line argument
+bool parseBenchArg(const char* arg, const char* key, std::string& value);
+
+// Robot model straight from URDF and SRDF files; throws std::string on failure
+robot_model::RobotModelPtr loadRobotModel(const std::string& urdf_file, const std::string& srdf_file);
+
+// Straight joint-space plans between random start/end pairs, optionally clustered like a real library
+void generateSyntheticPlans(std::vector<ur5_motion_plan>& plans, const robot_model::RobotModelPtr& rmodel, const synthetic_params& params);
+
+// Wall-clock latency samples of one operation
+class LatencyStats
+{
+    std::string _name;
+    std::vector<double> _samples;   // s
+
+public:
+    LatencyStats(const std::string& name);
+
+    inline void add(double sec) { _samples.push_back(sec); }
+    inline std::size_t size() { return _samples.size(); }
+    void clear();
+
+    double percentile(double p);
+    double mean();
+    void printInfo(std::ostream& cout);
+};
+
+// Swallows std::cout while in scope; the library logs to it from its query paths
+class ScopedQuiet
+{
+    class NullBuffer : public std::streambuf
+    {
+    protected:
+        int overflow(int c) { return c; }
+    };
+
+    NullBuffer _null;
+    std::streambuf* _saved;
+
+public:
+    ScopedQuiet() { _saved = std::cout.rdbuf(&_null); }
+    ~ScopedQuiet() { std::cout.rdbuf(_saved); }
+};
+
+#endif // BENCH_UTIL_H
@@ -1,5 +1,7 @@
 #include "trajectory_library.h"
 
+#include <sstream>
+
 
 int main(int argc, char** argv)
 {
@@ -7,12 +9,43 @@ int main(int argc, char** argv)
     ros::NodeHandle nh("~");
 
     double BUSH_RADIUS;
-    if (nh.hasParam("bush_radius"))
+    nh.param("bush_radius", BUSH_RADIUS, WEEDING_BUSH_RADIUS);
+
+    // Comma separated planner ids, raced on every target pair when more than one
+    std::string planners;
+    portfolio_params portfolio;
+    nh.param("planners", planners, std::string("manipulator[RRTConnectkConfigDefault]"));
+    nh.param("planner_time", portfolio.allowed_time, 20.0);
+    nh.param("first_wins", portfolio.first_wins, true);
+    std::stringstream planner_stream(planners);
+    std::string planner_id;
+    while (std::getline(planner_stream, planner_id, ','))
     {
-        nh.getParam("bush_radius", BUSH_RADIUS);
+        if (!planner_id.empty())
+        {
+            portfolio.planner_ids.push_back(planner_id);
+        }
     }
 
+    // Roadmap engine: one multi-query roadmap instead of a planner call per target pair
+    bool use_roadmap;
+    roadmap_params roadmap;
+    nh.param("roadmap", use_roadmap, false);
+    nh.param("roadmap_min_samples", roadmap.min_samples, 500);
+    nh.param("roadmap_max_samples", roadmap.max_samples, 5000);
+    nh.param("roadmap_neighbors", roadmap.neighbors, 10);
+    nh.param("roadmap_max_edge", roadmap.max_edge, 2.0);
+
+    // Path shortcutting after planning
+    shortcut_params shortcut;
+    nh.param("shortcut_parallel", shortcut.parallel, true);
+    nh.param("shortcut_iterations", shortcut.random_iterations, 50);
+    nh.param("shortcut_bisections", shortcut.bisections, 4);
+    nh.param("shortcut_time", shortcut.max_time, 0.05);
+
     TrajectoryLibrary tlib(nh);
+    tlib.setPortfolioParams(portfolio);
+    tlib.setShortcutParams(shortcut);
     ROS_INFO("Initializing world.");
     tlib.initWorkspaceBounds();
     tlib.addSphereCollisionObject(BUSH_RADIUS);
@@ -21,26 +54,9 @@ int main(int argc, char** argv)
     ROS_INFO("Press Enter to begin generating joint values.");
     std::cin.ignore(100, '\n');
 
-    // Define weed soil volume grid
-    target_volume weedSoilVol;
-    weedSoilVol.type = GRID_RECT;
-    weedSoilVol.grid.orientation.w = sqrt(0.5);
-    weedSoilVol.grid.orientation.x = 0;
-    weedSoilVol.grid.orientation.y = -sqrt(0.5);
-    weedSoilVol.grid.orientation.z = 0;
-    weedSoilVol.grid.xlim_low = -0.35;
-    weedSoilVol.grid.xlim_high = 0.35;
-    weedSoilVol.grid.xres = 4;
-    weedSoilVol.grid.ylim_high = -0.25;
-    weedSoilVol.grid.ylim_low = 0.25;
-    weedSoilVol.grid.yres = 2;
-    weedSoilVol.grid.zlim_low = 0.80;
-    weedSoilVol.grid.zlim_high = 0.89;
-    weedSoilVol.grid.zres = 1;
-    weedSoilVol.allow_internal_paths = true;
-
+    // Weed soil volume grid, shared by every weeding node
     std::vector<target_volume> t_vols;
-    t_vols.push_back(weedSoilVol);
+    t_vols.push_back(weedingSoilVolume());
 
     /* Generate target joint values */
     ROS_INFO("Calculating target joint values.");
@@ -52,7 +68,14 @@ int main(int argc, char** argv)
 
     /* Generate trajectories */
     ROS_INFO("Building trajectory library.");
-    tlib.build();
+    if (use_roadmap)
+    {
+        tlib.buildRoadmap(roadmap);
+    }
+    else
+    {
+        tlib.build();
+    }
 
     tlib.exportToFile("plans_weeding.dat");
 
@@ -0,0 +1,96 @@
+#include "build_report.h"
+
+#include <algorithm>
+#include <fstream>
+
+void initPairStats(build_pair_stats& stats, int start_group, int start_target, int end_group, int end_target)
+{
+    stats.start_group = start_group;
+    stats.start_target = start_target;
+    stats.end_group = end_group;
+    stats.end_target = end_target;
+    stats.success = false;
+    stats.attempts = 0;
+    stats.planner_failures = 0;
+    stats.invalid_paths = 0;
+    stats.invalid_optimized = 0;
+    stats.planner_time = 0;
+    stats.optimize_time = 0;
+    stats.total_time = 0;
+    stats.wpts_planned = 0;
+    stats.wpts_optimized = 0;
+    stats.shortcut_checks = 0;
+    stats.duration = -1;
+    stats.planner.clear();
+    return;
+}
+
+bool BuildReport::writeCsv(const char* filename) const
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    file << "start_group,start_target,end_group,end_target,success,attempts,planner_failures,invalid_paths,invalid_optimized,"
+         << "planner_time,optimize_time,total_time,wpts_planned,wpts_optimized,shortcut_checks,duration,planner" << std::endl;
+    for (std::size_t i = 0; i < _pairs.size(); i++)
+    {
+        const build_pair_stats& p = _pairs[i];
+        file << p.start_group << ',' << p.start_target << ',' << p.end_group << ',' << p.end_target << ','
+             << (p.success ? 1 : 0) << ',' << p.attempts << ',' << p.planner_failures << ',' << p.invalid_paths << ','
+             << p.invalid_optimized << ',' << p.planner_time << ',' << p.optimize_time << ',' << p.total_time << ','
+             << p.wpts_planned << ',' << p.wpts_optimized << ',' << p.shortcut_checks << ',' << p.duration << ',' << p.planner << std::endl;
+    }
+    return file.good();
+}
+
+static bool slowerPair(const build_pair_stats* a, const build_pair_stats* b)
+{
+    return a->total_time > b->total_time;
+}
+
+void BuildReport::printInfo(std::ostream& cout) const
+{
+    int successes = 0;
+    int attempts = 0;
+    int planner_failures = 0;
+    int invalid = 0;
+    double planner_time = 0;
+    double optimize_time = 0;
+    double total_time = 0;
+    std::vector<const build_pair_stats*> sorted;
+    for (std::size_t i = 0; i < _pairs.size(); i++)
+    {
+        const build_pair_stats& p = _pairs[i];
+        successes += p.success;
+        attempts += p.attempts;
+        planner_failures += p.planner_failures;
+        invalid += p.invalid_paths + p.invalid_optimized;
+        planner_time += p.planner_time;
+        optimize_time += p.optimize_time;
+        total_time += p.total_time;
+        sorted.push_back(&p);
+    }
+
+    cout << "BuildReport: " << std::endl;
+    cout << "  Pairs: " << _pairs.size() << " (" << successes << " planned)" << std::endl;
+    cout << "  Planner attempts: " << attempts << " (" << planner_failures << " failed, " << invalid << " invalid)" << std::endl;
+    cout << "  Time: " << total_time << " s (planner " << planner_time << " s, optimize " << optimize_time << " s)" << std::endl;
+
+    std::size_t num_worst = std::min(sorted.size(), (std::size_t) BUILD_REPORT_WORST_PAIRS);
+    std::partial_sort(sorted.begin(), sorted.begin() + num_worst, sorted.end(), slowerPair);
+    if (num_worst > 0)
+    {
+        cout << "  Slowest pairs (group:target -> group:target):" << std::endl;
+    }
+    for (std::size_t i = 0; i < num_worst; i++)
+    {
+        const build_pair_stats& p = *sorted[i];
+        cout << "    " << p.start_group << ':' << p.start_target << " -> " << p.end_group << ':' << p.end_target
+             << "  " << p.total_time << " s, " << p.attempts << " attempts, "
+             << (p.success ? "planned" : "failed") << std::endl;
+    }
+    return;
+}
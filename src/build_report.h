@@ -0,0 +1,51 @@
+#ifndef BUILD_REPORT_H
+#define BUILD_REPORT_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define BUILD_REPORT_WORST_PAIRS 10     // slowest pairs listed by printInfo
+
+// What it took to plan one library target pair
+typedef struct {
+    int start_group;
+    int start_target;
+    int end_group;
+    int end_target;
+    bool success;
+    int attempts;               // planner calls, at most MAX_PLANNER_ATTEMPTS
+    int planner_failures;       // planner returned no path
+    int invalid_paths;          // planner path failed validation
+    int invalid_optimized;      // shortcut path failed validation
+    double planner_time;        // s in the planning pipeline, summed over attempts
+    double optimize_time;       // s shortcutting and time parameterizing, summed over attempts
+    double total_time;          // s for the whole pair
+    int wpts_planned;           // waypoints of the last planner path
+    int wpts_optimized;         // waypoints after shortcutting
+    int shortcut_checks;        // segment validity checks made while shortcutting
+    double duration;            // s, of the stored plan; < 0 if none
+    std::string planner;        // planner id that found the stored plan; empty if none
+} build_pair_stats;
+
+// Per-pair profile of a library build, to find the target pairs that eat the planner budget
+class BuildReport
+{
+    std::vector<build_pair_stats> _pairs;
+
+public:
+    inline void add(const build_pair_stats& stats) { _pairs.push_back(stats); }
+    inline void clear() { _pairs.clear(); }
+    inline std::size_t size() const { return _pairs.size(); }
+    inline const build_pair_stats& get(std::size_t i) const { return _pairs[i]; }
+
+    // One header line, then one line per pair
+    bool writeCsv(const char* filename) const;
+
+    void printInfo(std::ostream& cout) const;
+};
+
+// Fresh record for a pair that is about to be planned
+void initPairStats(build_pair_stats& stats, int start_group, int start_target, int end_group, int end_target);
+
+#endif // BUILD_REPORT_H
@@ -0,0 +1,98 @@
+#include "trajectory_library.h"
+#include "query_trace.h"
+
+
+int main(int argc, char** argv)
+{
+    ros::init(argc, argv, "Compact Library");
+    ros::NodeHandle nh("~");
+
+    std::string input_file;
+    std::string output_file;
+    double warp_radius;
+    double traj_tolerance;
+    nh.param("input", input_file, std::string("plans_weeding.dat"));
+    nh.param("output", output_file, std::string("plans_weeding_compact.dat"));
+    nh.param("warp_radius", warp_radius, 0.3);
+    nh.param("traj_tolerance", traj_tolerance, 0.5);
+
+    // Replay check: every dropped plan's endpoints are fitted against the compacted library
+    bool verify;
+    double verify_deadline;
+    double bush_radius;
+    std::string dropped_trace;
+    nh.param("verify", verify, true);
+    nh.param("verify_deadline", verify_deadline, 1.0);
+    nh.param("bush_radius", bush_radius, WEEDING_BUSH_RADIUS);
+    nh.param("dropped_trace", dropped_trace, output_file + ".dropped.txt");
+
+    TrajectoryLibrary tlib(nh);
+    if (verify)
+    {
+        tlib.initWorkspaceBounds();
+        tlib.addSphereCollisionObject(bush_radius);
+    }
+
+    // Import plans
+    tlib.importFromFile(input_file.c_str());
+
+    ROS_INFO("Compacting with warp radius %f and trajectory tolerance %f.", warp_radius, traj_tolerance);
+    std::vector<ur5_motion_plan> dropped_plans;
+    std::size_t dropped = tlib.compactLibrary(warp_radius, traj_tolerance, &dropped_plans);
+    ROS_INFO("Dropped %d redundant plans.", (int) dropped);
+
+    tlib.exportToFile(output_file.c_str());
+
+    // Queries the dropped plans used to answer, for replay_trace against the compacted library
+    std::vector<trace_query> queries(dropped_plans.size());
+    for (std::size_t i = 0; i < dropped_plans.size(); i++)
+    {
+        queries[i].start_jvals = dropped_plans[i].start_state.joint_state.position;
+        queries[i].end_jvals = dropped_plans[i].end_state.joint_state.position;
+    }
+    if (!dropped_trace.empty() && !queries.empty())
+    {
+        if (writeQueryTrace(queries, dropped_trace.c_str()))
+        {
+            ROS_INFO("Dropped plan queries written to %s.", dropped_trace.c_str());
+        }
+        else
+        {
+            ROS_ERROR("Could not write dropped plan queries to %s.", dropped_trace.c_str());
+        }
+    }
+
+    if (verify && !queries.empty())
+    {
+        int warped = 0;
+        int fallbacks = 0;
+        double duration_ratio = 0;
+        for (std::size_t i = 0; i < queries.size(); i++)
+        {
+            ur5_motion_plan plan;
+            fit_report report;
+            if (tlib.fitPlan(plan, queries[i].start_jvals, queries[i].end_jvals, verify_deadline, report) && !report.used_fallback)
+            {
+                warped++;
+                duration_ratio += plan.duration / dropped_plans[i].duration;
+            }
+            else if (report.used_fallback)
+            {
+                fallbacks++;
+            }
+        }
+        std::cout << "\nReplay check: " << warped << "/" << queries.size() << " dropped plans recovered by warping a kept plan, "
+                  << fallbacks << " straight-line fallbacks" << std::endl;
+        if (warped > 0)
+        {
+            std::cout << "  Mean duration ratio, warped / dropped: " << duration_ratio / warped << std::endl;
+        }
+        if (warped < (int) queries.size())
+        {
+            ROS_WARN("%d dropped plans could not be recovered; consider a smaller warp_radius or traj_tolerance.", (int) queries.size() - warped);
+        }
+    }
+
+    ros::shutdown();
+    return 0;
+}
@@ -0,0 +1,182 @@
+#include "coverage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+
+CoverageReport::CoverageReport(double gap_dist)
+{
+    if (gap_dist <= 0)
+    {
+        throw std::string("Coverage gap distance must be positive.");
+    }
+    _gap_dist = gap_dist;
+    return;
+}
+
+bool CoverageReport::isGap(const coverage_sample& sample) const
+{
+    return sample.distance < 0 || sample.distance > _gap_dist;
+}
+
+std::size_t CoverageReport::countGaps() const
+{
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < _samples.size(); i++)
+    {
+        if (isGap(_samples[i]))
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+static double gapSeverity(const coverage_sample& sample)
+{
+    // An empty library is as far away as it gets
+    return (sample.distance < 0) ? HUGE_VAL : sample.distance;
+}
+
+static bool furtherSample(const coverage_sample& a, const coverage_sample& b)
+{
+    return gapSeverity(a) > gapSeverity(b);
+}
+
+void CoverageReport::getGaps(std::vector<coverage_sample>& gaps) const
+{
+    gaps.clear();
+    for (std::size_t i = 0; i < _samples.size(); i++)
+    {
+        if (isGap(_samples[i]))
+        {
+            gaps.push_back(_samples[i]);
+        }
+    }
+    std::sort(gaps.begin(), gaps.end(), furtherSample);
+    return;
+}
+
+bool CoverageReport::writeCsv(const char* filename) const
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    file << "start_group,end_group,start_x,start_y,start_z,end_x,end_y,end_z,distance,gap" << std::endl;
+    for (std::size_t i = 0; i < _samples.size(); i++)
+    {
+        const coverage_sample& s = _samples[i];
+        file << s.start_group << ',' << s.end_group << ','
+             << s.start_position.x << ',' << s.start_position.y << ',' << s.start_position.z << ','
+             << s.end_position.x << ',' << s.end_position.y << ',' << s.end_position.z << ','
+             << s.distance << ',' << (isGap(s) ? 1 : 0) << std::endl;
+    }
+    return file.good();
+}
+
+typedef struct {
+    int samples;
+    int gaps;
+    coverage_sample example;    // furthest gap seen in the region
+} coverage_region;
+
+static void appendRegionKey(std::vector<int>& key, const geometry_msgs::Point& p)
+{
+    key.push_back((int) floor(p.x / COVERAGE_REGION_SIZE));
+    key.push_back((int) floor(p.y / COVERAGE_REGION_SIZE));
+    key.push_back((int) floor(p.z / COVERAGE_REGION_SIZE));
+    return;
+}
+
+static bool moreGaps(const coverage_region* a, const coverage_region* b)
+{
+    return a->gaps > b->gaps;
+}
+
+void CoverageReport::printInfo(std::ostream& cout) const
+{
+    std::vector<double> distances;
+    for (std::size_t i = 0; i < _samples.size(); i++)
+    {
+        if (_samples[i].distance >= 0)
+        {
+            distances.push_back(_samples[i].distance);
+        }
+    }
+    std::sort(distances.begin(), distances.end());
+
+    std::size_t num_gaps = countGaps();
+    cout << "CoverageReport: " << std::endl;
+    cout << "  Samples: " << _samples.size() << std::endl;
+    cout << "  Gaps (further than " << _gap_dist << "): " << num_gaps;
+    if (!_samples.empty())
+    {
+        cout << " (" << 100.0 * num_gaps / _samples.size() << "%)";
+    }
+    cout << std::endl;
+    if (!distances.empty())
+    {
+        cout << "  Distance to nearest plan: p50 " << distances[distances.size() / 2]
+             << ", p90 " << distances[(distances.size() * 9) / 10]
+             << ", max " << distances.back() << std::endl;
+    }
+
+    // Bin by start and end region, so a gap names the part of the volume to add targets to
+    std::map< std::vector<int>, coverage_region > regions;
+    for (std::size_t i = 0; i < _samples.size(); i++)
+    {
+        const coverage_sample& s = _samples[i];
+        std::vector<int> key;
+        key.push_back(s.start_group);
+        key.push_back(s.end_group);
+        appendRegionKey(key, s.start_position);
+        appendRegionKey(key, s.end_position);
+
+        std::map< std::vector<int>, coverage_region >::iterator it = regions.find(key);
+        if (it == regions.end())
+        {
+            coverage_region region;
+            region.samples = 0;
+            region.gaps = 0;
+            region.example = s;
+            it = regions.insert(std::make_pair(key, region)).first;
+        }
+        it->second.samples++;
+        if (isGap(s))
+        {
+            if (it->second.gaps == 0 || furtherSample(s, it->second.example))
+            {
+                it->second.example = s;
+            }
+            it->second.gaps++;
+        }
+    }
+
+    std::vector<const coverage_region*> sorted;
+    for (std::map< std::vector<int>, coverage_region >::const_iterator it = regions.begin(); it != regions.end(); ++it)
+    {
+        if (it->second.gaps > 0)
+        {
+            sorted.push_back(&it->second);
+        }
+    }
+    std::size_t num_worst = std::min(sorted.size(), (std::size_t) COVERAGE_WORST_REGIONS);
+    std::partial_sort(sorted.begin(), sorted.begin() + num_worst, sorted.end(), moreGaps);
+    if (num_worst > 0)
+    {
+        cout << "  Uncovered regions (" << COVERAGE_REGION_SIZE << " m cubes, worst example start -> end):" << std::endl;
+    }
+    for (std::size_t i = 0; i < num_worst; i++)
+    {
+        const coverage_region& r = *sorted[i];
+        const coverage_sample& e = r.example;
+        cout << "    " << r.gaps << "/" << r.samples << " gaps, group " << e.start_group << " (" << e.start_position.x << ", "
+             << e.start_position.y << ", " << e.start_position.z << ") -> group " << e.end_group << " (" << e.end_position.x
+             << ", " << e.end_position.y << ", " << e.end_position.z << "), distance " << e.distance << std::endl;
+    }
+    return;
+}
@@ -0,0 +1,52 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include "kd_tree.h"
+
+#include <geometry_msgs/Point.h>
+
+#include <iostream>
+#include <vector>
+
+#define COVERAGE_REGION_SIZE 0.1        // side of the cubes (m) that samples are binned into for the region summary
+#define COVERAGE_WORST_REGIONS 10       // regions listed by printInfo
+
+// One random query drawn from the target volumes
+typedef struct {
+    int start_group;
+    int end_group;
+    geometry_msgs::Point start_position;    // end effector target, world frame
+    geometry_msgs::Point end_position;
+    joint_values_t start_jvals;
+    joint_values_t end_jvals;
+    double distance;                        // summed joint distance to the nearest library plan, < 0 if the library is empty
+} coverage_sample;
+
+// How well the library reaches the target volumes. Samples further than gap_dist from every plan
+// are gaps: their queries need long warps or fall back to a straight line.
+class CoverageReport
+{
+    double _gap_dist;
+    std::vector<coverage_sample> _samples;
+
+public:
+    CoverageReport(double gap_dist);
+
+    inline void add(const coverage_sample& sample) { _samples.push_back(sample); }
+    inline void clear() { _samples.clear(); }
+    inline std::size_t size() const { return _samples.size(); }
+    inline double getGapDistance() const { return _gap_dist; }
+
+    bool isGap(const coverage_sample& sample) const;
+    std::size_t countGaps() const;
+    // Gap samples, furthest from the library first
+    void getGaps(std::vector<coverage_sample>& gaps) const;
+
+    // One header line, then one line per sample
+    bool writeCsv(const char* filename) const;
+
+    // Distance percentiles, then the start/end regions with the most gaps
+    void printInfo(std::ostream& cout) const;
+};
+
+#endif // COVERAGE_H
@@ -0,0 +1,64 @@
+#include "trajectory_library.h"
+
+
+int main(int argc, char** argv)
+{
+    ros::init(argc, argv, "Library Coverage");
+    ros::NodeHandle nh("~");
+
+    double BUSH_RADIUS;
+    nh.param("bush_radius", BUSH_RADIUS, WEEDING_BUSH_RADIUS);
+
+    std::string library_file;
+    std::string output_file;
+    std::string report_file;
+    int num_samples;
+    double gap_dist;
+    int seed;
+    int build_gaps;
+    nh.param("library", library_file, std::string("plans_weeding.dat"));
+    nh.param("output", output_file, library_file);
+    nh.param("report", report_file, library_file + ".coverage.csv");
+    nh.param("samples", num_samples, 1000);
+    nh.param("gap_dist", gap_dist, 0.3);
+    nh.param("seed", seed, 1);
+    nh.param("build_gaps", build_gaps, 0);
+
+    TrajectoryLibrary tlib(nh);
+    tlib.initWorkspaceBounds();
+    tlib.addSphereCollisionObject(BUSH_RADIUS);
+
+    // Weed soil volume grid, shared by every weeding node
+    std::vector<target_volume> t_vols;
+    t_vols.push_back(weedingSoilVolume());
+    tlib.setTargetVolumes(t_vols);
+
+    // Import plans
+    tlib.importFromFile(library_file.c_str());
+
+    CoverageReport report(gap_dist);
+    srand(seed);
+    tlib.analyzeCoverage(report, num_samples);
+    report.printInfo(std::cout);
+    if (report.writeCsv(report_file.c_str()))
+    {
+        ROS_INFO("Coverage samples written to %s.", report_file.c_str());
+    }
+
+    // Incremental build: plan only where the library is thin, then measure again with the same seed
+    if (build_gaps > 0)
+    {
+        std::size_t added = tlib.buildGaps(report, build_gaps);
+        ROS_INFO("Added %d plans in coverage gaps.", (int) added);
+        tlib.exportToFile(output_file.c_str());
+
+        CoverageReport after(gap_dist);
+        srand(seed);
+        tlib.analyzeCoverage(after, num_samples);
+        ROS_INFO("Coverage after incremental build:");
+        after.printInfo(std::cout);
+    }
+
+    ros::shutdown();
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "trajectory_library.h"
+#include "trace_span.h"
 
 
 int main(int argc, char** argv)
@@ -7,44 +8,96 @@ int main(int argc, char** argv)
     ros::NodeHandle nh("~");
 
     double BUSH_RADIUS;
-    if (nh.hasParam("bush_radius"))
-    {
-        nh.getParam("bush_radius", BUSH_RADIUS);
-    }
+    nh.param("bush_radius", BUSH_RADIUS, WEEDING_BUSH_RADIUS);
 
     TrajectoryLibrary tlib(nh);
     tlib.initWorkspaceBounds();
     tlib.addSphereCollisionObject(BUSH_RADIUS);
     tlib.printCollisionWorldInfo(std::cout);
 
-    // Define weed soil volume grid
-    target_volume weedSoilVol;
-    weedSoilVol.type = GRID_RECT;
-    weedSoilVol.grid.orientation.w = sqrt(0.5);
-    weedSoilVol.grid.orientation.x = 0;
-    weedSoilVol.grid.orientation.y = -sqrt(0.5);
-    weedSoilVol.grid.orientation.z = 0;
-    weedSoilVol.grid.xlim_low = -0.35;
-    weedSoilVol.grid.xlim_high = 0.35;
-    weedSoilVol.grid.xres = 4;
-    weedSoilVol.grid.ylim_high = -0.25;
-    weedSoilVol.grid.ylim_low = 0.25;
-    weedSoilVol.grid.yres = 2;
-    weedSoilVol.grid.zlim_low = 0.80;
-    weedSoilVol.grid.zlim_high = 0.89;
-    weedSoilVol.grid.zres = 1;
-    weedSoilVol.allow_internal_paths = true;
+    // Warp optimizer settings
+    warp_params wparams = tlib.getWarpParams();
+    nh.param("gdw_method", wparams.method, wparams.method);
+    nh.param("gdw_max_iterations", wparams.max_iterations, wparams.max_iterations);
+    nh.param("gdw_max_time", wparams.max_time, wparams.max_time);
+    tlib.setWarpParams(wparams);
+
+    // Per-target planning latency budget (s), 0 to wait for the first successful warp
+    double fit_deadline;
+    nh.param("fit_deadline", fit_deadline, 0.0);
+
+    // Number of library hits warped concurrently, 0 to warp one at a time
+    int fit_parallel_hits;
+    nh.param("fit_parallel_hits", fit_parallel_hits, 0);
+
+    // Plan the next target while the current one executes
+    bool pipelined;
+    nh.param("pipelined", pipelined, false);
+
+    // Targets detected per batch and visited in sequenced order (pipelined demo only), 0 for one at a time
+    int batch_size;
+    nh.param("batch_size", batch_size, 0);
 
+    // Weed soil volume grid, shared by every weeding node
     std::vector<target_volume> t_vols;
-    t_vols.push_back(weedSoilVol);
+    t_vols.push_back(weedingSoilVolume());
     tlib.setTargetVolumes(t_vols);
 
     // Import plans
     tlib.importFromFile("plans_weeding.dat");
 
+    // Optionally grow the library with fitted plans
+    learning_params lparams;
+    nh.param("learn", lparams.enabled, false);
+    nh.param("learn_novelty_dist", lparams.novelty_dist, 0.2);
+    nh.param("learn_max_cell_plans", lparams.max_cell_plans, 50);
+    nh.param("learn_flush_period", lparams.flush_period, 60.0);
+    nh.param("learn_filename", lparams.filename, std::string("plans_weeding_learned.dat"));
+    tlib.setLearningParams(lparams);
+
+    // Optionally log every query for replay_trace
+    std::string trace_filename;
+    nh.param("record_trace", trace_filename, std::string(""));
+    if (!trace_filename.empty())
+    {
+        tlib.recordTrace(trace_filename);
+    }
+
+    // Metrics JSON on /apple_crusher/metrics every metrics_period s, and to metrics_file on exit
+    double metrics_period;
+    std::string metrics_filename;
+    nh.param("metrics_period", metrics_period, 0.0);
+    nh.param("metrics_file", metrics_filename, std::string(""));
+    tlib.setMetricsPeriod(metrics_period);
+
+    // Chrome trace of every query, written on exit; needs a build with APPLE_CRUSHER_TRACING
+    std::string spans_filename;
+    nh.param("spans_file", spans_filename, std::string(""));
+    if (!spans_filename.empty() && !Tracer::enable(true))
+    {
+        ROS_WARN("Trace spans are compiled out; %s will not be written.", spans_filename.c_str());
+        spans_filename.clear();
+    }
+
     ROS_INFO("Hit enter to begin demo.");
     std::cin.ignore(100, '\n');
-    tlib.demo();
+    if (pipelined)
+    {
+        tlib.demoPipelined(fit_deadline, fit_parallel_hits, batch_size);
+    }
+    else
+    {
+        tlib.demo(fit_deadline, fit_parallel_hits);
+    }
+
+    if (!metrics_filename.empty())
+    {
+        tlib.writeMetrics(metrics_filename);
+    }
+    if (!spans_filename.empty() && !Tracer::writeChromeJson(spans_filename))
+    {
+        ROS_ERROR("Could not write trace spans to %s.", spans_filename.c_str());
+    }
 
     ros::shutdown();
     return 0;
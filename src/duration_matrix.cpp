@@ -0,0 +1,165 @@
+#include "duration_matrix.h"
+
+#include <algorithm>
+#include <fstream>
+
+DurationMatrix::DurationMatrix()
+{
+    _target_count = 0;
+    return;
+}
+
+void DurationMatrix::resize(const std::vector<int>& group_sizes)
+{
+    _group_sizes = group_sizes;
+    _offsets.clear();
+    _target_count = 0;
+    for (int g = 0; g < _group_sizes.size(); g++)
+    {
+        _offsets.push_back(_target_count);
+        _target_count += _group_sizes[g];
+    }
+    _durations.assign(_target_count * _target_count, DURATION_NOT_PLANNED);
+    return;
+}
+
+bool DurationMatrix::grow(const std::vector<int>& group_sizes)
+{
+    if (group_sizes.size() < _group_sizes.size())
+    {
+        return false;
+    }
+    for (int g = 0; g < _group_sizes.size(); g++)
+    {
+        if (group_sizes[g] < _group_sizes[g])
+        {
+            return false;
+        }
+    }
+
+    DurationMatrix old = *this;
+    resize(group_sizes);
+    for (int sg = 0; sg < old.getGroupCount(); sg++)
+    {
+        for (int st = 0; st < old.getGroupSize(sg); st++)
+        {
+            for (int eg = 0; eg < old.getGroupCount(); eg++)
+            {
+                for (int et = 0; et < old.getGroupSize(eg); et++)
+                {
+                    set(sg, st, eg, et, old.get(sg, st, eg, et));
+                }
+            }
+        }
+    }
+    return true;
+}
+
+std::size_t DurationMatrix::countFeasible() const
+{
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < _durations.size(); i++)
+    {
+        if (_durations[i] >= 0)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+std::size_t DurationMatrix::countFailed() const
+{
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < _durations.size(); i++)
+    {
+        if (_durations[i] == DURATION_FAILED)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+bool DurationMatrix::write(const char* filename) const
+{
+    std::ofstream file;
+    file.open(filename, std::ofstream::out | std::ofstream::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    int group_count = _group_sizes.size();
+    file.write((char *)(&group_count), sizeof(group_count));
+    for (int g = 0; g < group_count; g++)
+    {
+        file.write((char *)(&_group_sizes[g]), sizeof(int));
+    }
+    if (!_durations.empty())
+    {
+        file.write((char *)(&_durations[0]), _durations.size() * sizeof(double));
+    }
+
+    bool ok = file.good();
+    file.close();
+    return ok;
+}
+
+bool DurationMatrix::read(const char* filename)
+{
+    std::ifstream file;
+    file.open(filename, std::ifstream::in | std::ifstream::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    // Parse into a scratch matrix, so a bad file leaves this one untouched
+    int group_count;
+    file.read((char *)(&group_count), sizeof(group_count));
+    if (!file || group_count < 0 || group_count > DURATION_MATRIX_MAX_GROUPS)
+    {
+        return false;
+    }
+    std::vector<int> group_sizes(group_count);
+    std::size_t target_count = 0;
+    for (int g = 0; g < group_count; g++)
+    {
+        file.read((char *)(&group_sizes[g]), sizeof(int));
+        if (!file || group_sizes[g] < 0)
+        {
+            return false;
+        }
+        target_count += group_sizes[g];
+        if (target_count > DURATION_MATRIX_MAX_TARGETS)
+        {
+            return false;
+        }
+    }
+
+    DurationMatrix matrix;
+    matrix.resize(group_sizes);
+    if (!matrix._durations.empty())
+    {
+        file.read((char *)(&matrix._durations[0]), matrix._durations.size() * sizeof(double));
+        if (!file)
+        {
+            return false;
+        }
+    }
+    file.close();
+
+    std::swap(*this, matrix);
+    return true;
+}
+
+void DurationMatrix::printInfo(std::ostream& cout) const
+{
+    cout << "DurationMatrix: " << std::endl;
+    cout << "  Groups: " << _group_sizes.size() << std::endl;
+    cout << "  Targets: " << _target_count << std::endl;
+    cout << "  Feasible pairs: " << countFeasible() << std::endl;
+    cout << "  Failed pairs: " << countFailed() << std::endl;
+    return;
+}
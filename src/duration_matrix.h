@@ -0,0 +1,59 @@
+#ifndef DURATION_MATRIX_H
+#define DURATION_MATRIX_H
+
+#include <iostream>
+#include <vector>
+
+#define DURATION_NOT_PLANNED -1.0   // pair was never attempted (e.g. same target, or internal paths disabled)
+#define DURATION_FAILED -2.0        // planner could not find a valid path
+#define DURATION_MATRIX_MAX_GROUPS 64       // read() rejects files claiming more
+#define DURATION_MATRIX_MAX_TARGETS 10000   // read() rejects files claiming more, 800 MB of durations
+
+// Dense travel-time table between all library targets. Targets of every group are laid out
+// back to back, so each (start group, end group) pair is one block of the matrix.
+class DurationMatrix
+{
+    std::vector<int> _group_sizes;
+    std::vector<std::size_t> _offsets;      // global index of each group's first target
+    std::size_t _target_count;
+    std::vector<double> _durations;         // row-major, _target_count x _target_count
+
+    inline std::size_t index(int start_group, int start_target, int end_group, int end_target) const
+    {
+        return ((_offsets[start_group] + start_target) * _target_count) + _offsets[end_group] + end_target;
+    }
+
+public:
+    DurationMatrix();
+
+    void resize(const std::vector<int>& group_sizes);
+    // Append targets to groups, keeping every existing entry; false if any group would shrink
+    bool grow(const std::vector<int>& group_sizes);
+    inline std::size_t getTargetCount() const { return _target_count; }
+    inline int getGroupCount() const { return _group_sizes.size(); }
+    inline int getGroupSize(int group) const { return _group_sizes[group]; }
+
+    inline void set(int start_group, int start_target, int end_group, int end_target, double duration)
+    {
+        _durations[ index(start_group, start_target, end_group, end_target) ] = duration;
+    }
+    inline double get(int start_group, int start_target, int end_group, int end_target) const
+    {
+        return _durations[ index(start_group, start_target, end_group, end_target) ];
+    }
+    inline bool feasible(int start_group, int start_target, int end_group, int end_target) const
+    {
+        return get(start_group, start_target, end_group, end_target) >= 0;
+    }
+
+    std::size_t countFeasible() const;
+    std::size_t countFailed() const;
+
+    bool write(const char* filename) const;
+    // Leaves the matrix unchanged and returns false on a missing, truncated or implausible file
+    bool read(const char* filename);
+
+    void printInfo(std::ostream& cout) const;
+};
+
+#endif // DURATION_MATRIX_H
@@ -1,48 +1,163 @@
 #include "kd_tree.h"
+#include "trace_span.h"
+
+#include <ros/console.h>
+
+#include <algorithm>
 
 //////////////// Cell Class definitions
 
-Cell::Cell(const std::vector<std::size_t> & coords)
+template <std::size_t DIM>
+CellT<DIM>::CellT(const coords_t& coords)
 {
     _coords = coords;
-    _dimension = _coords.size();
+    _level = 0;
+    _split_dim = 0;
+    _split_value = 0;
+    _split_retry_size = 0;
     return;
 }
 
-bool operator== (const Cell& lhs, const Cell& rhs)
+template <std::size_t DIM>
+void CellT<DIM>::addValue(std::size_t val, const std::vector<point_t>& points, std::size_t threshold)
 {
-    if (lhs._dimension != rhs._dimension)
+    _values.push_back(val);
+
+    if (!isLeaf())
+    {
+        // Pass down to the matching half
+        if (points[val][_split_dim] < _split_value)
+        {
+            _low->addValue(val, points, threshold);
+        }
+        else
+        {
+            _high->addValue(val, points, threshold);
+        }
+        return;
+    }
+
+    if (_values.size() > threshold && _values.size() >= _split_retry_size && _level < KDTREE_MAX_SPLIT_LEVEL)
     {
+        // Each attempt scans every plan in the cell, so back off geometrically rather than retrying on every add
+        if (!split(points, threshold))
+        {
+            _split_retry_size = 2 * _values.size();
+        }
+    }
+    return;
+}
+
+template <std::size_t DIM>
+bool CellT<DIM>::split(const std::vector<point_t>& points, std::size_t threshold)
+{
+    // Find widest populated dimension
+    double widest = 0;
+    std::size_t widest_dim = 0;
+    for (std::size_t d = 0; d < DIM; d++)
+    {
+        double lo = points[ _values[0] ][d];
+        double hi = lo;
+        for (std::size_t i = 1; i < _values.size(); i++)
+        {
+            lo = std::min(lo, points[ _values[i] ][d]);
+            hi = std::max(hi, points[ _values[i] ][d]);
+        }
+        if (hi - lo > widest)
+        {
+            widest = hi - lo;
+            widest_dim = d;
+        }
+    }
+    if (widest <= 0)
+    {
+        // All plans coincide; nothing to separate
         return false;
     }
 
-    for (int i=0; i < lhs._dimension; i++)
+    // Split at the median
+    std::vector<double> vals;
+    vals.reserve(_values.size());
+    for (std::size_t i = 0; i < _values.size(); i++)
+    {
+        vals.push_back(points[ _values[i] ][widest_dim]);
+    }
+    std::nth_element(vals.begin(), vals.begin() + vals.size()/2, vals.end());
+    double split_value = vals[ vals.size()/2 ];
+
+    // Make sure neither half ends up empty
+    std::size_t low_count = 0;
+    for (std::size_t i = 0; i < vals.size(); i++)
     {
-        if (lhs._coords[i] != rhs._coords[i])
+        if (vals[i] < split_value)
         {
-            return false;
+            low_count++;
+        }
+    }
+    if (low_count == 0)
+    {
+        return false;
+    }
+
+    _split_dim = widest_dim;
+    _split_value = split_value;
+    _low.reset(new CellT(_coords));
+    _high.reset(new CellT(_coords));
+    _low->_level = _level + 1;
+    _high->_level = _level + 1;
+    for (std::size_t i = 0; i < _values.size(); i++)
+    {
+        if (points[ _values[i] ][_split_dim] < _split_value)
+        {
+            _low->addValue(_values[i], points, threshold);
+        }
+        else
+        {
+            _high->addValue(_values[i], points, threshold);
         }
     }
     return true;
 }
 
-bool operator!= (const Cell& lhs, const Cell& rhs)
+template <std::size_t DIM>
+void CellT<DIM>::collectPools(std::vector< std::vector<std::size_t> >& pools, const point_t& point)
 {
-    return !(lhs == rhs);
+    if (isLeaf())
+    {
+        pools.push_back(_values);
+        return;
+    }
+
+    // Descend towards point first, then fall back on the other half at each level
+    boost::shared_ptr<CellT> near_cell = (point[_split_dim] < _split_value) ? _low : _high;
+    boost::shared_ptr<CellT> far_cell = (point[_split_dim] < _split_value) ? _high : _low;
+    near_cell->collectPools(pools, point);
+    pools.push_back(far_cell->getValues());
+    return;
 }
 
-std::size_t Cell::rectDistFrom(const cell_coords_t& coords)
+template <std::size_t DIM>
+std::size_t CellT<DIM>::countLeaves()
 {
-    if (coords.size() != _dimension)
+    if (isLeaf())
     {
-        throw "Dimension mismatch.";
-        return 0;
+        return 1;
     }
+    return _low->countLeaves() + _high->countLeaves();
+}
 
+template <std::size_t DIM>
+std::size_t CellT<DIM>::rectDistFrom(const coords_t& coords, const boost::array<bool, DIM>& periodic, const coords_t& resolution)
+{
     std::size_t max_dist = 0;
-    for (int i=0; i < _dimension; i++)
+    for (std::size_t i=0; i < DIM; i++)
     {
-        std::size_t dist = abs(coords[i] - _coords[i]);
+        // Coordinates are unsigned, so subtract the smaller from the larger
+        std::size_t dist = (coords[i] > _coords[i]) ? (coords[i] - _coords[i]) : (_coords[i] - coords[i]);
+        if (periodic[i])
+        {
+            dist = std::min(dist, resolution[i] - dist);
+        }
         if (dist > max_dist)
         {
             max_dist = dist;
@@ -54,81 +169,168 @@ std::size_t Cell::rectDistFrom(const cell_coords_t& coords)
 
 ////////////////// KDTree Class definitions
 
-KDTree::KDTree(robot_model::RobotModelPtr& rmodel, const std::vector<double>& low_bounds, const std::vector<double>& high_bounds, const std::vector<std::size_t>& resolution)
+template <std::size_t DOF>
+const std::size_t KDTreeT<DOF>::DIM;
+
+template <std::size_t DOF>
+KDTreeT<DOF>::KDTreeT(robot_model::RobotModelPtr& rmodel, const std::vector<double>& low_bounds, const std::vector<double>& high_bounds, const std::vector<std::size_t>& resolution)
 {
     // Store pointer to robot model
     _rmodel = rmodel;
 
-    // Extract dimension from model
     // Represent start and end joint-space positions as single point (dim = 2*numJoints)
-    _dimension = 2 * _rmodel->getVariableCount();
-    if (low_bounds.size() != _dimension)
+    if (_rmodel->getVariableCount() != DOF)
+    {
+        throw std::string("Robot model joint count does not match KDTree DOF.");
+    }
+    if (low_bounds.size() != DIM)
     {
         throw std::string("Dimension mismatch.");
     }
-    if (high_bounds.size() != _dimension)
+    if (high_bounds.size() != DIM)
     {
         throw std::string("Dimension mismatch.");
     }
-    if (resolution.size() != _dimension)
+    if (resolution.size() != DIM)
     {
         throw std::string("Dimension mismatch.");
     }
 
-    _bounds_low = low_bounds;
-    _bounds_high = high_bounds;
-    _resolution = resolution;
+    for (std::size_t i = 0; i < DIM; i++)
+    {
+        _bounds_low[i] = low_bounds[i];
+        _bounds_high[i] = high_bounds[i];
+        _resolution[i] = resolution[i];
+    }
+
+    // Unbounded (continuous) joints are periodic: their cells span exactly one turn
+    const std::vector<std::string>& var_names = _rmodel->getVariableNames();
+    _periodic.assign(false);
+    for (std::size_t i = 0; i < DOF; i++)
+    {
+        if (!_rmodel->getVariableBounds(var_names[i]).position_bounded_)
+        {
+            _periodic[i] = true;
+            _periodic[i + DOF] = true;
+            _bounds_low[i] = _bounds_low[i + DOF] = -M_PI;
+            _bounds_high[i] = _bounds_high[i + DOF] = M_PI;
+        }
+    }
 
     // Calculate index increments
-    for (int i = 0; i < _dimension; i++)
+    for (std::size_t i = 0; i < DIM; i++)
     {
-        _cell_increments.push_back( (_bounds_high[i] - _bounds_low[i]) / _resolution[i] );
+        _cell_increments[i] = (_bounds_high[i] - _bounds_low[i]) / _resolution[i];
     }
 
     _plan_count = 0;
+    _max_wpts = 0;
     _cell_count = 0;
+    _split_threshold = KDTREE_SPLIT_THRESHOLD;
+    _candidates_scored = NULL;
+    _lookup_depth = NULL;
 
     return;
 }
 
-void KDTree::printInfo(std::ostream &cout)
+template <std::size_t DOF>
+void KDTreeT<DOF>::printInfo(std::ostream &cout)
 {
+    boost::mutex::scoped_lock lock(_mutex);
+
     cout << "KDTree: " << std::endl;
-    cout << "  Dimensions: " << _dimension << std::endl;
+    cout << "  Dimensions: " << DIM << std::endl;
     cout << "  Low bounds: ";
-    for (int i=0; i < _dimension; i++)
+    for (std::size_t i=0; i < DIM; i++)
     {
         cout << _bounds_low[i] << ' ';
     }
     cout << "\n  High bounds: ";
-    for (int i=0; i < _dimension; i++)
+    for (std::size_t i=0; i < DIM; i++)
     {
         cout << _bounds_high[i] << ' ';
     }
     cout << std::endl;
     cout << "  Number of plans: " << _plan_count << std::endl;
     cout << "  Number of populated cells: " << _cell_count << std::endl;
+    std::size_t leaf_count = 0;
+    for (std::size_t i = 0; i < _cell_count; i++)
+    {
+        leaf_count += _cells[i].countLeaves();
+    }
+    cout << "  Number of leaf cells after refinement: " << leaf_count << std::endl;
     return;
 }
 
-cell_coords_t KDTree::calcCoords(const joint_values_t &jvals)
+template <std::size_t DOF>
+typename KDTreeT<DOF>::point_t KDTreeT<DOF>::makePoint(const joint_values_t& start_jvals, const joint_values_t& end_jvals)
 {
-    cell_coords_t coords;
-    if (jvals.size() > _dimension)
+    if (start_jvals.size() != DOF || end_jvals.size() != DOF)
     {
-        throw "Cannot calculate cell coordinates of joint value list with size higher than _dimension.";
+        throw std::string("Joint value count does not match KDTree DOF.");
     }
 
-    for (int i = 0; i < jvals.size(); i++)
+    point_t point;
+    for (std::size_t i = 0; i < DOF; i++)
     {
-        double f_index = floor( (jvals[i] - _bounds_low[i]) / _cell_increments[i] );
-        coords.push_back((coord_t) f_index);
+        point[i] = start_jvals[i];
+        point[i + DOF] = end_jvals[i];
+    }
+    wrapPoint(point);
+    return point;
+}
+
+template <std::size_t DOF>
+typename KDTreeT<DOF>::coords_t KDTreeT<DOF>::calcCoords(const point_t& point)
+{
+    coords_t coords;
+    for (std::size_t i = 0; i < DIM; i++)
+    {
+        double f_index = floor( (point[i] - _bounds_low[i]) / _cell_increments[i] );
+
+        // Points outside the bounds belong to the edge cells
+        f_index = std::max(0.0, std::min(f_index, (double) (_resolution[i] - 1)));
+        coords[i] = (coord_t) f_index;
     }
     return coords;
 }
 
-void KDTree::searchCellsAtNextDistance()
+template <std::size_t DOF>
+void KDTreeT<DOF>::wrapPoint(point_t& point)
 {
+    for (std::size_t i = 0; i < DIM; i++)
+    {
+        if (_periodic[i])
+        {
+            point[i] -= 2*M_PI * floor( (point[i] + M_PI) / (2*M_PI) );
+        }
+    }
+    return;
+}
+
+template <std::size_t DOF>
+double KDTreeT<DOF>::pointDistance(const point_t& a, const point_t& b)
+{
+    // Summed joint distance, as RobotState::distance for revolute joints, taking the short way round periodic ones.
+    // Both points are wrapped, so a periodic difference never exceeds one turn.
+    double dist = 0;
+    for (std::size_t i = 0; i < DIM; i++)
+    {
+        double d = fabs(a[i] - b[i]);
+        if (_periodic[i])
+        {
+            d = std::min(d, 2*M_PI - d);
+        }
+        dist += d;
+    }
+    return dist;
+}
+
+template <std::size_t DOF>
+void KDTreeT<DOF>::searchCellsAtNextDistance()
+{
+    TRACE_SPAN("KDTree::searchCellsAtNextDistance");
+
     /* Build plan search pool */
     std::vector<std::size_t> pool;
 
@@ -137,54 +339,79 @@ void KDTree::searchCellsAtNextDistance()
     // std::cout << "Expanding search to level " << _search_depth << std::endl;
 
     // Search through our cell map for cells at the correct distance from target
-    for (int c=0; c < _cell_count; c++)
+    collectPlansAtDistance(pool, _target_coords, _search_depth);
+
+    // Now sort the pool
+    linearSort(pool);
+}
+
+template <std::size_t DOF>
+void KDTreeT<DOF>::collectPlansAtDistance(std::vector<std::size_t>& pool, const coords_t& coords, std::size_t depth)
+{
+    for (std::size_t c=0; c < _cell_count; c++)
     {
-        if (_cells[c].rectDistFrom(_target_coords) == _search_depth)
+        if (_cells[c].rectDistFrom(coords, _periodic, _resolution) == depth)
         {
-            std::vector<std::size_t> plan_indices = _cells[c].getValues();
-            for (int i=0; i < plan_indices.size(); i++)
+            const std::vector<std::size_t>& plan_indices = _cells[c].getValues();
+            for (std::size_t i=0; i < plan_indices.size(); i++)
             {
                 pool.push_back(plan_indices[i]);
             }
         }
     }
+    return;
+}
 
-    // Now sort the pool
-    linearSort(pool);
+template <std::size_t DOF>
+void KDTreeT<DOF>::setMetrics(MetricsRegistry& metrics)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    _candidates_scored = metrics.counter("kdtree.candidates_scored");
+    _lookup_depth = metrics.histogram("kdtree.lookup_depth", "cells", linearBuckets(0, 1, METRICS_MAX_BUCKETS));
+    return;
 }
 
-void KDTree::add(const ur5_motion_plan & plan)
+template <std::size_t DOF>
+void KDTreeT<DOF>::add(const ur5_motion_plan & plan)
 {
-    // First make sure plan start state and end state are within range
-    for (int i=0; i < (_dimension/2); i++)
+    boost::mutex::scoped_lock lock(_mutex);
+
+    const joint_values_t& start_jvals = plan.start_state.joint_state.position;
+    const joint_values_t& end_jvals = plan.end_state.joint_state.position;
+    if (start_jvals.size() != DOF || end_jvals.size() != DOF)
+    {
+        throw std::string("Plan joint count does not match KDTree DOF. Cannot add plan to KDTree.");
+    }
+
+    // First make sure plan start state and end state are within range (periodic joints always are)
+    for (std::size_t i=0; i < DOF; i++)
     {
-        if (plan.start_state.joint_state.position[i] < _bounds_low[i] || plan.start_state.joint_state.position[i] > _bounds_high[i])
+        if (_periodic[i])
+        {
+            continue;
+        }
+        if (start_jvals[i] < _bounds_low[i] || start_jvals[i] > _bounds_high[i])
         {
             throw std::string("Plan start state out of bounds. Cannot add plan to KDTree.");
         }
-        if (plan.end_state.joint_state.position[i] < _bounds_low[i + (_dimension/2)] || plan.end_state.joint_state.position[i] > _bounds_high[i + (_dimension/2)])
+        if (end_jvals[i] < _bounds_low[i + DOF] || end_jvals[i] > _bounds_high[i + DOF])
         {
             throw std::string("Plan end state out of bounds. Cannot add plan to KDTree.");
         }
     }
 
+    // Combine joint values for start and end states into single point
+    point_t point = makePoint(start_jvals, end_jvals);
+
     // Add plan to data vector
     std::size_t plan_num = _plan_count;
-    _plans.push_back(plan);
+    _plans.push_back(plan_handle_t(new ur5_motion_plan(plan)));
+    _points.push_back(point);
     _plan_count++;
-
-    // Combine joint values for start and end states into single vector
-    std::vector<double> jvals;
-    jvals.reserve(2 * plan.start_state.joint_state.position.size());
-
-    jvals = plan.start_state.joint_state.position;
-    for (int i=0; i < plan.end_state.joint_state.position.size(); i++)
-    {
-        jvals.push_back(plan.end_state.joint_state.position[i]);
-    }
+    _max_wpts = std::max(_max_wpts, plan.trajectory.joint_trajectory.points.size());
 
     // Calculate cell coordinates
-    cell_coords_t coords = calcCoords(jvals);
+    coords_t coords = calcCoords(point);
 
     // Search for cell in our vector
     bool found = false;
@@ -193,57 +420,126 @@ void KDTree::add(const ur5_motion_plan & plan)
         if (_cells[i].getCoords() == coords)
         {
             found = true;
-            _cells[i].addValue(plan_num);
+            _cells[i].addValue(plan_num, _points, _split_threshold);
         }
     }
     // If not found
     if (!found)
     {
         // Create new cell
-        Cell cell(coords);
-        cell.addValue(plan_num);
+        cell_t cell(coords);
+        cell.addValue(plan_num, _points, _split_threshold);
         _cells.push_back(cell);
         _cell_count++;
     }
     return;
 }
 
-const ur5_motion_plan& KDTree::getRandomPlan()
+template <std::size_t DOF>
+void KDTreeT<DOF>::clear()
+{
+    boost::mutex::scoped_lock lock(_mutex);
+
+    _plans.clear();
+    _points.clear();
+    _plan_count = 0;
+    _max_wpts = 0;
+    _cells.clear();
+    _cell_count = 0;
+    _proximity_ordering.clear();
+    _search_depth = 0;
+    return;
+}
+
+template <std::size_t DOF>
+void KDTreeT<DOF>::copyPlanData(std::vector<ur5_motion_plan>& plans)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    plans.clear();
+    plans.reserve(_plans.size());
+    for (std::size_t i = 0; i < _plans.size(); i++)
+    {
+        plans.push_back(*_plans[i]);
+    }
+    return;
+}
+
+template <std::size_t DOF>
+std::size_t KDTreeT<DOF>::getPlanCount()
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    return _plans.size();
+}
+
+template <std::size_t DOF>
+std::size_t KDTreeT<DOF>::getMaxWaypointCount()
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    return _max_wpts;
+}
+
+template <std::size_t DOF>
+double KDTreeT<DOF>::getPlanDuration(std::size_t plan_index)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    return _plans[plan_index]->duration;
+}
+
+template <std::size_t DOF>
+std::size_t KDTreeT<DOF>::countPlansInCell(const joint_values_t& start_jvals, const joint_values_t& end_jvals)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+
+    coords_t coords = calcCoords(makePoint(start_jvals, end_jvals));
+
+    for (std::size_t i = 0; i < _cell_count; i++)
+    {
+        if (_cells[i].getCoords() == coords)
+        {
+            return _cells[i].getValues().size();
+        }
+    }
+    return 0;
+}
+
+template <std::size_t DOF>
+const ur5_motion_plan& KDTreeT<DOF>::getRandomPlan()
 {
     // Get random plan
     std::size_t plan_idx = rand() % _plans.size();
 
-    return _plans[plan_idx];
+    return *_plans[plan_idx];
 }
 
-const ur5_motion_plan& KDTree::getRandomPlanStartingNear(const moveit_msgs::RobotState& start_state, double dist_max)
+template <std::size_t DOF>
+const ur5_motion_plan& KDTreeT<DOF>::getRandomPlanStartingNear(const moveit_msgs::RobotState& start_state, double dist_max)
 {
     // First calculate cell subspace with this starting location
-    cell_coords_t start_coords = calcCoords(start_state.joint_state.position);
-    // This only includes the start state -- i.e. we have a 6 dimensional subspace to search still
+    // Only the start half of the coordinates is compared -- i.e. we have a DOF dimensional subspace to search still
+    const joint_values_t& start_jvals = start_state.joint_state.position;
+    coords_t start_coords = calcCoords(makePoint(start_jvals, start_jvals));
 
     robot_state::RobotState state(_rmodel);
     robot_state::RobotState comp_state(_rmodel);
     moveit::core::robotStateMsgToRobotState(start_state, comp_state);
 
     // Now search for cells in this subspace
-    for (int j=0; j < _cell_count; j++)
+    for (std::size_t j=0; j < _cell_count; j++)
     {
-        cell_coords_t cell_start_coords = _cells[j].getCoords();
-        cell_start_coords.resize(start_coords.size());
+        const coords_t& cell_coords = _cells[j].getCoords();
 
-        if (cell_start_coords == start_coords)
+        if (std::equal(start_coords.begin(), start_coords.begin() + DOF, cell_coords.begin()))
         {
             const std::vector<std::size_t>& values = _cells[j].getValues();
-            for (int i = 0; i < values.size(); i++)
+            for (std::size_t i = 0; i < values.size(); i++)
             {
-                const ur5_motion_plan& plan = _plans[ values[i] ];
+                const ur5_motion_plan& plan = *_plans[ values[i] ];
                 moveit::core::robotStateMsgToRobotState(plan.start_state, state);
                 double dist = comp_state.distance(state);
 
                 if (dist < dist_max)
                 {
-                    std::cout << "Found plan distance " << dist << " away.\n";
+                    ROS_DEBUG("Found plan distance %f away.", dist);
                     return plan;
                 }
             }
@@ -253,15 +549,12 @@ const ur5_motion_plan& KDTree::getRandomPlanStartingNear(const moveit_msgs::Robo
     throw "Could not find plan nearby.";
 }
 
-void KDTree::setTargets(const joint_values_t &start_jvals, const joint_values_t &end_jvals)
+template <std::size_t DOF>
+void KDTreeT<DOF>::setTargets(const joint_values_t &start_jvals, const joint_values_t &end_jvals)
 {
-    _target_point.reserve(2 * start_jvals.size());
-    _target_point = start_jvals;
-    for (int i=0; i < end_jvals.size(); i++)
-    {
-        _target_point.push_back(end_jvals[i]);
-    }
+    boost::mutex::scoped_lock lock(_mutex);
 
+    _target_point = makePoint(start_jvals, end_jvals);
     _target_coords = calcCoords(_target_point);
 
     // Now reset proximity list
@@ -274,10 +567,14 @@ void KDTree::setTargets(const joint_values_t &start_jvals, const joint_values_t
         if (_cells[i].getCoords() == _target_coords)
         {
             int num_plans = _cells[i].getValues().size();
-            std::cout << "Coords match. Cell has " << num_plans << " plans." << std::endl;
-            if (num_plans > 0)
+            ROS_DEBUG("Coords match. Cell has %d plans.", num_plans);
+
+            // Sort sub-cell by sub-cell, finest first, so pools stay small in crowded cells
+            std::vector< std::vector<std::size_t> > pools;
+            _cells[i].collectPools(pools, _target_point);
+            for (std::size_t p = 0; p < pools.size(); p++)
             {
-                linearSort(_cells[i].getValues());
+                linearSort(pools[p]);
             }
             break;
         }
@@ -286,8 +583,12 @@ void KDTree::setTargets(const joint_values_t &start_jvals, const joint_values_t
     return;
 }
 
-bool KDTree::lookup(ur5_motion_plan& plan, int hit)
+template <std::size_t DOF>
+bool KDTreeT<DOF>::lookup(plan_handle_t& plan, int hit)
 {
+    TRACE_SPAN("KDTree::lookup");
+    boost::mutex::scoped_lock lock(_mutex);
+
     while (1)
     {
         if (hit >= _plan_count)
@@ -298,6 +599,10 @@ bool KDTree::lookup(ur5_motion_plan& plan, int hit)
         if (hit < _proximity_ordering.size())
         {
             plan = _plans[ _proximity_ordering[hit] ];
+            if (_lookup_depth != NULL)
+            {
+                _lookup_depth->record(_search_depth);
+            }
             // Todo: Replace with actual distance value
             return true;
         }
@@ -307,7 +612,57 @@ bool KDTree::lookup(ur5_motion_plan& plan, int hit)
     }
 }
 
-void KDTree::linearSort(const std::vector<std::size_t>& plan_pool)
+template <std::size_t DOF>
+double KDTreeT<DOF>::planDistance(const joint_values_t& start_a, const joint_values_t& end_a, const joint_values_t& start_b, const joint_values_t& end_b)
+{
+    // No lock: bounds and periodicity are fixed at construction
+    return pointDistance(makePoint(start_a, end_a), makePoint(start_b, end_b));
+}
+
+template <std::size_t DOF>
+bool KDTreeT<DOF>::nearest(std::size_t& plan_index, double& distance, const joint_values_t& start_jvals, const joint_values_t& end_jvals)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+
+    point_t point = makePoint(start_jvals, end_jvals);
+    coords_t coords = calcCoords(point);
+
+    // Widest possible shell
+    std::size_t max_depth = 0;
+    for (std::size_t i=0; i < DIM; i++)
+    {
+        max_depth = std::max(max_depth, _resolution[i]);
+    }
+
+    // Closest plan in the first populated shell, same approximation as lookup()
+    std::vector<std::size_t> pool;
+    for (std::size_t depth = 0; depth <= max_depth; depth++)
+    {
+        collectPlansAtDistance(pool, coords, depth);
+        if (pool.empty())
+        {
+            continue;
+        }
+
+        distance = -1;
+        for (std::size_t i=0; i < pool.size(); i++)
+        {
+            double d = pointDistance(_points[ pool[i] ], point);
+
+            if (distance < 0 || d < distance)
+            {
+                distance = d;
+                plan_index = pool[i];
+            }
+        }
+        return true;
+    }
+
+    return false;
+}
+
+template <std::size_t DOF>
+void KDTreeT<DOF>::linearSort(const std::vector<std::size_t>& plan_pool)
 {
     int pool_size = plan_pool.size();
 
@@ -325,24 +680,17 @@ void KDTree::linearSort(const std::vector<std::size_t>& plan_pool)
 
     std::vector<std::size_t> index_vect;
     std::vector<double> d_vect;
-    robot_state::RobotState target_start(_rmodel);
-    robot_state::RobotState target_end(_rmodel);
-
-    // Initialize target start and end states
-    target_start.setVariablePositions(_target_point.data());
-    target_end.setVariablePositions(_target_point.data() + 6);
-
-    robot_state::RobotState state(_rmodel);
     double distance;
 
+    if (_candidates_scored != NULL)
+    {
+        _candidates_scored->inc(pool_size);
+    }
+
     // std::cout << "Calculating distances." << std::endl;
     for (int i=0; i < pool_size; i++)
     {
-        state.setVariablePositions(_plans[ plan_pool[i] ].start_state.joint_state.position);
-        distance = target_start.distance(state);
-
-        state.setVariablePositions(_plans[ plan_pool[i] ].end_state.joint_state.position);
-        distance += target_end.distance(state);
+        distance = pointDistance(_points[ plan_pool[i] ], _target_point);
 
         // std::cout << distance << std::endl;
         index_vect.push_back(plan_pool[i]);
@@ -369,7 +717,7 @@ void KDTree::linearSort(const std::vector<std::size_t>& plan_pool)
 
         // Now add to proximity queue
         _proximity_ordering.push_back(min_index);
-        std::cout << "Added " << min_index << " with distance of " << min << " to priority queue." << std::endl;
+        ROS_DEBUG("Added %d with distance of %f to priority queue.", (int) min_index, min);
         // And remove entry from distance and index vectors
         std::vector<double>::iterator d_it = d_vect.begin() + min_j;
         std::vector<std::size_t>::iterator i_it = index_vect.begin() + min_j;
@@ -379,3 +727,7 @@ void KDTree::linearSort(const std::vector<std::size_t>& plan_pool)
 
     return;
 }
+
+// Instantiations; add one per supported arm joint count
+template class CellT<2*UR5_DOF>;
+template class KDTreeT<UR5_DOF>;
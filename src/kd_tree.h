@@ -8,92 +8,169 @@
 #include <moveit_msgs/RobotState.h>
 #include <moveit_msgs/RobotTrajectory.h>
 
+#include "metrics.h"
+
 #include <boost/shared_ptr.hpp>
+#include <boost/array.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <Eigen/Core>
 
 #include <cmath>
 
+#define PLAN_NO_TARGET -1     // target index of plans that do not end on a library target (learned, fallback)
+
 typedef struct {
     moveit_msgs::RobotTrajectory trajectory;
     moveit_msgs::RobotState start_state;
     moveit_msgs::RobotState end_state;
-    int start_target_index;
-    int end_target_index;
+    int start_target_index;     // or PLAN_NO_TARGET
+    int end_target_index;       // or PLAN_NO_TARGET
     double duration; // seconds
     int num_wpts;
 } ur5_motion_plan;
 
+// Shared read-only view of a library plan; stays valid even if the tree is cleared meanwhile
+typedef boost::shared_ptr<const ur5_motion_plan> plan_handle_t;
+
 typedef std::vector<double> joint_values_t;
 
 typedef std::size_t coord_t;
-typedef std::vector<coord_t> cell_coords_t;
 
-class Cell
+#define UR5_DOF 6                   // joint count of the default instantiation
+#define KDTREE_BOUND_MARGIN 0.10    // library bounds extend this far past +-pi (rad)
+#define KDTREE_RESOLUTION 10        // grid cells per dimension
+#define KDTREE_SPLIT_THRESHOLD 32   // leaf cells holding more plans than this are split in two
+#define KDTREE_MAX_SPLIT_LEVEL 16   // deepest refinement level below a grid cell
+
+// A grid cell of the combined start/end joint space, templated on that space's dimension
+template <std::size_t DIM>
+class CellT
 {
+public:
+    typedef Eigen::Matrix<double, DIM, 1, Eigen::DontAlign> point_t;
+    typedef boost::array<coord_t, DIM> coords_t;
+
 protected:
-    std::size_t _dimension;
-    cell_coords_t _coords;
-    std::vector<std::size_t> _values;
+    coords_t _coords;
+    std::vector<std::size_t> _values;           // all plans in this cell, including those held by children
+
+    // Adaptive refinement: a crowded cell is split at the median of its widest populated dimension
+    std::size_t _level;
+    std::size_t _split_dim;
+    double _split_value;
+    boost::shared_ptr<CellT> _low;
+    boost::shared_ptr<CellT> _high;
+    std::size_t _split_retry_size;              // after a failed split (coincident plans), wait until the cell holds this many
+
+    bool split(const std::vector<point_t>& points, std::size_t threshold);
+
 public:
-    Cell(const std::vector<std::size_t>& coords);
+    CellT(const coords_t& coords);
 
-    inline const cell_coords_t& getCoords() { return _coords; }
-    inline cell_coords_t getCoordsCopy() { return _coords; }
+    inline const coords_t& getCoords() { return _coords; }
+    inline coords_t getCoordsCopy() { return _coords; }
     inline const std::vector<std::size_t>& getValues() { return _values; }
+    inline bool isLeaf() { return !_low; }
 
-    std::size_t rectDistFrom(const cell_coords_t &coords);
+    // Chebyshev distance in cells; periodic dimensions wrap around after resolution cells
+    std::size_t rectDistFrom(const coords_t& coords, const boost::array<bool, DIM>& periodic, const coords_t& resolution);
 
-    inline void addValue(std::size_t val) { _values.push_back(val); }
+    void addValue(std::size_t val, const std::vector<point_t>& points, std::size_t threshold);
 
-    friend bool operator== (const Cell& lhs, const Cell& rhs);
-    friend bool operator!= (const Cell& lhs, const Cell& rhs);
+    // Plan pools ordered from the finest populated sub-cell containing point outwards
+    void collectPools(std::vector< std::vector<std::size_t> >& pools, const point_t& point);
+    std::size_t countLeaves();
+
+    bool operator== (const CellT& rhs) const { return _coords == rhs._coords; }
+    bool operator!= (const CellT& rhs) const { return !(*this == rhs); }
 };
 
-class KDTree
+// Plan store and proximity search over DOF-joint plans. Points, bounds and cell coordinates are
+// fixed-size so the distance and coordinate loops unroll and never allocate. Instantiated in
+// kd_tree.cpp; add an explicit instantiation there for arms with another joint count.
+template <std::size_t DOF>
+class KDTreeT
 {
+public:
+    static const std::size_t DIM = 2 * DOF;     // start and end joint values form a single point
+    typedef CellT<DIM> cell_t;
+    typedef typename cell_t::point_t point_t;
+    typedef typename cell_t::coords_t coords_t;
+
+private:
     // Robot model
     robot_model::RobotModelPtr _rmodel;
 
+    // Guards data and proximity queue; plans may be added while queries run
+    boost::mutex _mutex;
+
     // KD parameters
-    std::size_t _dimension;
-    std::vector<double> _bounds_low;
-    std::vector<double> _bounds_high;
-    std::vector<coord_t> _resolution;
-    std::vector<double> _cell_increments;
+    point_t _bounds_low;
+    point_t _bounds_high;
+    coords_t _resolution;
+    point_t _cell_increments;
+    boost::array<bool, DIM> _periodic;              // continuous joints wrap around at +-pi
 
     // Data
-    std::vector<ur5_motion_plan> _plans;
+    std::vector<plan_handle_t> _plans;
+    std::vector<point_t> _points;                   // combined start and end joint values of each plan
     std::size_t _plan_count;
-    std::vector<Cell> _cells;
+    std::size_t _max_wpts;                          // longest plan trajectory, for sizing query workspaces
+    std::size_t _split_threshold;
+    std::vector<cell_t> _cells;
     std::size_t _cell_count;
 
     // Proximity Queue data
-    joint_values_t _target_point;
-    cell_coords_t _target_coords;
+    point_t _target_point;
+    coords_t _target_coords;
     std::vector<std::size_t> _proximity_ordering;
     int _search_depth;                              // distance of furthest cells included in proximity ordering so far
 
+    // Optional metrics, NULL until setMetrics
+    MetricCounter* _candidates_scored;
+    MetricHistogram* _lookup_depth;
+
     // Helper functions
-    std::vector<std::size_t> calcCoords(const joint_values_t& jvals);
+    point_t makePoint(const joint_values_t& start_jvals, const joint_values_t& end_jvals);
+    coords_t calcCoords(const point_t& point);
+    void wrapPoint(point_t& point);
+    double pointDistance(const point_t& a, const point_t& b);
+    void collectPlansAtDistance(std::vector<std::size_t>& pool, const coords_t& coords, std::size_t depth);
     void searchCellsAtNextDistance();
     void linearSort(const std::vector<std::size_t>& plan_pool);
-    void rectDistFrom(const cell_coords_t& coords);
 
 public:
-    KDTree(robot_model::RobotModelPtr& rmodel, const std::vector<double>& low_bounds, const std::vector<double>& high_bounds, const std::vector<std::size_t>& resolution);
+    KDTreeT(robot_model::RobotModelPtr& rmodel, const std::vector<double>& low_bounds, const std::vector<double>& high_bounds, const std::vector<std::size_t>& resolution);
 
     void add(const ur5_motion_plan &plan);
-    inline const std::vector<ur5_motion_plan>& getPlanData() { return _plans; }
-    inline std::size_t getPlanCount() { return _plans.size(); }
+    void clear();
+    inline void setSplitThreshold(std::size_t threshold) { _split_threshold = threshold; }
+    void setMetrics(MetricsRegistry& metrics);
+    void copyPlanData(std::vector<ur5_motion_plan>& plans);
+    std::size_t getPlanCount();
+    std::size_t getMaxWaypointCount();
+    double getPlanDuration(std::size_t plan_index);
+    std::size_t countPlansInCell(const joint_values_t& start_jvals, const joint_values_t& end_jvals);
 
     const ur5_motion_plan& getRandomPlan();
     const ur5_motion_plan& getRandomPlanStartingNear(const moveit_msgs::RobotState& start_state, double dist_max);
 
     void setTargets(const joint_values_t& start_jvals, const joint_values_t& end_jvals);
-    bool lookup(ur5_motion_plan& plan, int hit);
+    // Hands out the library plan itself rather than a copy; callers copy only what they modify
+    bool lookup(plan_handle_t& plan, int hit);
+
+    // Stateless nearest-plan query; does not disturb the proximity ordering from setTargets
+    bool nearest(std::size_t& plan_index, double& distance, const joint_values_t& start_jvals, const joint_values_t& end_jvals);
+    // The lookup metric between two start/end pairs, periodic joints taking the short way round
+    double planDistance(const joint_values_t& start_a, const joint_values_t& end_a, const joint_values_t& start_b, const joint_values_t& end_b);
 
     void printInfo(std::ostream& cout);
 };
 
+typedef KDTreeT<UR5_DOF> KDTree;
+typedef KDTree::cell_t Cell;
+typedef KDTree::coords_t cell_coords_t;
 typedef boost::shared_ptr<KDTree> KDTreePtr;
 
 #endif // KD_TREE_H
@@ -0,0 +1,126 @@
+#include "library_compactor.h"
+
+#include <algorithm>
+
+// Sort helper: plan indices by duration
+struct DurationLess
+{
+    const std::vector<ur5_motion_plan>* plans;
+    bool operator() (std::size_t a, std::size_t b) const
+    {
+        return (*plans)[a].duration < (*plans)[b].duration;
+    }
+};
+
+LibraryCompactor::LibraryCompactor(const KDTreePtr& kdtree, double warp_radius, double traj_tolerance)
+{
+    _kdtree = kdtree;
+    _warp_radius = warp_radius;
+    _traj_tolerance = traj_tolerance;
+    return;
+}
+
+double LibraryCompactor::endpointDistance(const ur5_motion_plan& a, const ur5_motion_plan& b)
+{
+    // The metric fitPlan looks plans up by, so a dominated plan is one lookup would find the representative for
+    return _kdtree->planDistance(a.start_state.joint_state.position, a.end_state.joint_state.position,
+                                 b.start_state.joint_state.position, b.end_state.joint_state.position);
+}
+
+void LibraryCompactor::samplePath(const ur5_motion_plan& plan, std::vector<joint_values_t>& samples)
+{
+    // Resample waypoints at evenly spaced path parameters so plans with different waypoint counts compare
+    const std::vector<trajectory_msgs::JointTrajectoryPoint>& points = plan.trajectory.joint_trajectory.points;
+    samples.clear();
+    if (points.empty())
+    {
+        return;
+    }
+
+    std::size_t last = points.size() - 1;
+    for (int k = 0; k < COMPACTOR_TRAJ_SAMPLES; k++)
+    {
+        double s = (double) k / (COMPACTOR_TRAJ_SAMPLES - 1) * last;
+        std::size_t i = std::min((std::size_t) floor(s), last);
+        std::size_t i_next = std::min(i + 1, last);
+        double t = s - i;
+
+        joint_values_t sample(points[i].positions.size());
+        for (std::size_t j = 0; j < sample.size(); j++)
+        {
+            sample[j] = (1 - t) * points[i].positions[j] + t * points[i_next].positions[j];
+        }
+        samples.push_back(sample);
+    }
+    return;
+}
+
+double LibraryCompactor::trajectoryDistance(const std::vector<joint_values_t>& a, const std::vector<joint_values_t>& b)
+{
+    // Largest summed joint distance between corresponding samples
+    double max_dist = 0;
+    for (std::size_t k = 0; k < a.size() && k < b.size(); k++)
+    {
+        double dist = 0;
+        for (std::size_t j = 0; j < a[k].size(); j++)
+        {
+            dist += fabs(a[k][j] - b[k][j]);
+        }
+        max_dist = std::max(max_dist, dist);
+    }
+    return max_dist;
+}
+
+std::size_t LibraryCompactor::compact(const std::vector<ur5_motion_plan>& plans, std::vector<ur5_motion_plan>& kept, std::vector<ur5_motion_plan>* dropped)
+{
+    // Fastest plans first, so every cluster is represented by its fastest member
+    std::vector<std::size_t> order(plans.size());
+    for (std::size_t i = 0; i < plans.size(); i++)
+    {
+        order[i] = i;
+    }
+    DurationLess less;
+    less.plans = &plans;
+    std::sort(order.begin(), order.end(), less);
+
+    std::vector<std::size_t> reps;
+    std::vector< std::vector<joint_values_t> > rep_samples;
+    std::vector<joint_values_t> samples;
+    for (std::size_t n = 0; n < order.size(); n++)
+    {
+        const ur5_motion_plan& plan = plans[ order[n] ];
+        samplePath(plan, samples);
+
+        bool dominated = false;
+        for (std::size_t r = 0; r < reps.size(); r++)
+        {
+            if (endpointDistance(plan, plans[ reps[r] ]) <= _warp_radius
+                && trajectoryDistance(samples, rep_samples[r]) <= _traj_tolerance)
+            {
+                dominated = true;
+                break;
+            }
+        }
+
+        if (!dominated)
+        {
+            reps.push_back(order[n]);
+            rep_samples.push_back(samples);
+        }
+        else if (dropped != NULL)
+        {
+            dropped->push_back(plan);
+        }
+    }
+
+    // Keep original library order
+    std::sort(reps.begin(), reps.end());
+    kept.clear();
+    kept.reserve(reps.size());
+    for (std::size_t r = 0; r < reps.size(); r++)
+    {
+        kept.push_back(plans[ reps[r] ]);
+    }
+
+    return plans.size() - kept.size();
+}
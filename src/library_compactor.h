@@ -0,0 +1,31 @@
+#ifndef LIBRARY_COMPACTOR_H
+#define LIBRARY_COMPACTOR_H
+
+#include "kd_tree.h"
+
+#include <vector>
+
+#define COMPACTOR_TRAJ_SAMPLES 20   // points compared along each trajectory
+
+// Offline pruning of redundant library plans. Plans are visited fastest first; a plan is dropped
+// when an already kept (hence faster) plan starts and ends within the warp radius of it and
+// follows a similar path, since fitPlan would warp the kept plan into its place anyway.
+class LibraryCompactor
+{
+    KDTreePtr _kdtree;                  // only for its distance metric
+    double _warp_radius;
+    double _traj_tolerance;
+
+    void samplePath(const ur5_motion_plan& plan, std::vector<joint_values_t>& samples);
+
+public:
+    LibraryCompactor(const KDTreePtr& kdtree, double warp_radius, double traj_tolerance);
+
+    double endpointDistance(const ur5_motion_plan& a, const ur5_motion_plan& b);
+    double trajectoryDistance(const std::vector<joint_values_t>& a, const std::vector<joint_values_t>& b);
+
+    // Returns number of plans dropped; they are appended to dropped if given
+    std::size_t compact(const std::vector<ur5_motion_plan>& plans, std::vector<ur5_motion_plan>& kept, std::vector<ur5_motion_plan>* dropped = NULL);
+};
+
+#endif // LIBRARY_COMPACTOR_H
@@ -0,0 +1,243 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+//////////////// Counter
+
+MetricCounter::MetricCounter(const std::string& name)
+{
+    _name = name;
+    _value.store(0);
+    return;
+}
+
+void MetricCounter::reset()
+{
+    _value.store(0, boost::memory_order_relaxed);
+    return;
+}
+
+void MetricCounter::writeJson(std::ostream& out)
+{
+    out << "\"" << _name << "\": " << get();
+    return;
+}
+
+//////////////// Histogram
+
+MetricHistogram::MetricHistogram(const std::string& name, const std::string& unit, const std::vector<double>& bounds)
+{
+    if (bounds.size() > METRICS_MAX_BUCKETS)
+    {
+        throw std::string("Too many histogram buckets for ") + name;
+    }
+    _name = name;
+    _unit = unit;
+    _num_bounds = bounds.size();
+    std::copy(bounds.begin(), bounds.end(), _bounds);
+    reset();
+    return;
+}
+
+void MetricHistogram::record(double value)
+{
+    std::size_t b = 0;
+    while (b < _num_bounds && value > _bounds[b])
+    {
+        b++;
+    }
+    _counts[b].fetch_add(1, boost::memory_order_relaxed);
+    _count.fetch_add(1, boost::memory_order_relaxed);
+
+    // No atomic add for doubles, so compare-and-swap
+    double old_sum = _sum.load(boost::memory_order_relaxed);
+    while (!_sum.compare_exchange_weak(old_sum, old_sum + value, boost::memory_order_relaxed))
+    {
+    }
+    double old_max = _max.load(boost::memory_order_relaxed);
+    while (value > old_max && !_max.compare_exchange_weak(old_max, value, boost::memory_order_relaxed))
+    {
+    }
+    return;
+}
+
+double MetricHistogram::mean()
+{
+    unsigned long count = getCount();
+    return (count > 0) ? _sum.load(boost::memory_order_relaxed) / count : 0;
+}
+
+double MetricHistogram::percentile(double p)
+{
+    unsigned long count = getCount();
+    if (count == 0)
+    {
+        return 0;
+    }
+    unsigned long rank = (unsigned long) (p / 100.0 * count);
+    unsigned long seen = 0;
+    for (std::size_t b = 0; b < _num_bounds; b++)
+    {
+        seen += _counts[b].load(boost::memory_order_relaxed);
+        if (seen > rank)
+        {
+            return _bounds[b];
+        }
+    }
+    // Overflow bucket has no upper bound of its own
+    return _max.load(boost::memory_order_relaxed);
+}
+
+void MetricHistogram::reset()
+{
+    for (std::size_t b = 0; b <= _num_bounds; b++)
+    {
+        _counts[b].store(0, boost::memory_order_relaxed);
+    }
+    _count.store(0, boost::memory_order_relaxed);
+    _sum.store(0, boost::memory_order_relaxed);
+    _max.store(0, boost::memory_order_relaxed);
+    return;
+}
+
+void MetricHistogram::writeJson(std::ostream& out)
+{
+    out << "\"" << _name << "\": {\"unit\": \"" << _unit << "\", \"count\": " << getCount()
+        << ", \"sum\": " << _sum.load(boost::memory_order_relaxed)
+        << ", \"max\": " << _max.load(boost::memory_order_relaxed) << ", \"bounds\": [";
+    for (std::size_t b = 0; b < _num_bounds; b++)
+    {
+        out << ((b > 0) ? ", " : "") << _bounds[b];
+    }
+    out << "], \"counts\": [";
+    for (std::size_t b = 0; b <= _num_bounds; b++)
+    {
+        out << ((b > 0) ? ", " : "") << _counts[b].load(boost::memory_order_relaxed);
+    }
+    out << "]}";
+    return;
+}
+
+std::vector<double> linearBuckets(double start, double width, std::size_t count)
+{
+    std::vector<double> bounds(count);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        bounds[i] = start + i * width;
+    }
+    return bounds;
+}
+
+std::vector<double> exponentialBuckets(double start, double factor, std::size_t count)
+{
+    std::vector<double> bounds(count);
+    double bound = start;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        bounds[i] = bound;
+        bound *= factor;
+    }
+    return bounds;
+}
+
+//////////////// Registry
+
+MetricCounter* MetricsRegistry::counter(const std::string& name)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    for (std::size_t i = 0; i < _counters.size(); i++)
+    {
+        if (_counters[i]->getName() == name)
+        {
+            return _counters[i].get();
+        }
+    }
+    _counters.push_back(boost::shared_ptr<MetricCounter>(new MetricCounter(name)));
+    return _counters.back().get();
+}
+
+MetricHistogram* MetricsRegistry::histogram(const std::string& name, const std::string& unit, const std::vector<double>& bounds)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    for (std::size_t i = 0; i < _histograms.size(); i++)
+    {
+        if (_histograms[i]->getName() == name)
+        {
+            return _histograms[i].get();
+        }
+    }
+    _histograms.push_back(boost::shared_ptr<MetricHistogram>(new MetricHistogram(name, unit, bounds)));
+    return _histograms.back().get();
+}
+
+void MetricsRegistry::reset()
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    for (std::size_t i = 0; i < _counters.size(); i++)
+    {
+        _counters[i]->reset();
+    }
+    for (std::size_t i = 0; i < _histograms.size(); i++)
+    {
+        _histograms[i]->reset();
+    }
+    return;
+}
+
+void MetricsRegistry::writeJson(std::ostream& out)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    out << "{\"counters\": {";
+    for (std::size_t i = 0; i < _counters.size(); i++)
+    {
+        out << ((i > 0) ? ", " : "");
+        _counters[i]->writeJson(out);
+    }
+    out << "}, \"histograms\": {";
+    for (std::size_t i = 0; i < _histograms.size(); i++)
+    {
+        out << ((i > 0) ? ", " : "");
+        _histograms[i]->writeJson(out);
+    }
+    out << "}}";
+    return;
+}
+
+std::string MetricsRegistry::toJson()
+{
+    std::stringstream out;
+    writeJson(out);
+    return out.str();
+}
+
+bool MetricsRegistry::writeJsonFile(const std::string& filename)
+{
+    std::ofstream file(filename.c_str());
+    if (!file.is_open())
+    {
+        return false;
+    }
+    writeJson(file);
+    file << std::endl;
+    return file.good();
+}
+
+void MetricsRegistry::printInfo(std::ostream& cout)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    cout << "Metrics:" << std::endl;
+    for (std::size_t i = 0; i < _counters.size(); i++)
+    {
+        cout << "  " << std::left << std::setw(28) << _counters[i]->getName() << std::right << _counters[i]->get() << std::endl;
+    }
+    for (std::size_t i = 0; i < _histograms.size(); i++)
+    {
+        MetricHistogram& h = *_histograms[i];
+        cout << "  " << std::left << std::setw(28) << h.getName() << std::right << "n=" << h.getCount()
+             << "  mean " << h.mean() << "  p50 <= " << h.percentile(50) << "  p99 <= " << h.percentile(99) << ' ' << h.getUnit() << std::endl;
+    }
+    return;
+}
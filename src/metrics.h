@@ -0,0 +1,86 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define METRICS_MAX_BUCKETS 16      // finite histogram buckets; one more catches everything above them
+
+// Event count; safe to bump from any thread
+class MetricCounter
+{
+    std::string _name;
+    boost::atomic<unsigned long> _value;
+
+public:
+    MetricCounter(const std::string& name);
+
+    inline void inc(unsigned long n = 1) { _value.fetch_add(n, boost::memory_order_relaxed); }
+    inline unsigned long get() { return _value.load(boost::memory_order_relaxed); }
+    inline const std::string& getName() { return _name; }
+    void reset();
+
+    void writeJson(std::ostream& out);
+};
+
+// Distribution over fixed buckets: bucket i counts values <= bounds[i] (and above bounds[i-1]).
+// Recording is a short bucket scan and a few relaxed atomic adds, so it is fine inside query loops.
+class MetricHistogram
+{
+    std::string _name;
+    std::string _unit;
+    std::size_t _num_bounds;
+    double _bounds[METRICS_MAX_BUCKETS];
+    boost::atomic<unsigned long> _counts[METRICS_MAX_BUCKETS + 1];
+    boost::atomic<unsigned long> _count;
+    boost::atomic<double> _sum;
+    boost::atomic<double> _max;
+
+public:
+    MetricHistogram(const std::string& name, const std::string& unit, const std::vector<double>& bounds);
+
+    void record(double value);
+    inline unsigned long getCount() { return _count.load(boost::memory_order_relaxed); }
+    inline const std::string& getName() { return _name; }
+    inline const std::string& getUnit() { return _unit; }
+    double mean();
+    double percentile(double p);    // upper bound of the bucket holding the p-th percentile
+    void reset();
+
+    void writeJson(std::ostream& out);
+};
+
+// Bucket bounds start, start+width, ...
+std::vector<double> linearBuckets(double start, double width, std::size_t count);
+// Bucket bounds start, start*factor, ...
+std::vector<double> exponentialBuckets(double start, double factor, std::size_t count);
+
+// Named counters and histograms of one library. Registration takes a lock and is meant for setup;
+// the returned pointers stay valid for the life of the registry and are used lock-free afterwards.
+class MetricsRegistry
+{
+    boost::mutex _mutex;
+    std::vector< boost::shared_ptr<MetricCounter> > _counters;
+    std::vector< boost::shared_ptr<MetricHistogram> > _histograms;
+
+public:
+    // Return the existing metric of that name, or register a new one
+    MetricCounter* counter(const std::string& name);
+    MetricHistogram* histogram(const std::string& name, const std::string& unit, const std::vector<double>& bounds);
+
+    void reset();
+
+    void writeJson(std::ostream& out);
+    std::string toJson();
+    bool writeJsonFile(const std::string& filename);
+    void printInfo(std::ostream& cout);
+};
+
+typedef boost::shared_ptr<MetricsRegistry> MetricsRegistryPtr;
+
+#endif // METRICS_H
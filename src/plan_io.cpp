@@ -0,0 +1,254 @@
+#include "plan_io.h"
+
+#include <ros/ros.h>
+
+#include <fstream>
+
+moveit_msgs::AttachedCollisionObject getAppleObjectMsg()
+{
+    moveit_msgs::AttachedCollisionObject apple;
+    apple.link_name = "ee_link";
+    apple.object.header.frame_id = "ee_link";
+    apple.object.id = "apple";
+
+    geometry_msgs::Pose pose;
+    shape_msgs::SolidPrimitive primitive;
+    pose.position.x = 0.05;
+    primitive.type = primitive.SPHERE;
+    primitive.dimensions.resize(1);
+    primitive.dimensions[0] = 0.05;
+
+    apple.object.primitives.push_back(primitive);
+    apple.object.primitive_poses.push_back(pose);
+    apple.object.operation = apple.object.ADD;
+    /* Publish and sleep (to view the visualized results)*/
+
+    return apple;
+}
+
+bool writePlanFile(const std::vector<ur5_motion_plan>& plans, const char* filename, bool debug)
+{
+    int plan_count = plans.size();
+    int node_count;
+
+    std::ofstream file;
+    file.open (filename, std::ofstream::out | std::ofstream::binary);
+
+    // If file didn't open correctly
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    // First write plan_group meta info
+    file.write((char *)(&plan_count),sizeof(plan_count));                   // number of plans
+
+    if (debug == 1) ROS_INFO("%d",plan_count);
+    for (size_t n = 0; n < plan_count; n++)
+    {
+        const ur5_motion_plan& plan = plans[n];
+
+        //RobotTrajectory -> JointTrajectory -> JointTrajectoryPoints
+        node_count = plan.trajectory.joint_trajectory.points.size();
+        if (debug == 1) ROS_INFO("%d",node_count);
+        file.write((char *)(&node_count),sizeof(node_count));
+        for (size_t idx = 0; idx < node_count; idx++)
+        {
+            for (size_t i=0; i < UR5_DOF; i++)
+            {
+                file.write((char *)(&plan.trajectory.joint_trajectory.points[idx].positions[i]),sizeof(double));
+                file.write((char *)(&plan.trajectory.joint_trajectory.points[idx].velocities[i]),sizeof(double));
+            }
+            file.write((char *)(&plan.trajectory.joint_trajectory.points[idx].time_from_start),sizeof(ros::Duration));
+        }
+
+        //RobotTrajectory -> JointTrajectory -> Header
+        file.write((char *)(&plan.trajectory.joint_trajectory.header.seq),sizeof(uint32_t));
+        file.write((char *)(&plan.trajectory.joint_trajectory.header.stamp),sizeof(ros::Time));
+        file << plan.trajectory.joint_trajectory.header.frame_id << '\n';
+
+        //RobotTrajectory -> JointTrajectory -> joint_names
+        for (size_t i=0; i < UR5_DOF; i++) file << plan.trajectory.joint_trajectory.joint_names[i] << '\n';
+
+
+        //start_state
+        //RobotState -> JointState -> Header
+        file.write((char *)(&plan.start_state.joint_state.header.seq),sizeof(uint32_t));
+        file.write((char *)(&plan.start_state.joint_state.header.stamp),sizeof(ros::Time));
+        file << plan.start_state.joint_state.header.frame_id << '\n';
+        //RobotState -> JointState -> string & position
+        for (size_t j = 0; j < UR5_DOF; j++)
+        {
+            file << plan.start_state.joint_state.name[j] << '\n';
+            file.write((char *)(&plan.start_state.joint_state.position[j]),sizeof(double));
+        }
+
+        //end_state
+        //RobotState -> JointState -> Header
+        file.write((char *)(&plan.end_state.joint_state.header.seq),sizeof(uint32_t));
+        file.write((char *)(&plan.end_state.joint_state.header.stamp),sizeof(ros::Time));
+        file << plan.end_state.joint_state.header.frame_id << '\n';
+        //RobotState -> JointState -> stirng & position
+        for (size_t j = 0; j < UR5_DOF; j++)
+        {
+            file << plan.end_state.joint_state.name[j] << '\n';
+            file.write((char *)(&plan.end_state.joint_state.position[j]),sizeof(double));
+        }
+
+        //index, PLAN_NO_TARGET if the plan does not join library targets
+        file.write((char *)(&plan.start_target_index),sizeof(int));
+        file.write((char *)(&plan.end_target_index),sizeof(int));
+
+        //duration
+        file.write((char *) &plan.duration, sizeof(ur5_motion_plan::duration));
+
+        //write an apple
+        if (plan.start_state.attached_collision_objects.size() > 0)
+        {
+            file << "apple\n";
+        }
+        else
+        {
+            file << "no apple\n";
+        }
+    }
+
+    file.close();
+
+    return true;
+}
+
+bool readPlanFile(std::vector<ur5_motion_plan>& plans, const char* filename, bool debug)
+{
+    int wpt_count;
+    int plan_count;
+
+    //int nodeset = 10;
+    double temp_double;
+    std::string temp_string;
+    std::string blank_string;
+    ros::Duration temp_duration;
+
+    ur5_motion_plan temp_plan;
+    ur5_motion_plan empty;
+    std::vector<int> temp;
+    trajectory_msgs::JointTrajectoryPoint temp_points;
+    trajectory_msgs::JointTrajectoryPoint blank;
+
+    std::ifstream info;
+    info.open(filename,std::ifstream::in | std::ofstream::binary);
+
+    if(!info.is_open())
+    {
+        return false;
+    }
+
+    // First read meta data
+    info.read((char*)(&plan_count), sizeof(plan_count));                    // Number of plans
+    plans.reserve(plan_count);
+
+    if (debug == 1) ROS_INFO("%d",plan_count);
+    for (size_t n = 0; n < plan_count; n++)
+    {
+        // Iterate through waypoints
+        info.read((char*)(&wpt_count),sizeof(wpt_count));
+        temp.push_back(wpt_count);
+        if (debug == 1) ROS_INFO("%d",wpt_count);
+        for (size_t wpt_idx = 0; wpt_idx < wpt_count; wpt_idx++)
+        {
+            for (size_t i=0; i < UR5_DOF; i++)
+            {
+                info.read((char *)(&temp_double),sizeof(temp_double));
+                temp_points.positions.push_back(temp_double);
+                info.read((char *)(&temp_double),sizeof(temp_double));
+                temp_points.velocities.push_back(temp_double);
+            }
+            info.read((char *)(&temp_duration),sizeof(temp_duration));
+            //ros::Duration d(z);
+            temp_points.time_from_start = temp_duration;
+            temp_plan.trajectory.joint_trajectory.points.push_back(temp_points);
+            temp_points = blank;
+        }
+
+        //RobotTrajectory -> JointTrajectory -> Header
+        info.read((char *)(&temp_plan.trajectory.joint_trajectory.header.seq),sizeof(uint32_t));
+        info.read((char *)(&temp_plan.trajectory.joint_trajectory.header.stamp),sizeof(ros::Time));
+        getline (info,temp_plan.trajectory.joint_trajectory.header.frame_id);
+
+        //RobotTrajectory -> JointTrajectory -> joint_names
+        for (size_t i=0; i < UR5_DOF; i++)
+        {
+            getline(info,temp_string);
+            temp_plan.trajectory.joint_trajectory.joint_names.push_back(temp_string);
+            temp_string = blank_string;
+        }
+
+        //start_state
+        //RobotState -> JointState -> Header
+        info.read((char *)(&temp_plan.start_state.joint_state.header.seq),sizeof(uint32_t));
+        info.read((char *)(&temp_plan.start_state.joint_state.header.stamp),sizeof(ros::Time));
+        getline(info, temp_plan.start_state.joint_state.header.frame_id);
+
+        //RobotState -> JointState -> stirng & position
+        for (size_t j = 0; j < UR5_DOF; j++)
+        {
+            getline(info, temp_string);
+            temp_plan.start_state.joint_state.name.push_back(temp_string);
+            temp_string = blank_string;
+
+            info.read((char *)(&temp_double),sizeof(temp_double));
+            temp_plan.start_state.joint_state.position.push_back(temp_double);
+        }
+
+        //end_state
+        //RobotState -> JointState -> Header
+        info.read((char *)(&temp_plan.end_state.joint_state.header.seq),sizeof(uint32_t));
+        info.read((char *)(&temp_plan.end_state.joint_state.header.stamp),sizeof(ros::Time));
+        getline (info,temp_plan.end_state.joint_state.header.frame_id);
+
+        //RobotState -> JointState -> stirng & position
+        for (size_t j = 0; j < UR5_DOF; j++)
+        {
+            getline(info,temp_string);
+            temp_plan.end_state.joint_state.name.push_back(temp_string);
+            temp_string = blank_string;
+
+            info.read((char *)(&temp_double),sizeof(temp_double));
+            temp_plan.end_state.joint_state.position.push_back(temp_double);
+
+        }
+
+        //Index
+        info.read((char *)(&temp_plan.start_target_index),sizeof(int));
+        info.read((char *)(&temp_plan.end_target_index),sizeof(int));
+
+        // Duration
+        info.read((char*) &(temp_plan.duration), sizeof(ur5_motion_plan::duration));
+
+        // Now check for an apple
+        /* Define the attached object message*/
+        getline(info,temp_string);
+        if (debug) { std::cout << temp_string << '\n'; }
+        if (temp_string == "apple")
+        {
+            std::cout << "Adding apple for this trajectory.\n";
+            temp_plan.start_state.attached_collision_objects.push_back(getAppleObjectMsg());
+            temp_plan.end_state.attached_collision_objects.push_back(getAppleObjectMsg());
+        }
+        else
+        {
+            ROS_ASSERT(temp_string == "no apple");
+        }
+
+        // Other parameters
+        temp_plan.num_wpts = wpt_count;
+
+        plans.push_back(temp_plan);
+        temp_plan = empty;
+    }
+
+    info.close();
+
+    return true;
+
+}
@@ -0,0 +1,18 @@
+#ifndef PLAN_IO_H
+#define PLAN_IO_H
+
+#include "kd_tree.h"
+
+#include <moveit_msgs/AttachedCollisionObject.h>
+
+#include <vector>
+
+// Binary plan library files (.dat). Kept apart from TrajectoryLibrary so tools can read and
+// write libraries without a ROS master or planning scene.
+bool writePlanFile(const std::vector<ur5_motion_plan>& plans, const char* filename, bool debug = false);
+bool readPlanFile(std::vector<ur5_motion_plan>& plans, const char* filename, bool debug = false);
+
+// Apple held by the end effector, attached to both states of plans flagged "apple"
+moveit_msgs::AttachedCollisionObject getAppleObjectMsg();
+
+#endif // PLAN_IO_H
@@ -0,0 +1,170 @@
+#include "plan_pipeline.h"
+
+PlanPipeline::PlanPipeline(TrajectoryLibrary* tlib, double deadline, int parallel_hits, std::size_t max_queued, std::size_t max_targets)
+{
+    _tlib = tlib;
+    _deadline = deadline;
+    _parallel_hits = parallel_hits;
+    _max_queued = max_queued;
+    _max_targets = max_targets;
+    _sequence = 0;
+    _generation = 0;
+    _running = false;
+    return;
+}
+
+PlanPipeline::~PlanPipeline()
+{
+    stop();
+}
+
+void PlanPipeline::start(const joint_values_t& start_jvals)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    if (_running)
+    {
+        return;
+    }
+    _plan_from = start_jvals;
+    _running = true;
+    _worker = boost::thread(boost::bind(&PlanPipeline::workerLoop, this));
+    return;
+}
+
+void PlanPipeline::stop()
+{
+    {
+        boost::mutex::scoped_lock lock(_mutex);
+        if (!_running)
+        {
+            return;
+        }
+        _running = false;
+        _cond.notify_all();
+    }
+    // An in-flight fit is allowed to finish
+    _worker.join();
+    return;
+}
+
+bool PlanPipeline::pushTarget(const joint_values_t& jvals)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    if (_targets.size() >= _max_targets)
+    {
+        return false;
+    }
+    pipeline_item item;
+    item.end_jvals = jvals;
+    item.sequence = _sequence++;
+    _targets.push_back(item);
+    _cond.notify_all();
+    return true;
+}
+
+void PlanPipeline::requeueTarget(const pipeline_item& item)
+{
+    // Back into its place in the sequence, so a cancel never reorders the tour.
+    // Requeued targets were already admitted, so they don't count against max_targets.
+    std::deque<pipeline_item>::iterator it = _targets.begin();
+    while (it != _targets.end() && it->sequence < item.sequence)
+    {
+        ++it;
+    }
+    _targets.insert(it, item);
+    return;
+}
+
+std::size_t PlanPipeline::getPendingTargetCount()
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    return _targets.size();
+}
+
+bool PlanPipeline::popPlan(pipeline_item& item, double timeout)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    boost::system_time wake = boost::get_system_time() + boost::posix_time::microseconds((long) (timeout * 1e6));
+    while (_running && _plans.empty())
+    {
+        if (!_cond.timed_wait(lock, wake))
+        {
+            break;
+        }
+    }
+    if (_plans.empty())
+    {
+        return false;
+    }
+    item = _plans.front();
+    _plans.pop_front();
+    _cond.notify_all();
+    return true;
+}
+
+void PlanPipeline::cancel(const joint_values_t& current_jvals, const pipeline_item* failed)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+
+    if (failed != NULL)
+    {
+        requeueTarget(*failed);
+    }
+
+    // Put targets of discarded plans back in the queue, in order
+    while (!_plans.empty())
+    {
+        requeueTarget(_plans.back());
+        _plans.pop_back();
+    }
+
+    _plan_from = current_jvals;
+    _generation++;
+    _cond.notify_all();
+    return;
+}
+
+void PlanPipeline::workerLoop()
+{
+    while (1)
+    {
+        // Wait for a target and room in the plan queue
+        pipeline_item item;
+        int generation;
+        {
+            boost::mutex::scoped_lock lock(_mutex);
+            while (_running && (_targets.empty() || _plans.size() >= _max_queued))
+            {
+                _cond.wait(lock);
+            }
+            if (!_running)
+            {
+                return;
+            }
+            item = _targets.front();
+            _targets.pop_front();
+            item.start_jvals = _plan_from;
+            generation = _generation;
+        }
+
+        // Plan outside the lock
+        bool success = _tlib->fitPlanConfigured(item.plan, item.start_jvals, item.end_jvals, _deadline, _parallel_hits);
+
+        boost::mutex::scoped_lock lock(_mutex);
+        if (generation != _generation)
+        {
+            // Cancelled while planning: the start state is stale, so replan this target
+            requeueTarget(item);
+            continue;
+        }
+        if (!success)
+        {
+            // Skip unreachable target; next plan still starts from _plan_from
+            ROS_ERROR("Pipeline could not fit plan for target %d. Skipping.", item.sequence);
+            continue;
+        }
+        _plan_from = item.end_jvals;
+        _plans.push_back(item);
+        _cond.notify_all();
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef PLAN_PIPELINE_H
+#define PLAN_PIPELINE_H
+
+#include "trajectory_library.h"
+
+#include <boost/thread.hpp>
+
+#include <deque>
+
+typedef struct {
+    joint_values_t start_jvals;
+    joint_values_t end_jvals;
+    ur5_motion_plan plan;
+    int sequence;               // order in which targets were queued
+} pipeline_item;
+
+class PlanPipeline
+{
+    // Planner
+    TrajectoryLibrary* _tlib;
+    double _deadline;
+    int _parallel_hits;
+
+    // Queues
+    std::size_t _max_queued;
+    std::size_t _max_targets;
+    std::deque<pipeline_item> _targets;         // waiting to be planned, in sequence order
+    std::deque<pipeline_item> _plans;           // planned, waiting to be executed
+    joint_values_t _plan_from;                  // end state of the last planned trajectory
+    int _sequence;
+    int _generation;                            // bumped on cancel so in-flight plans get dropped
+
+    // Worker
+    boost::mutex _mutex;
+    boost::condition_variable _cond;
+    boost::thread _worker;
+    bool _running;
+
+    void workerLoop();
+    void requeueTarget(const pipeline_item& item);
+
+public:
+    PlanPipeline(TrajectoryLibrary* tlib, double deadline, int parallel_hits, std::size_t max_queued, std::size_t max_targets);
+    ~PlanPipeline();
+
+    void start(const joint_values_t& start_jvals);
+    void stop();
+
+    // Returns false without queueing once max_targets are waiting; the caller keeps the target and retries
+    bool pushTarget(const joint_values_t& jvals);
+    std::size_t getPendingTargetCount();
+
+    // Blocks until a plan is ready. Returns false on timeout (s) or once stopped.
+    bool popPlan(pipeline_item& item, double timeout);
+
+    // Drop queued plans and replan their targets from where the robot actually is. A plan that failed
+    // to execute, already popped, is given back too so its target is not lost from the tour.
+    void cancel(const joint_values_t& current_jvals, const pipeline_item* failed = NULL);
+};
+
+#endif // PLAN_PIPELINE_H
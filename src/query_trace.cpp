@@ -0,0 +1,122 @@
+#include "query_trace.h"
+
+#include <iomanip>
+#include <sstream>
+
+static void writeHeader(std::ostream& out)
+{
+    out << "# fitPlan query trace: " << UR5_DOF << " start joint values, " << UR5_DOF << " end joint values\n";
+    return;
+}
+
+static void writeQueryLine(std::ostream& out, const joint_values_t& start_jvals, const joint_values_t& end_jvals)
+{
+    out << std::setprecision(9);
+    for (std::size_t i = 0; i < start_jvals.size(); i++)
+    {
+        out << start_jvals[i] << ' ';
+    }
+    for (std::size_t i = 0; i < end_jvals.size(); i++)
+    {
+        out << end_jvals[i] << ((i + 1 < end_jvals.size()) ? ' ' : '\n');
+    }
+    return;
+}
+
+bool writeQueryTrace(const std::vector<trace_query>& queries, const char* filename)
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    writeHeader(file);
+    for (std::size_t q = 0; q < queries.size(); q++)
+    {
+        writeQueryLine(file, queries[q].start_jvals, queries[q].end_jvals);
+    }
+    return file.good();
+}
+
+bool readQueryTrace(std::vector<trace_query>& queries, const char* filename)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    queries.clear();
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        std::istringstream values(line);
+        trace_query query;
+        query.start_jvals.resize(UR5_DOF);
+        query.end_jvals.resize(UR5_DOF);
+        for (int i = 0; i < UR5_DOF; i++)
+        {
+            values >> query.start_jvals[i];
+        }
+        for (int i = 0; i < UR5_DOF; i++)
+        {
+            values >> query.end_jvals[i];
+        }
+        if (values.fail())
+        {
+            // Malformed line
+            return false;
+        }
+        queries.push_back(query);
+    }
+    return true;
+}
+
+bool QueryTraceRecorder::open(const std::string& filename)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    if (_file.is_open())
+    {
+        _file.close();
+    }
+    _file.open(filename.c_str());
+    if (!_file.is_open())
+    {
+        return false;
+    }
+    writeHeader(_file);
+    return true;
+}
+
+void QueryTraceRecorder::close()
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    _file.close();
+    return;
+}
+
+bool QueryTraceRecorder::isOpen()
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    return _file.is_open();
+}
+
+void QueryTraceRecorder::record(const joint_values_t& start_jvals, const joint_values_t& end_jvals)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    if (!_file.is_open())
+    {
+        return;
+    }
+    writeQueryLine(_file, start_jvals, end_jvals);
+
+    // Keep the trace usable if the node is killed
+    _file.flush();
+    return;
+}
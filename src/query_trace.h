@@ -0,0 +1,36 @@
+#ifndef QUERY_TRACE_H
+#define QUERY_TRACE_H
+
+#include "kd_tree.h"
+
+#include <boost/thread/mutex.hpp>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Plain text, one fitPlan query per line: UR5_DOF start joint values, then UR5_DOF end joint values.
+// Lines starting with '#' are comments.
+typedef struct {
+    joint_values_t start_jvals;
+    joint_values_t end_jvals;
+} trace_query;
+
+bool writeQueryTrace(const std::vector<trace_query>& queries, const char* filename);
+bool readQueryTrace(std::vector<trace_query>& queries, const char* filename);
+
+// Appends queries to a trace file as they are made; safe to call from several threads
+class QueryTraceRecorder
+{
+    boost::mutex _mutex;
+    std::ofstream _file;
+
+public:
+    bool open(const std::string& filename);
+    void close();
+    bool isOpen();
+
+    void record(const joint_values_t& start_jvals, const joint_values_t& end_jvals);
+};
+
+#endif // QUERY_TRACE_H
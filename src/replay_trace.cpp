@@ -0,0 +1,136 @@
+#include "trajectory_library.h"
+#include "bench_util.h"
+#include "trace_span.h"
+
+
+int main(int argc, char** argv)
+{
+    ros::init(argc, argv, "Replay Query Trace");
+    ros::NodeHandle nh("~");
+
+    double BUSH_RADIUS;
+    nh.param("bush_radius", BUSH_RADIUS, WEEDING_BUSH_RADIUS);
+
+    std::string library_file;
+    std::string trace_file;
+    int repeat;
+    double fit_deadline;
+    int fit_parallel_hits;
+    nh.param("library", library_file, std::string("plans_weeding.dat"));
+    nh.param("trace", trace_file, std::string(APPLE_CRUSHER_CONFIG_DIR "/weeding_trace.txt"));
+    nh.param("repeat", repeat, 1);
+    nh.param("fit_deadline", fit_deadline, 1.0);
+    nh.param("fit_parallel_hits", fit_parallel_hits, 0);
+    std::string metrics_file;
+    nh.param("metrics_file", metrics_file, std::string(""));
+    std::string spans_file;
+    nh.param("spans_file", spans_file, std::string(""));
+    if (fit_deadline <= 0 && fit_parallel_hits <= 0)
+    {
+        ROS_ERROR("Serial replay needs a positive fit_deadline.");
+        return 1;
+    }
+
+    std::vector<trace_query> queries;
+    if (!readQueryTrace(queries, trace_file.c_str()))
+    {
+        ROS_ERROR("Could not read query trace %s.", trace_file.c_str());
+        return 1;
+    }
+    ROS_INFO("Replaying %d queries from %s, %d time(s).", (int) queries.size(), trace_file.c_str(), repeat);
+
+    TrajectoryLibrary tlib(nh);
+    tlib.initWorkspaceBounds();
+    tlib.addSphereCollisionObject(BUSH_RADIUS);
+    tlib.importFromFile(library_file.c_str());
+
+    // Chrome trace of the replay; needs a build with APPLE_CRUSHER_TRACING
+    if (!spans_file.empty() && !Tracer::enable(true))
+    {
+        ROS_WARN("Trace spans are compiled out; %s will not be written.", spans_file.c_str());
+        spans_file.clear();
+    }
+
+    LatencyStats total_stats("total");
+    LatencyStats lookup_stats("lookup");
+    LatencyStats warp_stats("warp");
+    LatencyStats validation_stats("validation");
+    LatencyStats duration_stats("plan duration");
+    int successes = 0;
+    int fallbacks = 0;
+    int deadline_hits = 0;
+    long iterations = 0;
+    long hits_tried = 0;
+
+    for (int r = 0; r < repeat; r++)
+    {
+        for (std::size_t q = 0; q < queries.size(); q++)
+        {
+            ur5_motion_plan plan;
+            fit_report report;
+
+            ros::WallTime start = ros::WallTime::now();
+            bool success;
+            if (fit_parallel_hits > 0)
+            {
+                success = tlib.fitPlanParallel(plan, queries[q].start_jvals, queries[q].end_jvals, fit_parallel_hits, fit_deadline <= 0, fit_deadline, report);
+            }
+            else
+            {
+                success = tlib.fitPlan(plan, queries[q].start_jvals, queries[q].end_jvals, fit_deadline, report);
+            }
+            total_stats.add((ros::WallTime::now() - start).toSec());
+
+            lookup_stats.add(report.lookup_time);
+            warp_stats.add(report.warp_time);
+            validation_stats.add(report.validation_time);
+            iterations += report.warp_iterations;
+            hits_tried += report.hits_tried;
+            if (report.deadline_hit) deadline_hits++;
+            if (success)
+            {
+                successes++;
+                if (report.used_fallback) fallbacks++;
+                duration_stats.add(plan.duration);
+            }
+        }
+    }
+
+    int total = queries.size() * repeat;
+    std::cout << "\nReplayed " << total << " queries against " << library_file << std::endl;
+    std::cout << "  Success rate: " << successes << "/" << total << " (" << fallbacks << " straight-line fallbacks), "
+              << deadline_hits << " deadline hits" << std::endl;
+    if (total > 0)
+    {
+        std::cout << "  Hits tried per query: " << (double) hits_tried / total
+                  << ", warp iterations per query: " << (double) iterations / total << std::endl;
+    }
+    std::cout << "  Plan duration (s): mean " << duration_stats.mean() << ", p50 " << duration_stats.percentile(50)
+              << ", p90 " << duration_stats.percentile(90) << ", max " << duration_stats.percentile(100) << std::endl;
+    std::cout << "Stage latency:" << std::endl;
+    total_stats.printInfo(std::cout);
+    lookup_stats.printInfo(std::cout);
+    warp_stats.printInfo(std::cout);
+    validation_stats.printInfo(std::cout);
+    tlib.printValidityCacheInfo(std::cout);
+    tlib.getMetrics().printInfo(std::cout);
+    if (!metrics_file.empty())
+    {
+        tlib.writeMetrics(metrics_file);
+    }
+    if (!spans_file.empty())
+    {
+        Tracer::enable(false);
+        if (Tracer::writeChromeJson(spans_file))
+        {
+            ROS_INFO("Trace spans written to %s.", spans_file.c_str());
+        }
+        else
+        {
+            ROS_ERROR("Could not write trace spans to %s.", spans_file.c_str());
+        }
+    }
+
+    ros::shutdown();
+    return 0;
+}
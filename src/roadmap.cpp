@@ -0,0 +1,192 @@
+#include "roadmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+
+Roadmap::Roadmap()
+{
+    _num_edges = 0;
+    return;
+}
+
+double Roadmap::distance(const joint_values_t& a, const joint_values_t& b)
+{
+    double dist = 0;
+    for (std::size_t i = 0; i < a.size(); i++)
+    {
+        dist += fabs(a[i] - b[i]);
+    }
+    return dist;
+}
+
+int Roadmap::addNode(const joint_values_t& jvals)
+{
+    int node = _nodes.size();
+    _nodes.push_back(jvals);
+    _edges.push_back(std::vector<roadmap_edge>());
+    _parent.push_back(node);
+    _component_size.push_back(1);
+    return node;
+}
+
+int Roadmap::findRoot(int node) const
+{
+    while (_parent[node] != node)
+    {
+        node = _parent[node];
+    }
+    return node;
+}
+
+void Roadmap::addEdge(int a, int b)
+{
+    roadmap_edge edge;
+    edge.cost = distance(_nodes[a], _nodes[b]);
+    edge.node = b;
+    _edges[a].push_back(edge);
+    edge.node = a;
+    _edges[b].push_back(edge);
+    _num_edges++;
+
+    // Merge components
+    int root_a = findRoot(a);
+    int root_b = findRoot(b);
+    if (root_a != root_b)
+    {
+        if (_component_size[root_a] < _component_size[root_b])
+        {
+            std::swap(root_a, root_b);
+        }
+        _parent[root_b] = root_a;
+        _component_size[root_a] += _component_size[root_b];
+    }
+    return;
+}
+
+bool Roadmap::hasEdge(int a, int b) const
+{
+    for (std::size_t i = 0; i < _edges[a].size(); i++)
+    {
+        if (_edges[a][i].node == b)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Roadmap::clear()
+{
+    _nodes.clear();
+    _edges.clear();
+    _parent.clear();
+    _component_size.clear();
+    _num_edges = 0;
+    return;
+}
+
+void Roadmap::nearest(const joint_values_t& jvals, int k, double max_dist, std::vector<int>& neighbors) const
+{
+    // Brute force: the roadmap is built once per library, and is small next to the pair count
+    std::vector< std::pair<double, int> > candidates;
+    for (std::size_t i = 0; i < _nodes.size(); i++)
+    {
+        double dist = distance(jvals, _nodes[i]);
+        if (dist <= max_dist)
+        {
+            candidates.push_back(std::make_pair(dist, (int) i));
+        }
+    }
+    std::size_t num_nearest = std::min(candidates.size(), (std::size_t) k);
+    std::partial_sort(candidates.begin(), candidates.begin() + num_nearest, candidates.end());
+
+    neighbors.clear();
+    for (std::size_t i = 0; i < num_nearest; i++)
+    {
+        neighbors.push_back(candidates[i].second);
+    }
+    return;
+}
+
+bool Roadmap::connected(int a, int b) const
+{
+    return findRoot(a) == findRoot(b);
+}
+
+std::size_t Roadmap::countComponents() const
+{
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < _nodes.size(); i++)
+    {
+        if (_parent[i] == (int) i)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+void Roadmap::shortestPathTree(int start, std::vector<int>& parents) const
+{
+    typedef std::pair<double, int> queue_entry;
+    std::priority_queue< queue_entry, std::vector<queue_entry>, std::greater<queue_entry> > open;
+    std::vector<double> cost(_nodes.size(), HUGE_VAL);
+    parents.assign(_nodes.size(), -1);
+
+    cost[start] = 0;
+    open.push(std::make_pair(0.0, start));
+    while (!open.empty())
+    {
+        queue_entry top = open.top();
+        open.pop();
+        int node = top.second;
+        if (top.first > cost[node])
+        {
+            // Stale entry, node was reached more cheaply since
+            continue;
+        }
+        for (std::size_t i = 0; i < _edges[node].size(); i++)
+        {
+            const roadmap_edge& edge = _edges[node][i];
+            double new_cost = cost[node] + edge.cost;
+            if (new_cost < cost[edge.node])
+            {
+                cost[edge.node] = new_cost;
+                parents[edge.node] = node;
+                open.push(std::make_pair(new_cost, edge.node));
+            }
+        }
+    }
+    return;
+}
+
+bool Roadmap::tracePath(const std::vector<int>& parents, int start, int goal, std::vector<int>& path) const
+{
+    path.clear();
+    if (goal != start && parents[goal] < 0)
+    {
+        return false;
+    }
+    for (int node = goal; node != start; node = parents[node])
+    {
+        path.push_back(node);
+    }
+    path.push_back(start);
+    std::reverse(path.begin(), path.end());
+    return true;
+}
+
+void Roadmap::printInfo(std::ostream& cout) const
+{
+    cout << "Roadmap: " << std::endl;
+    cout << "  Nodes: " << _nodes.size() << std::endl;
+    cout << "  Edges: " << _num_edges << std::endl;
+    if (!_nodes.empty())
+    {
+        cout << "  Mean degree: " << 2.0 * _num_edges / _nodes.size() << std::endl;
+    }
+    cout << "  Components: " << countComponents() << std::endl;
+    return;
+}
@@ -0,0 +1,54 @@
+#ifndef ROADMAP_H
+#define ROADMAP_H
+
+#include "kd_tree.h"
+
+#include <iostream>
+#include <vector>
+
+typedef struct {
+    int node;
+    double cost;                // summed joint distance (rad)
+} roadmap_edge;
+
+// Undirected joint space graph for multi-query planning. It knows nothing of the robot: callers add
+// only collision-free nodes and edges, so every graph path is a valid joint space path.
+class Roadmap
+{
+    std::vector<joint_values_t> _nodes;
+    std::vector< std::vector<roadmap_edge> > _edges;
+    std::size_t _num_edges;
+
+    // Union-find over nodes, to tell cheaply whether two nodes are joined at all
+    std::vector<int> _parent;
+    std::vector<int> _component_size;   // valid at roots only; smaller trees are hung under larger
+    int findRoot(int node) const;
+
+public:
+    Roadmap();
+
+    static double distance(const joint_values_t& a, const joint_values_t& b);
+
+    int addNode(const joint_values_t& jvals);
+    void addEdge(int a, int b);
+    bool hasEdge(int a, int b) const;
+    void clear();
+
+    inline std::size_t size() const { return _nodes.size(); }
+    inline std::size_t numEdges() const { return _num_edges; }
+    inline const joint_values_t& getNode(int node) const { return _nodes[node]; }
+
+    // Up to k nodes within max_dist of jvals, nearest first
+    void nearest(const joint_values_t& jvals, int k, double max_dist, std::vector<int>& neighbors) const;
+    bool connected(int a, int b) const;
+    std::size_t countComponents() const;
+
+    // Dijkstra from start; parents[n] is the previous node on the cheapest path to n, -1 if unreached
+    void shortestPathTree(int start, std::vector<int>& parents) const;
+    // Path start to goal inclusive, read off a tree rooted at start
+    bool tracePath(const std::vector<int>& parents, int start, int goal, std::vector<int>& path) const;
+
+    void printInfo(std::ostream& cout) const;
+};
+
+#endif // ROADMAP_H
@@ -0,0 +1,229 @@
+#include "target_sequencer.h"
+
+#include <cmath>
+
+TargetSequencer::TargetSequencer(KDTreePtr kdtree)
+{
+    _kdtree = kdtree;
+    _durations = NULL;
+    _node_count = 0;
+    return;
+}
+
+void TargetSequencer::setDurationMatrix(const DurationMatrix* durations, const std::vector< std::vector<joint_values_t> >& targets)
+{
+    _durations = durations;
+    _library_targets = targets;
+    return;
+}
+
+bool TargetSequencer::snapTarget(const joint_values_t& jvals, int& group, int& target)
+{
+    for (int g = 0; g < _library_targets.size() && g < _durations->getGroupCount(); g++)
+    {
+        for (int t = 0; t < _library_targets[g].size() && t < _durations->getGroupSize(g); t++)
+        {
+            const joint_values_t& target_jvals = _library_targets[g][t];
+            if (target_jvals.empty())
+            {
+                continue;
+            }
+            double dist = 0;
+            for (std::size_t j = 0; j < jvals.size() && j < target_jvals.size(); j++)
+            {
+                dist += fabs(jvals[j] - target_jvals[j]);
+            }
+            if (dist <= SEQUENCER_SNAP_DIST)
+            {
+                group = g;
+                target = t;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+double TargetSequencer::estimateTravelTime(const joint_values_t& start_jvals, const joint_values_t& end_jvals)
+{
+    // Both ends on library targets: the build recorded the travel time, or that there is none
+    int start_group, start_target, end_group, end_target;
+    if (_durations != NULL && snapTarget(start_jvals, start_group, start_target) && snapTarget(end_jvals, end_group, end_target))
+    {
+        double duration = _durations->get(start_group, start_target, end_group, end_target);
+        if (duration >= 0)
+        {
+            return duration;
+        }
+        if (duration == DURATION_FAILED)
+        {
+            return SEQUENCER_UNREACHABLE_COST;
+        }
+    }
+
+    // Otherwise the closest library plan, plus the warp from it to this pair
+    std::size_t plan_index;
+    double distance;
+    if (!_kdtree->nearest(plan_index, distance, start_jvals, end_jvals) || distance > SEQUENCER_MAX_HIT_DIST)
+    {
+        return SEQUENCER_UNREACHABLE_COST;
+    }
+    return _kdtree->getPlanDuration(plan_index) + SEQUENCER_HIT_DIST_COST * distance;
+}
+
+void TargetSequencer::setTargets(const joint_values_t& start_jvals, const std::vector<joint_values_t>& targets)
+{
+    _node_count = targets.size() + 1;
+    _cost.assign(_node_count, std::vector<double>(_node_count, 0.0));
+
+    for (std::size_t a = 0; a < _node_count; a++)
+    {
+        const joint_values_t& from = (a == 0) ? start_jvals : targets[a-1];
+        // Nothing ever travels back to the start node
+        for (std::size_t b = 1; b < _node_count; b++)
+        {
+            if (a != b)
+            {
+                _cost[a][b] = estimateTravelTime(from, targets[b-1]);
+            }
+        }
+    }
+    return;
+}
+
+double TargetSequencer::pathCost(const std::vector<std::size_t>& path)
+{
+    double cost = 0;
+    for (std::size_t i = 1; i < path.size(); i++)
+    {
+        cost += _cost[ path[i-1] ][ path[i] ];
+    }
+    return cost;
+}
+
+double TargetSequencer::orderCost(const std::vector<std::size_t>& order)
+{
+    std::vector<std::size_t> path(1, 0);
+    for (std::size_t i = 0; i < order.size(); i++)
+    {
+        path.push_back(order[i] + 1);
+    }
+    return pathCost(path);
+}
+
+void TargetSequencer::nearestNeighbour(std::vector<std::size_t>& path)
+{
+    std::vector<bool> visited(_node_count, false);
+    path.clear();
+    path.push_back(0);
+    visited[0] = true;
+
+    for (std::size_t step = 1; step < _node_count; step++)
+    {
+        std::size_t from = path.back();
+        std::size_t next = 0;
+        double min = -1;
+        for (std::size_t b = 1; b < _node_count; b++)
+        {
+            if (!visited[b] && (min < 0 || _cost[from][b] < min))
+            {
+                min = _cost[from][b];
+                next = b;
+            }
+        }
+        path.push_back(next);
+        visited[next] = true;
+    }
+    return;
+}
+
+bool TargetSequencer::twoOpt(std::vector<std::size_t>& path, double& cost)
+{
+    // Costs are asymmetric, so reversed segments are re-costed in full
+    bool improved = false;
+    for (std::size_t i = 1; i + 1 < path.size(); i++)
+    {
+        for (std::size_t j = i + 1; j < path.size(); j++)
+        {
+            std::reverse(path.begin() + i, path.begin() + j + 1);
+            double new_cost = pathCost(path);
+            if (new_cost < cost - 1e-9)
+            {
+                cost = new_cost;
+                improved = true;
+            }
+            else
+            {
+                std::reverse(path.begin() + i, path.begin() + j + 1);
+            }
+        }
+    }
+    return improved;
+}
+
+bool TargetSequencer::orOpt(std::vector<std::size_t>& path, double& cost)
+{
+    // Move chains of 1..SEQUENCER_OR_OPT_LEN targets to a better position
+    bool improved = false;
+    for (std::size_t len = 1; len <= SEQUENCER_OR_OPT_LEN; len++)
+    {
+        for (std::size_t i = 1; i + len <= path.size(); i++)
+        {
+            std::vector<std::size_t> chain(path.begin() + i, path.begin() + i + len);
+            std::vector<std::size_t> rest(path.begin(), path.begin() + i);
+            rest.insert(rest.end(), path.begin() + i + len, path.end());
+
+            for (std::size_t k = 1; k <= rest.size(); k++)
+            {
+                if (k == i)
+                {
+                    // Same position
+                    continue;
+                }
+                std::vector<std::size_t> candidate(rest.begin(), rest.begin() + k);
+                candidate.insert(candidate.end(), chain.begin(), chain.end());
+                candidate.insert(candidate.end(), rest.begin() + k, rest.end());
+
+                double new_cost = pathCost(candidate);
+                if (new_cost < cost - 1e-9)
+                {
+                    path = candidate;
+                    cost = new_cost;
+                    improved = true;
+                    break;
+                }
+            }
+        }
+    }
+    return improved;
+}
+
+double TargetSequencer::solve(std::vector<std::size_t>& order)
+{
+    order.clear();
+    if (_node_count < 2)
+    {
+        return 0;
+    }
+
+    // Greedy construction, then local search until nothing improves
+    std::vector<std::size_t> path;
+    nearestNeighbour(path);
+    double cost = pathCost(path);
+
+    for (int pass = 0; pass < SEQUENCER_MAX_PASSES; pass++)
+    {
+        bool improved = twoOpt(path, cost);
+        improved = orOpt(path, cost) || improved;
+        if (!improved)
+        {
+            break;
+        }
+    }
+
+    for (std::size_t i = 1; i < path.size(); i++)
+    {
+        order.push_back(path[i] - 1);
+    }
+    return cost;
+}
@@ -0,0 +1,53 @@
+#ifndef TARGET_SEQUENCER_H
+#define TARGET_SEQUENCER_H
+
+#include "kd_tree.h"
+#include "duration_matrix.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#define SEQUENCER_UNREACHABLE_COST 1000.0   // travel time assumed when the library has no nearby plan (s)
+#define SEQUENCER_MAX_HIT_DIST 3.0          // summed start and end joint distance (rad) past which a plan says nothing about a pair
+#define SEQUENCER_HIT_DIST_COST 0.5         // s added per rad between a pair and its nearest plan, for the warp
+#define SEQUENCER_SNAP_DIST 0.01            // summed joint distance (rad) within which a query end is a library target
+#define SEQUENCER_MAX_PASSES 50             // local search improvement passes
+#define SEQUENCER_OR_OPT_LEN 3              // longest chain moved by Or-opt
+
+class TargetSequencer
+{
+    // Library used to estimate travel times
+    KDTreePtr _kdtree;
+
+    // Optional build-time travel times between library targets, per group
+    const DurationMatrix* _durations;
+    std::vector< std::vector<joint_values_t> > _library_targets;
+    bool snapTarget(const joint_values_t& jvals, int& group, int& target);
+
+    // Node 0 is the robot's current state, nodes 1..n the targets.
+    // _cost[a][b] is the estimated time to go from a to b (not symmetric).
+    std::size_t _node_count;
+    std::vector< std::vector<double> > _cost;
+
+    // Helper functions
+    double pathCost(const std::vector<std::size_t>& path);
+    void nearestNeighbour(std::vector<std::size_t>& path);
+    bool twoOpt(std::vector<std::size_t>& path, double& cost);
+    bool orOpt(std::vector<std::size_t>& path, double& cost);
+
+public:
+    TargetSequencer(KDTreePtr kdtree);
+
+    // Pairs whose ends are both library targets take their time from durations; targets[g] lists group g's joint values
+    void setDurationMatrix(const DurationMatrix* durations, const std::vector< std::vector<joint_values_t> >& targets);
+
+    double estimateTravelTime(const joint_values_t& start_jvals, const joint_values_t& end_jvals);
+    void setTargets(const joint_values_t& start_jvals, const std::vector<joint_values_t>& targets);
+
+    // Order in which to visit targets (indices into the setTargets vector). Returns estimated total time.
+    double solve(std::vector<std::size_t>& order);
+    double orderCost(const std::vector<std::size_t>& order);
+};
+
+#endif // TARGET_SEQUENCER_H
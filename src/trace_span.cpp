@@ -0,0 +1,132 @@
+#include "trace_span.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <fstream>
+#include <vector>
+
+typedef struct {
+    const char* name;
+    boost::int64_t start;   // us
+    boost::int64_t end;
+} trace_event;
+
+// One thread's spans. The owning thread is the only writer; the lock is only ever contended by a dump.
+struct trace_buffer
+{
+    int tid;
+    boost::mutex mutex;
+    std::vector<trace_event> events;
+    std::size_t next;       // slot the next span goes into
+    bool wrapped;
+};
+
+boost::atomic<bool> Tracer::_enabled(false);
+
+// Buffers outlive their threads so spans from finished threads still get written
+static boost::mutex buffers_mutex;
+static std::vector< boost::shared_ptr<trace_buffer> > buffers;
+static void keepBuffer(trace_buffer*) {}
+static boost::thread_specific_ptr<trace_buffer> thread_buffer(&keepBuffer);
+
+static const boost::posix_time::ptime trace_epoch = boost::posix_time::microsec_clock::universal_time();
+
+static trace_buffer* getThreadBuffer()
+{
+    trace_buffer* buffer = thread_buffer.get();
+    if (buffer == NULL)
+    {
+        boost::shared_ptr<trace_buffer> created(new trace_buffer());
+        created->events.resize(TRACE_BUFFER_EVENTS);
+        created->next = 0;
+        created->wrapped = false;
+
+        boost::mutex::scoped_lock lock(buffers_mutex);
+        created->tid = buffers.size() + 1;
+        buffers.push_back(created);
+        buffer = created.get();
+        thread_buffer.reset(buffer);
+    }
+    return buffer;
+}
+
+bool Tracer::enable(bool enabled)
+{
+#ifdef APPLE_CRUSHER_TRACING
+    _enabled.store(enabled);
+    return true;
+#else
+    return !enabled;
+#endif
+}
+
+boost::int64_t Tracer::now()
+{
+    return (boost::posix_time::microsec_clock::universal_time() - trace_epoch).total_microseconds();
+}
+
+void Tracer::record(const char* name, boost::int64_t start, boost::int64_t end)
+{
+    trace_buffer* buffer = getThreadBuffer();
+    boost::mutex::scoped_lock lock(buffer->mutex);
+
+    trace_event& event = buffer->events[buffer->next];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    buffer->next++;
+    if (buffer->next == buffer->events.size())
+    {
+        buffer->next = 0;
+        buffer->wrapped = true;
+    }
+    return;
+}
+
+bool Tracer::writeChromeJson(const std::string& filename)
+{
+    std::ofstream file(filename.c_str());
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    // Complete ("X") events, times in us
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    boost::mutex::scoped_lock lock(buffers_mutex);
+    for (std::size_t b = 0; b < buffers.size(); b++)
+    {
+        trace_buffer& buffer = *buffers[b];
+        boost::mutex::scoped_lock buffer_lock(buffer.mutex);
+
+        // Oldest first
+        std::size_t count = buffer.wrapped ? buffer.events.size() : buffer.next;
+        std::size_t oldest = buffer.wrapped ? buffer.next : 0;
+        for (std::size_t i = 0; i < count; i++)
+        {
+            const trace_event& event = buffer.events[(oldest + i) % buffer.events.size()];
+            file << (first ? "\n" : ",\n")
+                 << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer.tid
+                 << ", \"ts\": " << event.start << ", \"dur\": " << (event.end - event.start) << "}";
+            first = false;
+        }
+    }
+    file << "\n]}" << std::endl;
+    return file.good();
+}
+
+void Tracer::clear()
+{
+    boost::mutex::scoped_lock lock(buffers_mutex);
+    for (std::size_t b = 0; b < buffers.size(); b++)
+    {
+        boost::mutex::scoped_lock buffer_lock(buffers[b]->mutex);
+        buffers[b]->next = 0;
+        buffers[b]->wrapped = false;
+    }
+    return;
+}
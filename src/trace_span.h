@@ -0,0 +1,61 @@
+#ifndef TRACE_SPAN_H
+#define TRACE_SPAN_H
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
+#include <string>
+
+#define TRACE_BUFFER_EVENTS 65536   // per thread; oldest spans are overwritten once full
+
+// Scoped timing spans, written to Chrome / Perfetto trace JSON (chrome://tracing, ui.perfetto.dev).
+// Spans are compiled in only with APPLE_CRUSHER_TRACING (the CMake option of the same name) and then
+// still record nothing until Tracer::enable(true). Each thread appends to its own ring buffer.
+class Tracer
+{
+    static boost::atomic<bool> _enabled;
+
+public:
+    // False if spans were compiled out
+    static bool enable(bool enabled);
+    static inline bool isEnabled() { return _enabled.load(boost::memory_order_relaxed); }
+
+    static boost::int64_t now();    // us
+    static void record(const char* name, boost::int64_t start, boost::int64_t end);
+
+    // Snapshot of every thread's buffer; fine to call while spans are being recorded
+    static bool writeChromeJson(const std::string& filename);
+    static void clear();
+};
+
+// Times its own scope. name must outlive the trace, which string literals do.
+class TraceSpan
+{
+    const char* _name;
+    boost::int64_t _start;          // < 0 if tracing was off on entry
+
+public:
+    inline TraceSpan(const char* name)
+    {
+        _name = name;
+        _start = Tracer::isEnabled() ? Tracer::now() : -1;
+    }
+    inline ~TraceSpan()
+    {
+        if (_start >= 0)
+        {
+            Tracer::record(_name, _start, Tracer::now());
+        }
+    }
+};
+
+#define TRACE_SPAN_CONCAT_(a, b) a##b
+#define TRACE_SPAN_CONCAT(a, b) TRACE_SPAN_CONCAT_(a, b)
+
+#ifdef APPLE_CRUSHER_TRACING
+#define TRACE_SPAN(name) TraceSpan TRACE_SPAN_CONCAT(_trace_span_, __LINE__)(name)
+#else
+#define TRACE_SPAN(name)
+#endif
+
+#endif // TRACE_SPAN_H
@@ -1,7 +1,60 @@
 #include "trajectory_library.h"
+#include "plan_pipeline.h"
+#include "trace_span.h"
+
+#include <boost/random/uniform_real_distribution.hpp>
 
 #define STUB ROS_INFO("LINE %d", __LINE__)
 
+static double elapsedSec(const boost::posix_time::ptime& since)
+{
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    return (now - since).total_microseconds() * 1e-6;
+}
+
+// Shared state of one fitPlanParallel call
+struct warp_batch
+{
+    std::vector<warp_job> jobs;
+    joint_values_t start_jvals;
+    joint_values_t end_jvals;
+    double max_time;
+    bool first_wins;
+
+    boost::atomic<bool> cancel;
+    boost::mutex mutex;
+    boost::condition_variable finished_cond;
+    int finished;
+    int winner;             // first job to finish with a valid plan, -1 if none yet
+};
+
+struct planner_race
+{
+    std::vector<planning_interface::PlanningContextPtr> contexts;   // one per portfolio planner, NULL if unavailable
+    std::vector<planning_interface::MotionPlanResponse> responses;
+    std::vector<double> solve_times;
+    std::vector<bool> valid;
+    bool first_wins;
+
+    boost::atomic<bool> cancel;
+    boost::mutex mutex;
+    boost::condition_variable finished_cond;
+    int finished;
+    int winner;             // first planner to return a valid path, -1 if none yet
+};
+
+struct shortcut_batch
+{
+    const robot_trajectory::RobotTrajectory* traj;
+    std::size_t start;
+    std::vector<std::size_t> ends;      // candidate end waypoints, furthest first
+    std::vector<bool> valid;
+
+    boost::mutex mutex;
+    boost::condition_variable finished_cond;
+    int finished;
+};
+
 TrajectoryLibrary::TrajectoryLibrary(ros::NodeHandle& nh)
 {
     /* Load up robot model */
@@ -11,6 +64,32 @@ TrajectoryLibrary::TrajectoryLibrary(ros::NodeHandle& nh)
 
     ROS_INFO("Loaded model %s.", _rmodel->getName().c_str());
 
+    // Load up the planning pipeline
+    _planning_pipeline.reset(new planning_pipeline::PlanningPipeline(_rmodel, nh, "/planning_plugin", "/planning_adapters"));
+
+    // Create publisher for rviz
+    _trajectory_publisher = nh.advertise<moveit_msgs::DisplayTrajectory>("/move_group/display_planned_path", 1, true);
+    _plan_scene_publisher = nh.advertise<moveit_msgs::PlanningScene>("/move_group/monitored_planning_scene", 1, true);
+    _robot_state_publisher = nh.advertise<moveit_msgs::DisplayRobotState>("/display_robot_state", 1, true);
+    _collision_object_publisher = nh.advertise<moveit_msgs::CollisionObject>("/collision_object", 1);
+    _metrics_publisher = nh.advertise<std_msgs::String>("/apple_crusher/metrics", 1);
+
+    init();
+    return;
+}
+
+TrajectoryLibrary::TrajectoryLibrary(const robot_model::RobotModelPtr& rmodel)
+{
+    // Headless: no planning pipeline and nothing published, so no master is needed
+    _rmodel = rmodel;
+    ROS_INFO("Using model %s.", _rmodel->getName().c_str());
+
+    init();
+    return;
+}
+
+void TrajectoryLibrary::init()
+{
     ROS_INFO("Grabbing JointModelGroup.");
     _jmg = _rmodel->getJointModelGroup(UR5_GROUP_NAME);
 
@@ -19,26 +98,128 @@ TrajectoryLibrary::TrajectoryLibrary(ros::NodeHandle& nh)
     _plan_scene = planning_scene::PlanningScenePtr(new planning_scene::PlanningScene(_rmodel));
     _acm = _plan_scene->getAllowedCollisionMatrixNonConst();
 
-    // Load up the planning pipeline
-    _planning_pipeline.reset(new planning_pipeline::PlanningPipeline(_rmodel, nh, "/planning_plugin", "/planning_adapters"));
-
     // Initialize time parameterizer
     _time_parametizer.reset(new trajectory_processing::IterativeParabolicTimeParameterization());
 
-    // Create publisher for rviz
-    _trajectory_publisher = nh.advertise<moveit_msgs::DisplayTrajectory>("/move_group/display_planned_path", 1, true);
-    _plan_scene_publisher = nh.advertise<moveit_msgs::PlanningScene>("/move_group/monitored_planning_scene", 1, true);
-    _robot_state_publisher = nh.advertise<moveit_msgs::DisplayRobotState>("/display_robot_state", 1, true);
-    _collision_object_publisher = nh.advertise<moveit_msgs::CollisionObject>("/collision_object", 1);
+    // Joint limits as the parameterizer applies them, for the local timing model behind the warp gradient
+    const std::vector<std::string>& var_names = _rmodel->getVariableNames();
+    for (std::size_t j = 0; j < var_names.size(); j++)
+    {
+        const robot_model::VariableBounds& bounds = _rmodel->getVariableBounds(var_names[j]);
+        _max_velocity.push_back(bounds.velocity_bounded_ ? std::min(fabs(bounds.max_velocity_), fabs(bounds.min_velocity_)) : 1.0);
+        _max_acceleration.push_back(bounds.acceleration_bounded_ ? std::min(fabs(bounds.max_acceleration_), fabs(bounds.min_acceleration_)) : 1.0);
+    }
 
     _num_target_groups = 0;
 
     // Initialize KD Tree
-    std::vector<double> low_bounds(12,-M_PI-0.10);
-    std::vector<double> high_bounds(12, M_PI+0.10);
-    std::vector<std::size_t> res(12, 10);
+    std::vector<double> low_bounds(2*UR5_DOF, -M_PI-KDTREE_BOUND_MARGIN);
+    std::vector<double> high_bounds(2*UR5_DOF, M_PI+KDTREE_BOUND_MARGIN);
+    std::vector<std::size_t> res(2*UR5_DOF, KDTREE_RESOLUTION);
     _kdtree.reset(new KDTree(_rmodel, low_bounds, high_bounds, res));
 
+    // Metrics are registered up front so the hot paths never take the registry lock
+    registerMetrics();
+    _kdtree->setMetrics(_metrics);
+    _metrics_period = 0;
+
+    // Initialize collision check cache
+    _validity_cache.reset(new ValidityCache(VALIDITY_CACHE_RES, VALIDITY_CACHE_MAX_ENTRIES));
+
+    // Default warp optimizer
+    _warp_params.method = GDW_MOMENTUM;
+    _warp_params.max_iterations = 100;
+    _warp_params.max_time = 0;
+    _warp_params.step = 0.01;
+    _warp_params.min_step = 0.0005;
+    _warp_params.momentum = 0.8;
+    _warp_params.min_improvement = 0.001;
+
+    // Online learning is off until configured
+    _learning_params.enabled = false;
+    _learning_params.novelty_dist = 0.2;
+    _learning_params.max_cell_plans = 50;
+    _learning_params.flush_period = 0;
+    _learned_dirty.store(false);
+
+    // Default shortcutting
+    _shortcut_params.parallel = true;
+    _shortcut_params.random_iterations = 50;
+    _shortcut_params.bisections = 4;
+    _shortcut_params.max_time = 0.05;
+    _shortcut_rng.seed(1);
+
+    // A single planner goes straight through the planning pipeline
+    portfolio_params portfolio;
+    portfolio.planner_ids.push_back("manipulator[RRTConnectkConfigDefault]");
+    portfolio.allowed_time = 20.0;
+    portfolio.first_wins = true;
+    setPortfolioParams(portfolio);
+
+    // One workspace per pool thread plus the calling thread; sized once a library is loaded
+    for (int i = 0; i < WARP_POOL_THREADS + 1; i++)
+    {
+        _free_workspaces.push_back(WarpWorkspacePtr(new WarpWorkspace(_rmodel, UR5_GROUP_NAME, 0)));
+    }
+
+    // Start warp worker pool
+    _warp_work.reset(new boost::asio::io_service::work(_warp_service));
+    for (int i = 0; i < WARP_POOL_THREADS; i++)
+    {
+        _warp_threads.create_thread(boost::bind(&TrajectoryLibrary::warpServiceThread, this));
+    }
+
+    return;
+}
+
+TrajectoryLibrary::~TrajectoryLibrary()
+{
+    // Stop background flushing and metrics publishing
+    _flush_thread.interrupt();
+    _flush_thread.join();
+    _metrics_thread.interrupt();
+    _metrics_thread.join();
+
+    // Let queued warps drain; run() returns in each worker once the queue is empty
+    _warp_work.reset();
+    _warp_threads.join_all();
+}
+
+void TrajectoryLibrary::warpServiceThread()
+{
+    _warp_service.run();
+    return;
+}
+
+WarpWorkspacePtr TrajectoryLibrary::acquireWorkspace()
+{
+    boost::mutex::scoped_lock lock(_workspace_mutex);
+    if (_free_workspaces.empty())
+    {
+        // More concurrent warps than expected; this one stays around afterwards
+        return WarpWorkspacePtr(new WarpWorkspace(_rmodel, UR5_GROUP_NAME, _kdtree->getMaxWaypointCount()));
+    }
+    WarpWorkspacePtr workspace = _free_workspaces.back();
+    _free_workspaces.pop_back();
+    return workspace;
+}
+
+void TrajectoryLibrary::releaseWorkspace(const WarpWorkspacePtr& workspace)
+{
+    boost::mutex::scoped_lock lock(_workspace_mutex);
+    _free_workspaces.push_back(workspace);
+    return;
+}
+
+void TrajectoryLibrary::reserveWorkspaces()
+{
+    std::size_t max_wpts = _kdtree->getMaxWaypointCount();
+
+    boost::mutex::scoped_lock lock(_workspace_mutex);
+    for (std::size_t i = 0; i < _free_workspaces.size(); i++)
+    {
+        _free_workspaces[i]->reserve(max_wpts);
+    }
     return;
 }
 
@@ -116,10 +297,16 @@ void TrajectoryLibrary::initWorkspaceBounds()
     object_msg.plane_poses[0] = pose;
     _plan_scene->processCollisionObjectMsg(object_msg);
 
+    // World changed, so cached collision checks are stale
+    _validity_cache->clear();
+
     // Publish updated planning scene
     moveit_msgs::PlanningScene scene_msg;
     _plan_scene->getPlanningSceneMsg(scene_msg);
-    _plan_scene_publisher.publish(scene_msg);
+    if (_plan_scene_publisher)
+    {
+        _plan_scene_publisher.publish(scene_msg);
+    }
 
     return;
 }
@@ -157,10 +344,16 @@ void TrajectoryLibrary::addSphereCollisionObject(double radius)
     _acm.setEntry("obstructo_sphere", "base_link", true);
     _acm.setEntry("obstructo_sphere", "shoulder_link", true);
 
+    // World changed, so cached collision checks are stale
+    _validity_cache->clear();
+
     // Publish updated planning scene
     moveit_msgs::PlanningScene scene_msg;
     _plan_scene->getPlanningSceneMsg(scene_msg);
-    _plan_scene_publisher.publish(scene_msg);
+    if (_plan_scene_publisher)
+    {
+        _plan_scene_publisher.publish(scene_msg);
+    }
 
     return;
 }
@@ -173,6 +366,12 @@ void TrajectoryLibrary::printCollisionWorldInfo(std::ostream& cout)
     return;
 }
 
+void TrajectoryLibrary::printValidityCacheInfo(std::ostream& cout)
+{
+    _validity_cache->printInfo(cout);
+    return;
+}
+
 std::size_t TrajectoryLibrary::rectLinspace(std::vector<joint_values_t>& jvals, grid_rect& grid)
 {
     double di, dj, dk;
@@ -260,6 +459,7 @@ bool TrajectoryLibrary::doIK(std::vector<joint_values_t>& solutions, const geome
     for (int tries = 0; tries < MAX_IK_SOLUTIONS; tries++)
     {
         // Do IK
+        _metric.ik_attempts->inc();
         ik_success = state.setFromIK(_jmg, geo_pose, 5, 0.4, boost::bind(&TrajectoryLibrary::ikValidityCallback, this, solutions, _1, _2, _3));
         if (!ik_success)
         {
@@ -287,6 +487,7 @@ bool TrajectoryLibrary::doIK(std::vector<joint_values_t>& solutions, const geome
 bool TrajectoryLibrary::ikValidityCallback(const std::vector<joint_values_t>& comparison_values, robot_state::RobotState* p_state, const robot_model::JointModelGroup* p_jmg, const double* jvals)
 {
     // ROS_INFO("IK Validity checker...");
+    _metric.ik_solutions_checked->inc();
     // Construct state from given joint values
     p_state->setJointGroupPositions(p_jmg, jvals);
     p_state->update(true);
@@ -367,8 +568,9 @@ void TrajectoryLibrary::printJointValues(const joint_values_t& jvals)
     return;
 }
 
-bool TrajectoryLibrary::planTrajectory(ur5_motion_plan& plan, std::vector<moveit_msgs::Constraints> constraints)
+bool TrajectoryLibrary::planTrajectory(ur5_motion_plan& plan, std::vector<moveit_msgs::Constraints> constraints, build_pair_stats* stats)
 {
+    TRACE_SPAN("planTrajectory");
     planning_interface::MotionPlanRequest req;
     planning_interface::MotionPlanResponse res;
     req.group_name = UR5_GROUP_NAME;
@@ -377,10 +579,8 @@ bool TrajectoryLibrary::planTrajectory(ur5_motion_plan& plan, std::vector<moveit
 
     // Add constraints
     req.goal_constraints = constraints;
-    //req.planner_id = "manipulator[LBKPIECEkConfigDefault]";
-    req.planner_id = "manipulator[RRTConnectkConfigDefault]";
-    //req.planner_id = "manipulator[RRTstarkConfigDefault]";
-    req.allowed_planning_time = 20.0;
+    req.planner_id = _portfolio_params.planner_ids[0];
+    req.allowed_planning_time = _portfolio_params.allowed_time;
 
     req.num_planning_attempts = 3;
 
@@ -394,14 +594,36 @@ bool TrajectoryLibrary::planTrajectory(ur5_motion_plan& plan, std::vector<moveit
     req.workspace_parameters.min_corner.y = -0.38;
     req.workspace_parameters.min_corner.z = 0.05;
 
+    // Headless libraries have no planner to fall back on
+    if (!_planning_pipeline)
+    {
+        ROS_ERROR("No planning pipeline loaded.");
+        return false;
+    }
+
     // Now prepare the planning context
     int tries = 0;
     while (tries < MAX_PLANNER_ATTEMPTS)
     {
-        _planning_pipeline->generatePlan(_plan_scene, req, res);
+        boost::posix_time::ptime stage_start = boost::posix_time::microsec_clock::universal_time();
+        std::string planner_id = req.planner_id;
+        if (_portfolio_params.planner_ids.size() > 1)
+        {
+            solvePortfolio(req, res, planner_id);
+        }
+        else
+        {
+            _planning_pipeline->generatePlan(_plan_scene, req, res);
+        }
+        if (stats != NULL)
+        {
+            stats->attempts++;
+            stats->planner_time += elapsedSec(stage_start);
+        }
         if (res.error_code_.val == res.error_code_.SUCCESS)
         {
             robot_trajectory::RobotTrajectoryPtr traj(res.trajectory_);
+            if (stats != NULL) stats->wpts_planned = traj->getWayPointCount();
 
             std::vector<std::size_t> invalid_index;
             if (!_plan_scene->isPathValid(*traj, UR5_GROUP_NAME, true, &invalid_index))
@@ -411,6 +633,7 @@ bool TrajectoryLibrary::planTrajectory(ur5_motion_plan& plan, std::vector<moveit
                 {
                     ROS_ERROR("Invalid index %d", (int) invalid_index[i]);
                 }
+                if (stats != NULL) stats->invalid_paths++;
                 tries++;
                 continue;
             }
@@ -425,11 +648,19 @@ bool TrajectoryLibrary::planTrajectory(ur5_motion_plan& plan, std::vector<moveit
             }
 
             // Do optimization
+            stage_start = boost::posix_time::microsec_clock::universal_time();
             robot_trajectory::RobotTrajectoryPtr traj_opt(new robot_trajectory::RobotTrajectory(_rmodel, UR5_GROUP_NAME));
-            optimizeTrajectory(traj_opt, traj);
+            int shortcut_checks = 0;
+            optimizeTrajectory(traj_opt, traj, &shortcut_checks);
 
             // Do time parameterization on optimized trajectory
             _time_parametizer->computeTimeStamps(*traj_opt);
+            if (stats != NULL)
+            {
+                stats->optimize_time += elapsedSec(stage_start);
+                stats->shortcut_checks += shortcut_checks;
+                stats->wpts_optimized = traj_opt->getWayPointCount();
+            }
 
             // Now generate velocities
             computeVelocities(traj);
@@ -442,6 +673,7 @@ bool TrajectoryLibrary::planTrajectory(ur5_motion_plan& plan, std::vector<moveit
                 {
                     ROS_ERROR("Invalid index %d", (int) invalid_index[i]);
                 }
+                if (stats != NULL) stats->invalid_optimized++;
                 tries++;
                 continue;
             }
@@ -452,409 +684,1744 @@ bool TrajectoryLibrary::planTrajectory(ur5_motion_plan& plan, std::vector<moveit
             plan.num_wpts = traj_opt->getWayPointCount();
             plan.duration = traj_opt->getWaypointDurationFromStart(plan.num_wpts-1);
             traj_opt->getRobotTrajectoryMsg(plan.trajectory);
+            if (stats != NULL) stats->planner = planner_id;
 
             ROS_INFO("Duration = %f.", plan.duration);
             return true;
         }
         // else planner failed
+        if (stats != NULL) stats->planner_failures++;
         tries++;
     }
     return false;
 }
 
-void TrajectoryLibrary::timeWarpTrajectory(robot_trajectory::RobotTrajectoryPtr traj, double slow_factor)
+void TrajectoryLibrary::setPortfolioParams(const portfolio_params& params)
 {
-    std::size_t wpt_count = traj->getWayPointCount();
-    for (std::size_t i = 1; i < wpt_count; i++)
+    // Contexts may be shared per planner configuration, so each planner races at most once
+    _portfolio_params = params;
+    _portfolio_params.planner_ids.clear();
+    for (int i = 0; i < params.planner_ids.size(); i++)
     {
-        double t = traj->getWayPointDurationFromPrevious(i);
-        t = slow_factor*t;
-        traj->setWayPointDurationFromPrevious(i, t);
+        if (std::find(_portfolio_params.planner_ids.begin(), _portfolio_params.planner_ids.end(), params.planner_ids[i]) != _portfolio_params.planner_ids.end())
+        {
+            ROS_WARN("Planner %s is already in the portfolio.", params.planner_ids[i].c_str());
+            continue;
+        }
+        _portfolio_params.planner_ids.push_back(params.planner_ids[i]);
+    }
+    if (_portfolio_params.planner_ids.empty())
+    {
+        _portfolio_params.planner_ids.push_back("manipulator[RRTConnectkConfigDefault]");
+    }
+
+    _planner_stats.clear();
+    for (int i = 0; i < _portfolio_params.planner_ids.size(); i++)
+    {
+        planner_stats planner;
+        planner.planner_id = _portfolio_params.planner_ids[i];
+        planner.races = 0;
+        planner.solved = 0;
+        planner.valid = 0;
+        planner.wins = 0;
+        planner.solve_time = 0;
+        _planner_stats.push_back(planner);
     }
     return;
 }
 
-bool TrajectoryLibrary::segmentValid(const robot_state::RobotState &start, const robot_state::RobotState &end, int res)
+static double jointPathLength(const robot_trajectory::RobotTrajectory& traj)
 {
-    robot_state::RobotState inter_state(_rmodel);
-    double t = 0;
-    double dt = 1.0/res;
-    for (int i=0; i < res; i++)
+    double length = 0;
+    for (std::size_t i = 1; i < traj.getWayPointCount(); i++)
     {
-        t += dt;
-        start.interpolate(end, t, inter_state);
-        inter_state.update(true);
-        if (!_plan_scene->isStateValid(inter_state, UR5_GROUP_NAME))
+        length += traj.getWayPoint(i).distance(traj.getWayPoint(i-1));
+    }
+    return length;
+}
+
+void TrajectoryLibrary::raceTask(planner_race* race, int index)
+{
+    planning_interface::MotionPlanResponse& res = race->responses[index];
+    bool valid = false;
+    if (race->contexts[index] && !race->cancel.load())
+    {
+        boost::posix_time::ptime solve_start = boost::posix_time::microsec_clock::universal_time();
+        race->contexts[index]->solve(res);
+        race->solve_times[index] = elapsedSec(solve_start);
+        valid = (res.error_code_.val == res.error_code_.SUCCESS) && _plan_scene->isPathValid(*res.trajectory_, UR5_GROUP_NAME);
+    }
+
+    boost::mutex::scoped_lock lock(race->mutex);
+    race->valid[index] = valid;
+    if (valid && race->winner < 0)
+    {
+        race->winner = index;
+        if (race->first_wins)
         {
-            return false;
+            // Planners still searching return at their next termination check
+            race->cancel.store(true);
+            for (int i = 0; i < race->contexts.size(); i++)
+            {
+                if (i != index && race->contexts[i])
+                {
+                    race->contexts[i]->terminate();
+                }
+            }
         }
     }
-    return true;
+    race->finished++;
+    race->finished_cond.notify_all();
+    return;
 }
 
-bool TrajectoryLibrary::pathValid(const robot_trajectory::RobotTrajectoryPtr traj, int res)
+bool TrajectoryLibrary::solvePortfolio(const planning_interface::MotionPlanRequest& req, planning_interface::MotionPlanResponse& res, std::string& winner)
 {
-    robot_state::RobotStateConstPtr seg_start;
-    robot_state::RobotStateConstPtr seg_end;
-    for (int i=1; i < traj->getWayPointCount(); i++)
+    TRACE_SPAN("solvePortfolio");
+    const std::vector<std::string>& planner_ids = _portfolio_params.planner_ids;
+    int num_planners = planner_ids.size();
+
+    // Every planner gets its own context, so they search concurrently
+    std::vector<planning_interface::PlanningContextPtr> contexts;
+    for (int i = 0; i < num_planners; i++)
     {
-        seg_start = traj->getWayPointPtr(i-1);
-        seg_end = traj->getWayPointPtr(i);
-        if (!segmentValid(*seg_start, *seg_end, res))
+        planning_interface::MotionPlanRequest planner_req = req;
+        planner_req.planner_id = planner_ids[i];
+        moveit_msgs::MoveItErrorCodes error_code;
+        planning_interface::PlanningContextPtr context = _planning_pipeline->getPlannerManager()->getPlanningContext(_plan_scene, planner_req, error_code);
+        if (!context)
         {
-            return false;
+            ROS_ERROR("No planning context for %s.", planner_ids[i].c_str());
         }
+        contexts.push_back(context);
+    }
+
+    boost::posix_time::ptime race_start = boost::posix_time::microsec_clock::universal_time();
+    int best;
+    if (!racePlanners(contexts, _portfolio_params.first_wins, req.allowed_planning_time, res, best, &_planner_stats))
+    {
+        return false;
     }
+    winner = planner_ids[best];
+    res.planning_time_ = elapsedSec(race_start);
+
+    // Contexts bypass the pipeline's request adapters, so parameterize as AddTimeParameterization would
+    _time_parametizer->computeTimeStamps(*res.trajectory_);
+
+    ROS_INFO("Planner %s won in %f s.", winner.c_str(), res.planning_time_);
     return true;
 }
 
-void TrajectoryLibrary::optimizeTrajectory(robot_trajectory::RobotTrajectoryPtr traj_opt, const robot_trajectory::RobotTrajectoryPtr traj)
+bool TrajectoryLibrary::racePlanners(const std::vector<planning_interface::PlanningContextPtr>& contexts, bool first_wins, double allowed_time,
+                                     planning_interface::MotionPlanResponse& res, int& best, std::vector<planner_stats>* stats)
 {
-    // Make a copy
-    *traj_opt = *traj;
-//  return;
-
-    std::size_t wpt_count = traj->getWayPointCount();
-    ROS_INFO("Optimize starts with %d waypoints.", (int) wpt_count);
-
-    robot_trajectory::RobotTrajectory shortcut(_rmodel, UR5_GROUP_NAME);
+    int num_planners = contexts.size();
+
+    planner_race race;
+    race.contexts = contexts;
+    race.first_wins = first_wins;
+    race.cancel.store(false);
+    race.finished = 0;
+    race.winner = -1;
+    race.responses.resize(num_planners);
+    race.solve_times.resize(num_planners, 0.0);
+    race.valid.resize(num_planners, false);
+    for (int i = 0; i < num_planners; i++)
+    {
+        race.responses[i].error_code_.val = moveit_msgs::MoveItErrorCodes::PLANNING_FAILED;
+    }
 
-    // Iterate forwards from the first waypoint
-    for (std::size_t i=0; i < wpt_count; i++)
+    boost::thread_group racers;
+    for (int i = 0; i < num_planners; i++)
     {
-        // Get shortcut start waypoint
-        robot_state::RobotState wpt_i = traj_opt->getWayPoint(i);
+        racers.create_thread(boost::bind(&TrajectoryLibrary::raceTask, this, &race, i));
+    }
 
-        // Starting from the end and going backwards
-        for (std::size_t j=(wpt_count-1); j > (i+1); j--)
+    // Planners stop themselves at allowed_planning_time, and those that use all of it (RRT* in best-of
+    // mode always does) return a little later; terminate only those still running after a grace period
+    {
+        boost::mutex::scoped_lock lock(race.mutex);
+        boost::system_time wake = boost::get_system_time() + boost::posix_time::microseconds((long) ((allowed_time + PORTFOLIO_GRACE_TIME) * 1e6));
+        while (race.finished < num_planners)
         {
-            // Get shortcut end waypoint
-            robot_state::RobotState wpt_j = traj_opt->getWayPoint(j);
-            if (segmentValid(wpt_i, wpt_j, PATH_VALIDITY_CHECKER_RES))
+            if (!race.cancel.load())
             {
-                ROS_INFO("Shortcut found between nodes %d and %d.", (int) i, (int) j);
-                // Create new trajectory object with only neccessary endpoints
-                // Copy in waypoints before the shortcut
-                shortcut.clear();
-                for (std::size_t n=0; n <= i; n++)
-                {
-                    robot_state::RobotStatePtr state = traj_opt->getWayPointPtr(n);
-                    shortcut.insertWayPoint(n, state, 0);
-                }
-                // Copy in waypoints after the shortcut
-                for (std::size_t n=j; n < wpt_count; n++)
+                if (!race.finished_cond.timed_wait(lock, wake))
                 {
-                    robot_state::RobotStatePtr state = traj_opt->getWayPointPtr(n);
-                    shortcut.insertWayPoint(n - (j-i-1), state, 0);
+                    ROS_WARN("Planner portfolio overran %f s.", allowed_time);
+                    race.cancel.store(true);
+                    for (int i = 0; i < num_planners; i++)
+                    {
+                        if (race.contexts[i])
+                        {
+                            race.contexts[i]->terminate();
+                        }
+                    }
                 }
-                ROS_ASSERT(shortcut.getWayPointCount() == (wpt_count - (j-i-1)));
-
-                // Copy temporary trajectory
-                *traj_opt = shortcut;
-                wpt_count = traj_opt->getWayPointCount();
-                break; // break out of j loop
             }
+            else
+            {
+                race.finished_cond.wait(lock);
+            }
+        }
+    }
+    racers.join_all();
 
-            // Otherwise shortcut is invalid, so move on
+    // First-wins keeps the first valid path; otherwise the shortest valid path in joint space
+    best = race.first_wins ? race.winner : -1;
+    for (int i = 0; i < num_planners; i++)
+    {
+        if (!race.first_wins && race.valid[i]
+            && (best < 0 || jointPathLength(*race.responses[i].trajectory_) < jointPathLength(*race.responses[best].trajectory_)))
+        {
+            best = i;
+        }
+        if (stats != NULL)
+        {
+            planner_stats& planner = (*stats)[i];
+            planner.races++;
+            planner.solve_time += race.solve_times[i];
+            if (race.responses[i].error_code_.val == race.responses[i].error_code_.SUCCESS) planner.solved++;
+            if (race.valid[i]) planner.valid++;
         }
     }
 
-    ROS_INFO("Successfully trimmed %d nodes.", (int) (traj->getWayPointCount() - traj_opt->getWayPointCount()) );
-    return;
+    if (best < 0)
+    {
+        res.error_code_.val = moveit_msgs::MoveItErrorCodes::PLANNING_FAILED;
+        return false;
+    }
+
+    if (stats != NULL) (*stats)[best].wins++;
+    res = race.responses[best];
+    return true;
 }
 
-void TrajectoryLibrary::computeVelocities(robot_trajectory::RobotTrajectoryPtr traj)
+void TrajectoryLibrary::printPortfolioInfo(std::ostream& cout)
 {
-    std::size_t num_wpts = traj->getWayPointCount();
-
-    for (int i=1; i < num_wpts; i++)
+    cout << "PlannerPortfolio: " << (_portfolio_params.first_wins ? "first valid path wins" : "shortest valid path wins") << std::endl;
+    for (int i = 0; i < _planner_stats.size(); i++)
     {
-        robot_state::RobotStatePtr wpt = traj->getWayPointPtr(i);
-        robot_state::RobotStatePtr wpt_prev = traj->getWayPointPtr(i-1);
-
-        double duration = traj->getWayPointDurationFromPrevious(i);
-
-        // Iterate through joints
-        std::size_t num_joints = wpt->getVariableCount();
-        for (int j=0; j < num_joints; j++)
+        const planner_stats& planner = _planner_stats[i];
+        cout << "  " << planner.planner_id << ": " << planner.wins << "/" << planner.races << " wins, "
+             << planner.solved << " solved, " << planner.valid << " valid";
+        if (planner.races > 0)
         {
-            // Calculate joint movement distance
-            double joint_dist = wpt->getVariablePosition(j) - wpt_prev->getVariablePosition(j);
-            // Calculate joint velocity given desired duration
-            double vel = joint_dist / duration;
-            // Set joint velocity for waypoint
-            // ROS_INFO("Waypoint %d joint %d with duration %f has velocity %f.", i, j, duration, wpt->getVariableVelocity(j));
-            wpt->setVariableVelocity(j, vel);
-            // ROS_INFO("Assigned waypoint %d joint %d with duration %f a velocity of %f.", i, j, duration, vel);
+            cout << ", mean solve " << planner.solve_time / planner.races << " s";
         }
+        cout << std::endl;
     }
-
     return;
 }
 
-moveit_msgs::Constraints TrajectoryLibrary::genPoseConstraint(geometry_msgs::Pose pose_goal)
+void TrajectoryLibrary::timeWarpTrajectory(robot_trajectory::RobotTrajectoryPtr traj, double slow_factor)
 {
-    geometry_msgs::PoseStamped pose_pkt;
-    pose_pkt.header.frame_id = "world";
-    pose_pkt.pose = pose_goal;
-    // Position and orientation tolerances
-    std::vector<double> tolerance_pose(3, 0.01);
-    std::vector<double> tolerance_angle(3, 0.01);
-
-    // Create constraint from pose using IK
-    return kinematic_constraints::constructGoalConstraints("ee_link", pose_pkt, tolerance_pose, tolerance_angle);
+    std::size_t wpt_count = traj->getWayPointCount();
+    for (std::size_t i = 1; i < wpt_count; i++)
+    {
+        double t = traj->getWayPointDurationFromPrevious(i);
+        t = slow_factor*t;
+        traj->setWayPointDurationFromPrevious(i, t);
+    }
+    return;
 }
 
-moveit_msgs::Constraints TrajectoryLibrary::genJointValueConstraint(joint_values_t jvals)
+bool TrajectoryLibrary::stateValid(robot_state::RobotState& state)
 {
-    // Initialize state variable with joint values
-    robot_state::RobotState state(_rmodel);
-    state.setJointGroupPositions(UR5_GROUP_NAME, jvals);
-    // Verify joint values are within bounds
-    if (!_jmg->satisfiesPositionBounds( jvals.data() ) )
+    bool valid;
+    if (_validity_cache->lookupState(state, valid))
     {
-        ROS_ERROR("Joint value constraint does not satisfy position bounds.");
+        return valid;
     }
-    // Create constraint
-    return kinematic_constraints::constructGoalConstraints(state, _jmg, 0.01);
+
+    // Cache miss: do the full collision check
+    _metric.state_checks->inc();
+    state.update(true);
+    valid = _plan_scene->isStateValid(state, UR5_GROUP_NAME);
+    _validity_cache->storeState(state, valid);
+    return valid;
 }
 
-double TrajectoryLibrary::calculateGradients(double* gradient_array, robot_trajectory::RobotTrajectoryPtr traj)
+bool TrajectoryLibrary::segmentValid(const robot_state::RobotState &start, const robot_state::RobotState &end, int res)
 {
-    int num_wpts = traj->getWayPointCount();
-    int num_joints = _rmodel->getVariableCount();
-    double delta = 0.001;
-    double max = 0;
+    robot_state::RobotState inter_state(_rmodel);
+    return segmentValid(start, end, res, inter_state);
+}
 
-    double duration_old = traj->getWaypointDurationFromStart(num_wpts-1);
-    double duration_new;
+bool TrajectoryLibrary::segmentValid(const robot_state::RobotState &start, const robot_state::RobotState &end, int res, robot_state::RobotState& inter_state)
+{
+    bool valid;
+    if (_validity_cache->lookupSegment(start, end, res, valid))
+    {
+        return valid;
+    }
 
-    robot_state::RobotStatePtr wpt;
-    double* gtstate;
-    // Loop through waypoints
-    for (int i=0; i < num_wpts; i++)
+    valid = true;
+    double t = 0;
+    double dt = 1.0/res;
+    for (int i=0; i < res; i++)
     {
-        // Get waypoint
-        wpt = traj->getWayPointPtr(i);
-        // Get joint position pointer
-        gtstate = wpt->getVariablePositions();
-        // Loop through joints
-        for (int j=0; j < num_joints; j++)
+        t += dt;
+        start.interpolate(end, t, inter_state);
+        if (!stateValid(inter_state))
         {
-            // Perturb joint j by delta
-            gtstate[j] += delta;
-            wpt->update(true);
-
-            // Calculate new path duration
-            _time_parametizer->computeTimeStamps(*traj);
-            duration_new = traj->getWaypointDurationFromStart(num_wpts-1);
-
-            // Now calculate gradient
-            double gradient = (duration_new - duration_old) / delta;
-            if (max < abs(gradient))
-            {
-                max = abs(gradient);
-            }
-            printf("Calculated gradient with old dur %f and new dur %f to be %f.\n", duration_old, duration_new, gradient);
-            *(gradient_array + (i*num_joints) + j) = gradient;
-
-            // Now reset joint j
-            gtstate[j] -= delta;
+            valid = false;
+            break;
         }
     }
 
-    return max;
+    _validity_cache->storeSegment(start, end, res, valid);
+    return valid;
 }
 
-bool TrajectoryLibrary::gradientDescentWarp(ur5_motion_plan &plan, const joint_values_t &jvals_start, const joint_values_t &jvals_end)
+bool TrajectoryLibrary::pathValid(const robot_trajectory::RobotTrajectoryPtr traj, int res)
 {
-    // Intialize RobotTrajectory object
-    robot_trajectory::RobotTrajectoryPtr traj(new robot_trajectory::RobotTrajectory(_rmodel, UR5_GROUP_NAME));
-    robot_state::RobotState start_state(_rmodel);
-    moveit::core::robotStateMsgToRobotState(plan.start_state, start_state);
-    traj->setRobotTrajectoryMsg(start_state, plan.trajectory);
+    robot_state::RobotState inter_state(_rmodel);
+    return pathValid(traj, res, inter_state);
+}
 
-    // Collect useful data
+bool TrajectoryLibrary::pathValid(const robot_trajectory::RobotTrajectoryPtr traj, int res, robot_state::RobotState& inter_state)
+{
+    TRACE_SPAN("pathValid");
+    for (int i=1; i < traj->getWayPointCount(); i++)
+    {
+        if (!segmentValid(traj->getWayPoint(i-1), traj->getWayPoint(i), res, inter_state))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TrajectoryLibrary::setShortcutParams(const shortcut_params& params)
+{
+    _shortcut_params = params;
+    return;
+}
+
+void TrajectoryLibrary::shortcutTask(shortcut_batch* batch, int index)
+{
+    robot_state::RobotState inter_state(_rmodel);
+    bool valid = segmentValid(batch->traj->getWayPoint(batch->start), batch->traj->getWayPoint(batch->ends[index]), PATH_VALIDITY_CHECKER_RES, inter_state);
+
+    boost::mutex::scoped_lock lock(batch->mutex);
+    batch->valid[index] = valid;
+    batch->finished++;
+    batch->finished_cond.notify_all();
+    return;
+}
+
+std::size_t TrajectoryLibrary::furthestShortcut(const robot_trajectory::RobotTrajectory& traj, std::size_t start, int* shortcut_checks)
+{
+    // Candidates go furthest first, a batch at a time, so the answer matches a serial scan from the end
+    shortcut_batch batch;
+    batch.traj = &traj;
+    batch.start = start;
+    std::size_t batch_size = _shortcut_params.parallel ? SHORTCUT_BATCH : 1;
+    std::size_t end = traj.getWayPointCount() - 1;
+    while (end > start + 1)
+    {
+        batch.ends.clear();
+        for (std::size_t j = end; j > start + 1 && batch.ends.size() < batch_size; j--)
+        {
+            batch.ends.push_back(j);
+        }
+        batch.valid.assign(batch.ends.size(), false);
+        batch.finished = 0;
+        if (shortcut_checks != NULL) (*shortcut_checks) += batch.ends.size();
+
+        // The pool takes the nearer candidates, this thread the furthest
+        for (int k = 1; k < batch.ends.size(); k++)
+        {
+            _warp_service.post(boost::bind(&TrajectoryLibrary::shortcutTask, this, &batch, k));
+        }
+        shortcutTask(&batch, 0);
+        {
+            boost::mutex::scoped_lock lock(batch.mutex);
+            while (batch.finished < (int) batch.ends.size())
+            {
+                batch.finished_cond.wait(lock);
+            }
+        }
+
+        for (int k = 0; k < batch.ends.size(); k++)
+        {
+            if (batch.valid[k])
+            {
+                ROS_DEBUG("Shortcut found between nodes %d and %d.", (int) start, (int) batch.ends[k]);
+                return batch.ends[k];
+            }
+        }
+        end = batch.ends.back() - 1;
+    }
+    return start + 1;
+}
+
+// Point at parameter p along a waypoint path: segment floor(p), fraction p - floor(p)
+static void pathPoint(const std::vector<robot_state::RobotStatePtr>& path, double p, robot_state::RobotState& state)
+{
+    std::size_t k = std::min((std::size_t) p, path.size() - 2);
+    path[k]->interpolate(*path[k+1], p - k, state);
+    state.update(true);
+    return;
+}
+
+void TrajectoryLibrary::randomShortcuts(std::vector<robot_state::RobotStatePtr>& path, int* shortcut_checks)
+{
+    boost::posix_time::ptime shortcut_start = boost::posix_time::microsec_clock::universal_time();
+    robot_state::RobotState state_a(_rmodel);
+    robot_state::RobotState state_b(_rmodel);
+    robot_state::RobotState inter_state(_rmodel);
+    boost::random::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    for (int iter = 0; iter < _shortcut_params.random_iterations && path.size() > 2; iter++)
+    {
+        if (_shortcut_params.max_time > 0 && elapsedSec(shortcut_start) > _shortcut_params.max_time)
+        {
+            break;
+        }
+
+        // Two random points on the path, possibly inside segments
+        double pa = uniform(_shortcut_rng) * (path.size() - 1);
+        double pb = uniform(_shortcut_rng) * (path.size() - 1);
+        if (pa > pb)
+        {
+            std::swap(pa, pb);
+        }
+        pathPoint(path, pa, state_a);
+
+        bool valid = false;
+        for (int bisection = 0; bisection <= _shortcut_params.bisections; bisection++)
+        {
+            // Only worth it while a corner lies between the two points
+            std::size_t ka = (std::size_t) pa;
+            std::size_t kb = (std::size_t) pb;
+            if (kb <= ka || (kb == ka + 1 && pb == (double) kb))
+            {
+                break;
+            }
+            pathPoint(path, pb, state_b);
+
+            double path_length = state_a.distance(*path[ka+1]) + path[kb]->distance(state_b);
+            for (std::size_t k = ka + 1; k < kb; k++)
+            {
+                path_length += path[k]->distance(*path[k+1]);
+            }
+            if (state_a.distance(state_b) >= path_length)
+            {
+                break;
+            }
+
+            if (shortcut_checks != NULL) (*shortcut_checks)++;
+            if (segmentValid(state_a, state_b, PATH_VALIDITY_CHECKER_RES, inter_state))
+            {
+                valid = true;
+                break;
+            }
+            // Collides: pull the far end halfway back
+            pb = 0.5 * (pa + pb);
+        }
+        if (!valid)
+        {
+            continue;
+        }
+
+        // Splice: waypoints up to a, the two shortcut ends where they are new, waypoints from b on
+        std::size_t ka = (std::size_t) pa;
+        std::size_t kb = (std::size_t) pb;
+        std::vector<robot_state::RobotStatePtr> shortcut(path.begin(), path.begin() + ka + 1);
+        if (pa > (double) ka)
+        {
+            shortcut.push_back(robot_state::RobotStatePtr(new robot_state::RobotState(state_a)));
+        }
+        if (pb > (double) kb)
+        {
+            shortcut.push_back(robot_state::RobotStatePtr(new robot_state::RobotState(state_b)));
+            kb++;
+        }
+        shortcut.insert(shortcut.end(), path.begin() + kb, path.end());
+        path.swap(shortcut);
+    }
+    return;
+}
+
+void TrajectoryLibrary::optimizeTrajectory(robot_trajectory::RobotTrajectoryPtr traj_opt, const robot_trajectory::RobotTrajectoryPtr traj, int* shortcut_checks)
+{
+    std::size_t wpt_count = traj->getWayPointCount();
+    ROS_INFO("Optimize starts with %d waypoints.", (int) wpt_count);
+
+    // Greedy pass: from each kept waypoint jump to the furthest one reachable in a straight line
+    std::vector<robot_state::RobotStatePtr> path;
+    if (wpt_count > 0)
+    {
+        std::size_t i = 0;
+        path.push_back(traj->getWayPointPtr(0));
+        while (i + 1 < wpt_count)
+        {
+            i = furthestShortcut(*traj, i, shortcut_checks);
+            path.push_back(traj->getWayPointPtr(i));
+        }
+    }
+
+    // Random pass: only ever accepts strictly shorter paths, so the greedy result is the worst case
+    randomShortcuts(path, shortcut_checks);
+
+    traj_opt->clear();
+    for (std::size_t n = 0; n < path.size(); n++)
+    {
+        traj_opt->addSuffixWayPoint(path[n], 0);
+    }
+
+    ROS_INFO("Successfully trimmed %d nodes.", (int) (traj->getWayPointCount() - traj_opt->getWayPointCount()) );
+    return;
+}
+
+void TrajectoryLibrary::computeVelocities(robot_trajectory::RobotTrajectoryPtr traj)
+{
+    std::size_t num_wpts = traj->getWayPointCount();
+
+    for (int i=1; i < num_wpts; i++)
+    {
+        robot_state::RobotStatePtr wpt = traj->getWayPointPtr(i);
+        robot_state::RobotStatePtr wpt_prev = traj->getWayPointPtr(i-1);
+
+        double duration = traj->getWayPointDurationFromPrevious(i);
+
+        // Iterate through joints
+        std::size_t num_joints = wpt->getVariableCount();
+        for (int j=0; j < num_joints; j++)
+        {
+            // Calculate joint movement distance
+            double joint_dist = wpt->getVariablePosition(j) - wpt_prev->getVariablePosition(j);
+            // Calculate joint velocity given desired duration
+            double vel = joint_dist / duration;
+            // Set joint velocity for waypoint
+            // ROS_INFO("Waypoint %d joint %d with duration %f has velocity %f.", i, j, duration, wpt->getVariableVelocity(j));
+            wpt->setVariableVelocity(j, vel);
+            // ROS_INFO("Assigned waypoint %d joint %d with duration %f a velocity of %f.", i, j, duration, vel);
+        }
+    }
+
+    return;
+}
+
+moveit_msgs::Constraints TrajectoryLibrary::genPoseConstraint(geometry_msgs::Pose pose_goal)
+{
+    geometry_msgs::PoseStamped pose_pkt;
+    pose_pkt.header.frame_id = "world";
+    pose_pkt.pose = pose_goal;
+    // Position and orientation tolerances
+    std::vector<double> tolerance_pose(3, 0.01);
+    std::vector<double> tolerance_angle(3, 0.01);
+
+    // Create constraint from pose using IK
+    return kinematic_constraints::constructGoalConstraints("ee_link", pose_pkt, tolerance_pose, tolerance_angle);
+}
+
+moveit_msgs::Constraints TrajectoryLibrary::genJointValueConstraint(joint_values_t jvals)
+{
+    // Initialize state variable with joint values
+    robot_state::RobotState state(_rmodel);
+    state.setJointGroupPositions(UR5_GROUP_NAME, jvals);
+    // Verify joint values are within bounds
+    if (!_jmg->satisfiesPositionBounds( jvals.data() ) )
+    {
+        ROS_ERROR("Joint value constraint does not satisfy position bounds.");
+    }
+    // Create constraint
+    return kinematic_constraints::constructGoalConstraints(state, _jmg, 0.01);
+}
+
+double TrajectoryLibrary::calculateGradients(double* gradient_array, robot_trajectory::RobotTrajectoryPtr traj, WarpWorkspace& workspace)
+{
+    TRACE_SPAN("calculateGradients");
     int num_wpts = traj->getWayPointCount();
     int num_joints = _rmodel->getVariableCount();
+    double delta = GRADIENT_DELTA;
+    double max = 0;
+
+    // Moving waypoint i only retimes the two segments either side of it, so the duration change is
+    // taken from localSegmentTime() on those segments rather than from a full re-parameterization per
+    // perturbation. traj must already be parameterized for its current positions: the other segments
+    // keep that timing, so the velocities at the boundaries are the trajectory's own. No
+    // parameterization is run here at all. bench_primitives only=calculateGradients compares the
+    // result against the full-trajectory finite difference.
+    std::vector<double>& perturbed = workspace.getPerturbed();
+
+    // Start and end waypoints are pinned to the targets, so they get no gradient
+    for (int j=0; j < num_joints; j++)
+    {
+        gradient_array[j] = 0;
+        gradient_array[((num_wpts-1)*num_joints) + j] = 0;
+    }
+
+    // Loop through interior waypoints
+    for (int i=1; i < num_wpts-1; i++)
+    {
+        const double* positions = traj->getWayPoint(i).getVariablePositions();
+        std::copy(positions, positions + num_joints, perturbed.begin());
+        double duration_old = localSegmentTime(*traj, i, &perturbed[0]);
+
+        // Loop through joints
+        for (int j=0; j < num_joints; j++)
+        {
+            // Perturb joint j by delta
+            perturbed[j] = positions[j] + delta;
+            double duration_new = localSegmentTime(*traj, i, &perturbed[0]);
+
+            // Now calculate gradient
+            double gradient = (duration_new - duration_old) / delta;
+            if (max < fabs(gradient))
+            {
+                max = fabs(gradient);
+            }
+            *(gradient_array + (i*num_joints) + j) = gradient;
+
+            // Now reset joint j
+            perturbed[j] = positions[j];
+        }
+    }
+
+    return max;
+}
+
+double TrajectoryLibrary::localSegmentTime(const robot_trajectory::RobotTrajectory& traj, int i, const double* positions)
+{
+    // Duration of the segments into and out of waypoint i with it moved to positions, by the rules the
+    // time parameterizer applies: each segment is first as short as the joint velocity limits allow, then
+    // stretched until the acceleration limits hold at waypoints i-1, i and i+1. Outer segments keep their
+    // current timing, and the trajectory starts and ends at rest.
+    int num_wpts = traj.getWayPointCount();
+    int num_joints = _max_velocity.size();
+    const double* wpt[3] = { traj.getWayPoint(i-1).getVariablePositions(), positions, traj.getWayPoint(i+1).getVariablePositions() };
+
+    double dt[2] = { 0, 0 };
+    for (int j = 0; j < num_joints; j++)
+    {
+        dt[0] = std::max(dt[0], fabs(wpt[1][j] - wpt[0][j]) / _max_velocity[j]);
+        dt[1] = std::max(dt[1], fabs(wpt[2][j] - wpt[1][j]) / _max_velocity[j]);
+    }
+
+    for (int pass = 0; pass < GRADIENT_ACCEL_PASSES; pass++)
+    {
+        bool stretched = false;
+        for (int knot = i-1; knot <= i+1; knot++)
+        {
+            // Segment s runs from waypoint s to s+1; those into and out of i are the ones being timed
+            int before = knot - 1;
+            int after = knot;
+            const double* q = (knot == i) ? positions : traj.getWayPoint(knot).getVariablePositions();
+            const double* q_before = (before < 0) ? NULL : (before == i) ? positions : traj.getWayPoint(before).getVariablePositions();
+            const double* q_after = (after >= num_wpts-1) ? NULL : (knot+1 == i) ? positions : traj.getWayPoint(knot+1).getVariablePositions();
+            double t_before = (q_before == NULL) ? 0 : (before == i-1 || before == i) ? dt[before - (i-1)] : traj.getWayPointDurationFromPrevious(before+1);
+            double t_after = (q_after == NULL) ? 0 : (after == i-1 || after == i) ? dt[after - (i-1)] : traj.getWayPointDurationFromPrevious(after+1);
+            if (t_before + t_after <= 0)
+            {
+                continue;
+            }
+
+            double worst = 0;
+            for (int j = 0; j < num_joints; j++)
+            {
+                double v_before = (t_before > 0) ? (q[j] - q_before[j]) / t_before : 0;
+                double v_after = (t_after > 0) ? (q_after[j] - q[j]) / t_after : 0;
+                double accel = 2 * (v_after - v_before) / (t_before + t_after);
+                worst = std::max(worst, fabs(accel) / _max_acceleration[j]);
+            }
+            if (worst <= 1)
+            {
+                continue;
+            }
+
+            // Acceleration falls with the square of time, so stretch whichever timed segments meet here
+            double stretch = sqrt(worst);
+            for (int s = i-1; s <= i; s++)
+            {
+                if (s == before || s == after)
+                {
+                    dt[s - (i-1)] *= stretch;
+                    stretched = true;
+                }
+            }
+        }
+        if (!stretched)
+        {
+            break;
+        }
+    }
+    return dt[0] + dt[1];
+}
+
+void TrajectoryLibrary::getTrajectoryPositions(double* positions, robot_trajectory::RobotTrajectoryPtr traj)
+{
+    int num_wpts = traj->getWayPointCount();
+    int num_joints = _rmodel->getVariableCount();
+    for (int i=0; i < num_wpts; i++)
+    {
+        const double* wpt_positions = traj->getWayPointPtr(i)->getVariablePositions();
+        for (int j=0; j < num_joints; j++)
+        {
+            positions[(i*num_joints) + j] = wpt_positions[j];
+        }
+    }
+    return;
+}
+
+void TrajectoryLibrary::setTrajectoryPositions(robot_trajectory::RobotTrajectoryPtr traj, const double* positions, const double* direction, double scale)
+{
+    int num_wpts = traj->getWayPointCount();
+    int num_joints = _rmodel->getVariableCount();
+    for (int i=0; i < num_wpts; i++)
+    {
+        double* wpt_positions = traj->getWayPointPtr(i)->getVariablePositions();
+        for (int j=0; j < num_joints; j++)
+        {
+            int k = (i*num_joints) + j;
+            wpt_positions[j] = positions[k];
+            if (direction != NULL)
+            {
+                wpt_positions[j] += scale * direction[k];
+            }
+        }
+    }
+    return;
+}
+
+bool TrajectoryLibrary::gradientDescentWarp(const ur5_motion_plan& seed, ur5_motion_plan &plan, const joint_values_t &jvals_start, const joint_values_t &jvals_end, double max_time, fit_report* report, const boost::atomic<bool>* cancel)
+{
+    // Load seed into a borrowed workspace; seed is only read, plan is only written once the warp succeeds
+    WarpWorkspacePtr workspace = acquireWorkspace();
+    bool success = gradientDescentWarp(*workspace, seed, plan, jvals_start, jvals_end, max_time, report, cancel);
+    releaseWorkspace(workspace);
+    return success;
+}
+
+bool TrajectoryLibrary::gradientDescentWarp(WarpWorkspace& workspace, const ur5_motion_plan& seed, ur5_motion_plan &plan, const joint_values_t &jvals_start, const joint_values_t &jvals_end, double max_time, fit_report* report, const boost::atomic<bool>* cancel)
+{
+    TRACE_SPAN("gradientDescentWarp");
+    robot_trajectory::RobotTrajectoryPtr traj = workspace.load(seed);
+    robot_state::RobotState& inter_state = workspace.getInterState();
+    _metric.warps->inc();
+
+    // Collect useful data
+    int num_wpts = traj->getWayPointCount();
+    int num_joints = _rmodel->getVariableCount();
+    int num_vals = num_wpts * num_joints;
+
+    // Now replace start and end points to target start and end
+    robot_state::RobotStatePtr wpt_start = traj->getFirstWayPointPtr();
+    robot_state::RobotStatePtr wpt_end = traj->getLastWayPointPtr();
+    wpt_start->setVariablePositions(jvals_start);
+    wpt_start->update(true);
+    wpt_end->setVariablePositions(jvals_end);
+    wpt_end->update(true);
+
+    // If path invalid
+    boost::posix_time::ptime validation_start = boost::posix_time::microsec_clock::universal_time();
+    bool valid = pathValid(traj, PATH_VALIDITY_CHECKER_RES, inter_state);
+    if (report != NULL) report->validation_time += elapsedSec(validation_start);
+    if (!valid)
+    {
+        _metric.invalid_seeds->inc();
+        ROS_DEBUG("Gradient descent failed.");
+        return false;
+    }
+
+    // Now do gradient descent to smooth the rest of the path.
+    // Accepted waypoint positions live in a flat buffer; candidate steps are written straight
+    // into the trajectory's waypoints and rolled back from the buffer if rejected.
+    std::vector<double>& gradient_field = workspace.getGradientField();
+    std::vector<double>& positions = workspace.getPositions();
+    std::vector<double>& direction = workspace.getDirection();
+    getTrajectoryPositions(&positions[0], traj);
+
+    // Compute path duration
+    _time_parametizer->computeTimeStamps(*traj);
+    double start_duration = traj->getWaypointDurationFromStart(num_wpts-1);
+    double duration = start_duration;
+
+    // GDW_FIXED_STEP is the original warp, with its own step and stopping rule
+    bool fixed_step = (_warp_params.method == GDW_FIXED_STEP);
+    double momentum = fixed_step ? 0.0 : _warp_params.momentum;
+    double max_step = fixed_step ? GDW_FIXED_STEP_SIZE : _warp_params.step;
+    double min_improvement = fixed_step ? GDW_FIXED_MIN_IMPROVEMENT : _warp_params.min_improvement;
+    double step = max_step;
+    bool restarted = false;
+
+    boost::posix_time::ptime warp_start = boost::posix_time::microsec_clock::universal_time();
+    int iter;
+    for (iter = 0; iter < _warp_params.max_iterations; iter++)
+    {
+        // Honour wall-clock budget
+        if (max_time > 0 && elapsedSec(warp_start) > max_time)
+        {
+            _metric.budget_exhausted->inc();
+            ROS_DEBUG("GDW time budget exhausted.");
+            break;
+        }
+        if (cancel != NULL && cancel->load())
+        {
+            break;
+        }
+
+        // Calculate gradients
+        double grad_max = calculateGradients(&gradient_field[0], traj, workspace);
+        if (grad_max <= 0)
+        {
+            break;
+        }
+
+        // Update search direction from the normalized gradient (start and end stay pinned)
+        double dir_max = 0;
+        for (int k=num_joints; k < num_vals - num_joints; k++)
+        {
+            direction[k] = (momentum * direction[k]) - (gradient_field[k] / grad_max);
+            if (dir_max < fabs(direction[k]))
+            {
+                dir_max = fabs(direction[k]);
+            }
+        }
+
+        // Backtracking line search: shrink the step until the path is valid and faster
+        bool accepted = false;
+        double new_duration = duration;
+        while (fixed_step || step >= _warp_params.min_step)
+        {
+            setTrajectoryPositions(traj, &positions[0], &direction[0], step / dir_max);
+            validation_start = boost::posix_time::microsec_clock::universal_time();
+            valid = pathValid(traj, PATH_VALIDITY_CHECKER_RES, inter_state);
+            if (report != NULL) report->validation_time += elapsedSec(validation_start);
+            if (valid)
+            {
+                _time_parametizer->computeTimeStamps(*traj);
+                new_duration = traj->getWaypointDurationFromStart(num_wpts-1);
+                if (new_duration < duration)
+                {
+                    accepted = true;
+                    break;
+                }
+            }
+            if (_warp_params.method == GDW_FIXED_STEP)
+            {
+                break;
+            }
+            step *= 0.5;
+        }
+
+        if (!accepted)
+        {
+            // Roll back to last accepted positions, and their timing, which calculateGradients reads
+            setTrajectoryPositions(traj, &positions[0], NULL, 0);
+            _time_parametizer->computeTimeStamps(*traj);
+
+            // Stale momentum can point somewhere useless; retry once along the plain gradient
+            if (momentum > 0 && !restarted)
+            {
+                std::fill(direction.begin(), direction.end(), 0.0);
+                step = max_step;
+                restarted = true;
+                continue;
+            }
+            break;
+        }
+        restarted = false;
+
+        // Accept step
+        double improvement = duration - new_duration;
+        getTrajectoryPositions(&positions[0], traj);
+        duration = new_duration;
+
+        if (improvement < min_improvement)
+        {
+            break;
+        }
+
+        // Let the step grow back after a success
+        if (_warp_params.method != GDW_FIXED_STEP)
+        {
+            step = std::min(2 * step, max_step);
+        }
+    }
+
+    ROS_DEBUG("GDW finished after %d iterations: %f -> %f sec.", iter, start_duration, duration);
+    _metric.warp_iterations->record(iter);
+    if (report != NULL) report->warp_iterations += iter;
+
+    // Now we have smoothed and fitted path
+    // timeWarpTrajectory(traj, 3);
+    _time_parametizer->computeTimeStamps(*traj);
+    computeVelocities(traj);
+    traj->getRobotTrajectoryMsg(plan.trajectory);
+    plan.duration = traj->getWaypointDurationFromStart(num_wpts-1);
+    plan.num_wpts = num_wpts;
+    plan.start_target_index = seed.start_target_index;
+    plan.end_target_index = seed.end_target_index;
+    moveit::core::robotStateToRobotStateMsg(traj->getFirstWayPoint(), plan.start_state);
+    moveit::core::robotStateToRobotStateMsg(traj->getLastWayPoint(), plan.end_state);
+
+    return true;
+}
+
+void TrajectoryLibrary::setWarpParams(const warp_params& params)
+{
+    _warp_params = params;
+    return;
+}
+
+bool TrajectoryLibrary::fitPlan(ur5_motion_plan& plan, const joint_values_t &start_jvals, const joint_values_t &end_jvals)
+{
+    TRACE_SPAN("fitPlan");
+    _trace_recorder.record(start_jvals, end_jvals);
+
+    boost::posix_time::ptime fit_start = boost::posix_time::microsec_clock::universal_time();
+    boost::posix_time::ptime stage_start;
+
+    // Stage timings feed the same metrics as the deadline and parallel overloads
+    fit_report report;
+    report.lookup_time = 0;
+    report.warp_time = 0;
+    report.validation_time = 0;
+    report.warp_iterations = 0;
+    report.hits_tried = 0;
+    report.deadline_hit = false;
+    report.used_fallback = false;
+
+    // First find similar plan in database
+    stage_start = boost::posix_time::microsec_clock::universal_time();
+    _kdtree->setTargets(start_jvals, end_jvals);
+    report.lookup_time += elapsedSec(stage_start);
+    bool success;
+    bool lookup_success;
+    int proximity_index = 0;
+    plan_handle_t seed;
+    do
+    {
+        ROS_DEBUG("Looking up plan at position %d in priority queue.", proximity_index);
+        stage_start = boost::posix_time::microsec_clock::universal_time();
+        lookup_success = _kdtree->lookup(seed, proximity_index);
+        report.lookup_time += elapsedSec(stage_start);
+        if (!lookup_success)
+        {
+            recordFitMetrics(report, false, elapsedSec(fit_start));
+            ROS_ERROR("All plans failed.");
+            return false;
+        }
+        report.hits_tried++;
+
+        double validation_before = report.validation_time;
+        stage_start = boost::posix_time::microsec_clock::universal_time();
+        success = gradientDescentWarp(*seed, plan, start_jvals, end_jvals, _warp_params.max_time, &report, NULL);
+        report.warp_time += elapsedSec(stage_start) - (report.validation_time - validation_before);
+        ++proximity_index;
+    } while (!success);
+
+    ROS_DEBUG("Found plan.");
+    recordFitMetrics(report, true, elapsedSec(fit_start));
+    learnPlan(plan);
+    return true;
+}
+
+bool TrajectoryLibrary::fitPlan(ur5_motion_plan& plan, const joint_values_t &start_jvals, const joint_values_t &end_jvals, double deadline, fit_report& report)
+{
+    TRACE_SPAN("fitPlan");
+    _trace_recorder.record(start_jvals, end_jvals);
+
+    boost::posix_time::ptime fit_start = boost::posix_time::microsec_clock::universal_time();
+    boost::posix_time::ptime stage_start;
+
+    report.lookup_time = 0;
+    report.warp_time = 0;
+    report.validation_time = 0;
+    report.warp_iterations = 0;
+    report.hits_tried = 0;
+    report.deadline_hit = false;
+    report.used_fallback = false;
+
+    // First find similar plans in database
+    stage_start = boost::posix_time::microsec_clock::universal_time();
+    _kdtree->setTargets(start_jvals, end_jvals);
+    report.lookup_time += elapsedSec(stage_start);
+
+    // Warp candidates until the deadline, keeping the fastest valid result
+    bool found = false;
+    plan_handle_t seed;
+    ur5_motion_plan candidate;
+    for (int proximity_index = 0; proximity_index < FIT_MAX_HITS; proximity_index++)
+    {
+        double remaining = deadline - elapsedSec(fit_start);
+        if (remaining <= 0)
+        {
+            report.deadline_hit = true;
+            break;
+        }
+
+        stage_start = boost::posix_time::microsec_clock::universal_time();
+        bool lookup_success = _kdtree->lookup(seed, proximity_index);
+        report.lookup_time += elapsedSec(stage_start);
+        if (!lookup_success)
+        {
+            break;
+        }
+        report.hits_tried++;
+
+        // Warp may not outlast the deadline
+        double warp_budget = remaining;
+        if (_warp_params.max_time > 0 && _warp_params.max_time < warp_budget)
+        {
+            warp_budget = _warp_params.max_time;
+        }
+
+        double validation_before = report.validation_time;
+        stage_start = boost::posix_time::microsec_clock::universal_time();
+        bool success = gradientDescentWarp(*seed, candidate, start_jvals, end_jvals, warp_budget, &report, NULL);
+        report.warp_time += elapsedSec(stage_start) - (report.validation_time - validation_before);
+
+        if (success && (!found || candidate.duration < plan.duration))
+        {
+            plan = candidate;
+            found = true;
+        }
+    }
+
+    // Nothing warped in time, so try going straight there
+    if (!found)
+    {
+        stage_start = boost::posix_time::microsec_clock::universal_time();
+        found = straightLinePlan(plan, start_jvals, end_jvals);
+        report.validation_time += elapsedSec(stage_start);
+        report.used_fallback = found;
+    }
+
+    recordFitMetrics(report, found, elapsedSec(fit_start));
+    printFitReport(report);
+    if (!found)
+    {
+        ROS_ERROR("All plans failed.");
+        return false;
+    }
+    learnPlan(plan);
+    return true;
+}
+
+void TrajectoryLibrary::warpTask(warp_batch* batch, int job_index)
+{
+    warp_job& job = batch->jobs[job_index];
+    job.success = false;
+    if (!batch->cancel.load())
+    {
+        job.success = gradientDescentWarp(*job.seed, job.plan, batch->start_jvals, batch->end_jvals, batch->max_time, &job.report, &batch->cancel);
+    }
+
+    boost::mutex::scoped_lock lock(batch->mutex);
+    if (job.success && batch->winner < 0)
+    {
+        batch->winner = job_index;
+        if (batch->first_wins)
+        {
+            // Stragglers stop at their next iteration
+            batch->cancel.store(true);
+        }
+    }
+    batch->finished++;
+    batch->finished_cond.notify_all();
+    return;
+}
+
+bool TrajectoryLibrary::fitPlanParallel(ur5_motion_plan& plan, const joint_values_t &start_jvals, const joint_values_t &end_jvals, int num_hits, bool first_wins, double deadline, fit_report& report)
+{
+    TRACE_SPAN("fitPlanParallel");
+    _trace_recorder.record(start_jvals, end_jvals);
+
+    boost::posix_time::ptime fit_start = boost::posix_time::microsec_clock::universal_time();
+
+    report.lookup_time = 0;
+    report.warp_time = 0;
+    report.validation_time = 0;
+    report.warp_iterations = 0;
+    report.hits_tried = 0;
+    report.deadline_hit = false;
+    report.used_fallback = false;
+
+    // Pull top-k candidates; jobs share the library plans and only allocate their warped result
+    warp_batch batch;
+    batch.start_jvals = start_jvals;
+    batch.end_jvals = end_jvals;
+    batch.first_wins = first_wins;
+    batch.cancel.store(false);
+    batch.finished = 0;
+    batch.winner = -1;
+
+    _kdtree->setTargets(start_jvals, end_jvals);
+    batch.jobs.reserve(num_hits);
+    for (int hit = 0; hit < num_hits; hit++)
+    {
+        warp_job job;
+        if (!_kdtree->lookup(job.seed, hit))
+        {
+            break;
+        }
+        job.success = false;
+        job.report.validation_time = 0;
+        job.report.warp_iterations = 0;
+        batch.jobs.push_back(job);
+    }
+    report.lookup_time = elapsedSec(fit_start);
+    report.hits_tried = batch.jobs.size();
+
+    // Warps may not outlast the deadline
+    batch.max_time = _warp_params.max_time;
+    if (deadline > 0)
+    {
+        double remaining = deadline - report.lookup_time;
+        if (remaining <= 0)
+        {
+            report.deadline_hit = true;
+            batch.cancel.store(true);
+        }
+        else if (batch.max_time <= 0 || remaining < batch.max_time)
+        {
+            batch.max_time = remaining;
+        }
+    }
+
+    // Fan out to the pool and wait for every job, cancelling at the deadline
+    boost::posix_time::ptime warp_start = boost::posix_time::microsec_clock::universal_time();
+    for (int i = 0; i < batch.jobs.size(); i++)
+    {
+        _warp_service.post(boost::bind(&TrajectoryLibrary::warpTask, this, &batch, i));
+    }
+    {
+        boost::mutex::scoped_lock lock(batch.mutex);
+        boost::system_time wake = boost::get_system_time() + boost::posix_time::microseconds((long) ((deadline - elapsedSec(fit_start)) * 1e6));
+        while (batch.finished < (int) batch.jobs.size())
+        {
+            if (deadline > 0 && !batch.cancel.load())
+            {
+                if (!batch.finished_cond.timed_wait(lock, wake))
+                {
+                    report.deadline_hit = true;
+                    batch.cancel.store(true);
+                }
+            }
+            else
+            {
+                batch.finished_cond.wait(lock);
+            }
+        }
+    }
+    report.warp_time = elapsedSec(warp_start);
+
+    // Pick first finisher or fastest plan
+    int best = batch.winner;
+    for (int i = 0; i < batch.jobs.size(); i++)
+    {
+        // Validation time is summed over workers, so it can exceed the warp wall time
+        report.validation_time += batch.jobs[i].report.validation_time;
+        report.warp_iterations += batch.jobs[i].report.warp_iterations;
+        if (!first_wins && batch.jobs[i].success && (best < 0 || batch.jobs[i].plan.duration < batch.jobs[best].plan.duration))
+        {
+            best = i;
+        }
+    }
+
+    bool found = (best >= 0);
+    if (found)
+    {
+        plan = batch.jobs[best].plan;
+    }
+    else
+    {
+        // Nothing warped in time, so try going straight there
+        boost::posix_time::ptime stage_start = boost::posix_time::microsec_clock::universal_time();
+        found = straightLinePlan(plan, start_jvals, end_jvals);
+        report.validation_time += elapsedSec(stage_start);
+        report.used_fallback = found;
+    }
+
+    recordFitMetrics(report, found, elapsedSec(fit_start));
+    printFitReport(report);
+    if (!found)
+    {
+        ROS_ERROR("All plans failed.");
+        return false;
+    }
+    learnPlan(plan);
+    return true;
+}
+
+bool TrajectoryLibrary::fitPlanConfigured(ur5_motion_plan& plan, const joint_values_t &start_jvals, const joint_values_t &end_jvals, double deadline, int parallel_hits)
+{
+    fit_report report;
+    if (parallel_hits > 0)
+    {
+        // Without a deadline, take whichever warp finishes first
+        return fitPlanParallel(plan, start_jvals, end_jvals, parallel_hits, deadline <= 0, deadline, report);
+    }
+    if (deadline > 0)
+    {
+        return fitPlan(plan, start_jvals, end_jvals, deadline, report);
+    }
+    return fitPlan(plan, start_jvals, end_jvals);
+}
+
+void TrajectoryLibrary::setLearningParams(const learning_params& params)
+{
+    _learning_params = params;
+
+    // Flushing over the imported library would clobber it, and its .dur, with every learned plan
+    if (_learning_params.flush_period > 0 && _learning_params.filename == _library_filename)
+    {
+        ROS_ERROR("Learned plans can not be flushed to the imported library %s. Not flushing.", _library_filename.c_str());
+        _learning_params.flush_period = 0;
+    }
+
+    // (Re)start background flushing
+    _flush_thread.interrupt();
+    _flush_thread.join();
+    if (_learning_params.enabled && _learning_params.flush_period > 0)
+    {
+        _flush_thread = boost::thread(boost::bind(&TrajectoryLibrary::flushThread, this));
+    }
+    return;
+}
+
+void TrajectoryLibrary::learnPlan(const ur5_motion_plan& plan)
+{
+    if (!_learning_params.enabled)
+    {
+        return;
+    }
+
+    // Density: leave crowded cells alone
+    if (_kdtree->countPlansInCell(plan.start_state.joint_state.position, plan.end_state.joint_state.position) >= _learning_params.max_cell_plans)
+    {
+        return;
+    }
+
+    // Novelty: the library must not already have something this close
+    std::size_t plan_index;
+    double distance = -1;
+    if (_kdtree->nearest(plan_index, distance, plan.start_state.joint_state.position, plan.end_state.joint_state.position)
+        && distance < _learning_params.novelty_dist)
+    {
+        return;
+    }
+
+    // Learned plans do not connect library targets
+    ur5_motion_plan learned = plan;
+    learned.start_target_index = PLAN_NO_TARGET;
+    learned.end_target_index = PLAN_NO_TARGET;
+
+    try { _kdtree->add(learned); }
+    catch (std::string& s)
+    {
+        ROS_ERROR("KDTree::add() exception: %s.", s.c_str());
+        return;
+    }
+    _learned_dirty.store(true);
+    ROS_INFO("Learned new plan (%f from nearest). Library now has %d plans.", distance, (int) _kdtree->getPlanCount());
+    return;
+}
 
-    // Now replace start and end points to target start and end
-    robot_state::RobotStatePtr wpt_start = traj->getFirstWayPointPtr();
-    robot_state::RobotStatePtr wpt_end = traj->getLastWayPointPtr();
-    wpt_start->setVariablePositions(jvals_start);
-    wpt_start->update(true);
-    wpt_end->setVariablePositions(jvals_end);
-    wpt_end->update(true);
+void TrajectoryLibrary::flushThread()
+{
+    try
+    {
+        while (1)
+        {
+            boost::this_thread::sleep(boost::posix_time::microseconds((long) (_learning_params.flush_period * 1e6)));
+            if (_learned_dirty.exchange(false))
+            {
+                exportToFile(_learning_params.filename.c_str());
+            }
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+    }
+    return;
+}
 
-    // If path invalid
-    if (!pathValid(traj, PATH_VALIDITY_CHECKER_RES))
+bool TrajectoryLibrary::recordTrace(const std::string& filename)
+{
+    if (!_trace_recorder.open(filename))
     {
-        ROS_WARN("Gradient descent failed.");
+        ROS_ERROR("Could not open query trace %s.", filename.c_str());
         return false;
     }
+    ROS_INFO("Recording fitPlan queries to %s.", filename.c_str());
+    return true;
+}
 
-    // Now do gradient descent to smooth the rest of the path
-    robot_trajectory::RobotTrajectoryPtr traj_temp(new robot_trajectory::RobotTrajectory(*traj));
-    double* gradient_field = new double[num_wpts * num_joints];
-    robot_state::RobotStatePtr wpt;
-    double* gtstate;
+void TrajectoryLibrary::printFitReport(const fit_report& report)
+{
+    ROS_INFO("fitPlan: %d hits, lookup %.4f s, warp %.4f s (%d iterations), validation %.4f s%s%s.",
+             report.hits_tried, report.lookup_time, report.warp_time, report.warp_iterations, report.validation_time,
+             report.deadline_hit ? ", deadline hit" : "",
+             report.used_fallback ? ", straight-line fallback" : "");
+    return;
+}
 
-    // Compute path duration
-    _time_parametizer->computeTimeStamps(*traj_temp);
-    double old_duration;
-    double new_duration = traj_temp->getWaypointDurationFromStart(num_wpts-1);
+void TrajectoryLibrary::registerMetrics()
+{
+    std::vector<double> latency_buckets = exponentialBuckets(100, 2, 15);   // 100 us to 1.6 s
+
+    _metric.fit_queries = _metrics.counter("fit.queries");
+    _metric.fit_failures = _metrics.counter("fit.failures");
+    _metric.fallbacks = _metrics.counter("fit.fallbacks");
+    _metric.deadline_hits = _metrics.counter("fit.deadline_hits");
+    _metric.warps = _metrics.counter("gdw.warps");
+    _metric.invalid_seeds = _metrics.counter("gdw.invalid_seeds");
+    _metric.budget_exhausted = _metrics.counter("gdw.budget_exhausted");
+    _metric.state_checks = _metrics.counter("validity.state_checks");
+    _metric.ik_attempts = _metrics.counter("ik.attempts");
+    _metric.ik_solutions_checked = _metrics.counter("ik.solutions_checked");
+    _metric.hits_tried = _metrics.histogram("fit.hits_tried", "hits", linearBuckets(0, 1, FIT_MAX_HITS + 1));
+    _metric.warp_iterations = _metrics.histogram("gdw.iterations", "iterations", linearBuckets(0, 10, 11));
+    _metric.lookup_time = _metrics.histogram("fit.lookup_time", "us", latency_buckets);
+    _metric.warp_time = _metrics.histogram("fit.warp_time", "us", latency_buckets);
+    _metric.validation_time = _metrics.histogram("fit.validation_time", "us", latency_buckets);
+    _metric.fit_time = _metrics.histogram("fit.total_time", "us", latency_buckets);
+    return;
+}
 
-    do
-    {
-        std::cout << "GDW cycle.\n";
+void TrajectoryLibrary::recordFitMetrics(const fit_report& report, bool found, double fit_time)
+{
+    _metric.fit_queries->inc();
+    if (!found) _metric.fit_failures->inc();
+    if (report.used_fallback) _metric.fallbacks->inc();
+    if (report.deadline_hit) _metric.deadline_hits->inc();
+    _metric.hits_tried->record(report.hits_tried);
+    _metric.lookup_time->record(report.lookup_time * 1e6);
+    _metric.warp_time->record(report.warp_time * 1e6);
+    _metric.validation_time->record(report.validation_time * 1e6);
+    _metric.fit_time->record(fit_time * 1e6);
+    return;
+}
 
-        // Update previous duration
-        old_duration = new_duration;
+void TrajectoryLibrary::setMetricsPeriod(double period)
+{
+    _metrics_period = period;
 
-        // Calculate gradients
-        double grad_max = calculateGradients(gradient_field, traj_temp);
-        printf("Max gradient is %f.\n", grad_max);
+    // Restart publisher thread with new settings
+    _metrics_thread.interrupt();
+    _metrics_thread.join();
+    if (_metrics_period > 0 && _metrics_publisher)
+    {
+        _metrics_thread = boost::thread(boost::bind(&TrajectoryLibrary::metricsThread, this));
+    }
+    return;
+}
 
-        // For each waypoint besides the start and end
-        for (int i=1; i < num_wpts-1; i++)
+void TrajectoryLibrary::metricsThread()
+{
+    try
+    {
+        while (1)
         {
-            wpt = traj_temp->getWayPointPtr(i);
-            gtstate = wpt->getVariablePositions();
+            boost::this_thread::sleep(boost::posix_time::microseconds((long) (_metrics_period * 1e6)));
+            std_msgs::String msg;
+            msg.data = _metrics.toJson();
+            _metrics_publisher.publish(msg);
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+    }
+    return;
+}
+
+bool TrajectoryLibrary::writeMetrics(const std::string& filename)
+{
+    if (!_metrics.writeJsonFile(filename))
+    {
+        ROS_ERROR("Could not write metrics to %s.", filename.c_str());
+        return false;
+    }
+    ROS_INFO("Metrics written to %s.", filename.c_str());
+    return true;
+}
+
+bool TrajectoryLibrary::straightLinePlan(ur5_motion_plan& plan, const joint_values_t &start_jvals, const joint_values_t &end_jvals)
+{
+    robot_state::RobotStatePtr start_state(new robot_state::RobotState(_rmodel));
+    robot_state::RobotStatePtr end_state(new robot_state::RobotState(_rmodel));
+    start_state->setJointGroupPositions(_jmg, start_jvals);
+    start_state->update(true);
+    end_state->setJointGroupPositions(_jmg, end_jvals);
+    end_state->update(true);
+
+    if (!segmentValid(*start_state, *end_state, PATH_VALIDITY_CHECKER_RES))
+    {
+        return false;
+    }
+
+    robot_trajectory::RobotTrajectoryPtr traj(new robot_trajectory::RobotTrajectory(_rmodel, UR5_GROUP_NAME));
+    traj->addSuffixWayPoint(start_state, 0);
+    traj->addSuffixWayPoint(end_state, 0);
+    _time_parametizer->computeTimeStamps(*traj);
+    computeVelocities(traj);
+
+    // Pack motion plan struct
+    traj->getRobotTrajectoryMsg(plan.trajectory);
+    plan.num_wpts = traj->getWayPointCount();
+    plan.duration = traj->getWaypointDurationFromStart(plan.num_wpts-1);
+    plan.start_target_index = PLAN_NO_TARGET;
+    plan.end_target_index = PLAN_NO_TARGET;
+    moveit::core::robotStateToRobotStateMsg(*start_state, plan.start_state);
+    moveit::core::robotStateToRobotStateMsg(*end_state, plan.end_state);
+
+    return true;
+}
+
+void TrajectoryLibrary::setStartTarget(const joint_values_t& jvals)
+{
+    // Construct trajectory start state
+    robot_state::RobotState start_state(_rmodel);
+    start_state.setJointGroupPositions(UR5_GROUP_NAME, jvals);
+
+    // Update planning scene with start state
+    _plan_scene->setCurrentState(start_state);
+    // Publish planning scene
+    if (_plan_scene_publisher)
+    {
+        moveit_msgs::PlanningScene scene_msg;
+        _plan_scene->getPlanningSceneMsg(scene_msg);
+        _plan_scene_publisher.publish(scene_msg);
+    }
+    return;
+}
+
+bool TrajectoryLibrary::planTargetPair(int start_group, int start_target, int end_group, int end_target, const joint_values_t& end_jvals)
+{
+    // Generate constraint from target joint values
+    std::vector<moveit_msgs::Constraints> v_constraints;
+    v_constraints.push_back( genJointValueConstraint(end_jvals) );
+    // Generate trajectory
+    ur5_motion_plan plan;
+    build_pair_stats pair_stats;
+    initPairStats(pair_stats, start_group, start_target, end_group, end_target);
+    boost::posix_time::ptime pair_start = boost::posix_time::microsec_clock::universal_time();
+    bool success = planTrajectory(plan, v_constraints, &pair_stats);
+    pair_stats.total_time = elapsedSec(pair_start);
+    pair_stats.success = success;
+    pair_stats.duration = success ? plan.duration : -1;
+    return recordTargetPair(plan, pair_stats);
+}
+
+bool TrajectoryLibrary::recordTargetPair(ur5_motion_plan& plan, const build_pair_stats& pair_stats)
+{
+    int start_group = pair_stats.start_group;
+    int start_target = pair_stats.start_target;
+    int end_group = pair_stats.end_group;
+    int end_target = pair_stats.end_target;
+
+    boost::mutex::scoped_lock lock(_library_data_mutex);
+    _build_report.add(pair_stats);
+    if (!pair_stats.success)
+    {
+        ROS_ERROR("Planner failed to generate plan for end target %d. Skipping.", end_target);
+        _duration_matrix.set(start_group, start_target, end_group, end_target, DURATION_FAILED);
+        return false;
+    }
+    lock.unlock();
+
+    // Publish trajectory
+    if (_trajectory_publisher)
+    {
+        moveit_msgs::DisplayTrajectory display_trajectory;
+        display_trajectory.trajectory.push_back(plan.trajectory);
+        display_trajectory.trajectory_start = plan.start_state;
+        _trajectory_publisher.publish(display_trajectory);
+    }
+
+    // Now record start and stop locations
+    plan.start_target_index = start_target;
+    plan.end_target_index = end_target;
+    lock.lock();
+    _duration_matrix.set(start_group, start_target, end_group, end_target, plan.duration);
+    lock.unlock();
+
+    // Store trajectory in KD tree
+    try { _kdtree->add(plan); }
+    catch (std::string& s)
+    {
+        ROS_ERROR("KDTree::add() exception: %s.", s.c_str());
+        return false;
+    }
+    return true;
+}
+
+void TrajectoryLibrary::build()
+{
+    /* Check that target groups have been generated */
+    if (_num_target_groups == 0)
+    {
+        ROS_ERROR("No target groups defined.");
+        return;
+    }
+
+    /* Size travel time matrix to the generated targets */
+    std::vector<int> group_sizes;
+    for (int i = 0; i < _num_target_groups; i++)
+    {
+        group_sizes.push_back(_target_groups[i].target_count);
+    }
+    {
+        boost::mutex::scoped_lock lock(_library_data_mutex);
+        _duration_matrix.resize(group_sizes);
+        _build_report.clear();
+    }
+
+    /* Iterate through target groups for trajectory start location */
+    for (int i = 0; i < _num_target_groups; i++)
+    {
+        ROS_INFO("START GROUP: %d", i);
 
-            // For each joint
-            for (int j=0; j < num_joints; j++)
+        /* Iterate through target groups again for end location */
+        for (int j = 0; j < _num_target_groups; j++)
+        {
+            if (j == i)
             {
-                // Move joint according to negative gradient
-                double gradient = gradient_field[ (i*num_joints) + j ];
-                double move = -(gradient / grad_max) * 0.001;
-                printf("Gradient %f. Moving wpt %d joint %d by %f.\n", gradient, i, j, move);
-                gtstate[j] += move;
+                if (!_target_groups[i].vol.allow_internal_paths)
+                {
+                    // We don't want to generate paths between targets in the same group
+                    continue;
+                }
+                else
+                {
+                    ROS_INFO("INTERNAL");
+                }
+            }
+            else
+            {
+                ROS_INFO("END GROUP: %d", j);
             }
-            wpt->update(true);
-        }
 
-        // Make sure path is valid
-        if (!pathValid(traj_temp, PATH_VALIDITY_CHECKER_RES))
-        {
-            ROS_ERROR("Made invalid path in GDW.");
-            break;
-        }
+            // APPLE: If we are moving from place target to pick target, we need to attach an apple
+//            moveit_msgs::AttachedCollisionObject aco_msg;
+//            if (i == PLACE_TARGET && j == PICK_TARGET)
+//            {
+//                aco_msg = getAppleObjectMsg();
+//            }
+//            else
+//            {
+//                aco_msg = getAppleObjectMsg();
+//                aco_msg.object.operation = aco_msg.object.REMOVE;
+//            }
+//            _plan_scene->processAttachedCollisionObjectMsg(getAppleObjectMsg());
 
-        // Compute path duration
-        _time_parametizer->computeTimeStamps(*traj_temp);
-        new_duration = traj_temp->getWaypointDurationFromStart(num_wpts-1);
+            /* Pick particular start target */
+            for (int n = 0; n < _target_groups[i].target_count; n++)
+            {
+                ROS_INFO("START TARGET: %d", n);
 
-        // Update trajectory
-        *traj = *traj_temp;
+                setStartTarget(_target_groups[i].jvals[n]);
 
-        ROS_INFO("Improved duration by %f sec.", old_duration - new_duration);
+                /* Now pick particular end target */
+                for (int m = 0; m < _target_groups[j].target_count; m++)
+                {
+                    if (i == j && n == m)
+                    {
+                        // The start and end targets are the same.
+                        continue;
+                    }
+                    ROS_INFO("END TARGET: %d", m);
+                    planTargetPair(i, n, j, m, _target_groups[j].jvals[m]);
+                }
+            }
+        }
+    }
 
-    } while (old_duration - new_duration > 0.01);
+    _kdtree->printInfo(std::cout);
+    _duration_matrix.printInfo(std::cout);
+    _build_report.printInfo(std::cout);
+    if (_portfolio_params.planner_ids.size() > 1)
+    {
+        printPortfolioInfo(std::cout);
+    }
+    reserveWorkspaces();
 
-    std::cout << "Broke out of GDW loop.\n";
+    return;
+}
 
-    delete[] gradient_field;
+void TrajectoryLibrary::connectRoadmapNode(Roadmap& roadmap, int node, const roadmap_params& params, int* edge_checks)
+{
+    // One extra, since the node is its own nearest
+    std::vector<int> neighbors;
+    roadmap.nearest(roadmap.getNode(node), params.neighbors + 1, params.max_edge, neighbors);
 
-    // Now we have smoothed and fitted path
-    // timeWarpTrajectory(traj, 3);
-    computeVelocities(traj);
-    traj->getRobotTrajectoryMsg(plan.trajectory);
-    plan.duration = new_duration;
-    plan.num_wpts = num_wpts;
-    moveit::core::robotStateToRobotStateMsg(traj->getFirstWayPoint(), plan.start_state);
-    moveit::core::robotStateToRobotStateMsg(traj->getLastWayPoint(), plan.end_state);
+    robot_state::RobotState node_state(_rmodel);
+    robot_state::RobotState neighbor_state(_rmodel);
+    robot_state::RobotState inter_state(_rmodel);
+    node_state.setJointGroupPositions(_jmg, roadmap.getNode(node));
+    for (int i = 0; i < neighbors.size(); i++)
+    {
+        if (neighbors[i] == node || roadmap.hasEdge(node, neighbors[i]))
+        {
+            continue;
+        }
+        neighbor_state.setJointGroupPositions(_jmg, roadmap.getNode(neighbors[i]));
+        if (edge_checks != NULL) (*edge_checks)++;
+        if (segmentValid(node_state, neighbor_state, PATH_VALIDITY_CHECKER_RES, inter_state))
+        {
+            roadmap.addEdge(node, neighbors[i]);
+        }
+    }
+    return;
+}
+
+bool TrajectoryLibrary::roadmapPlan(ur5_motion_plan& plan, const Roadmap& roadmap, const std::vector<int>& path, build_pair_stats* stats)
+{
+    // Graph path as waypoints; every edge was collision checked when it was added
+    robot_trajectory::RobotTrajectoryPtr traj(new robot_trajectory::RobotTrajectory(_rmodel, UR5_GROUP_NAME));
+    for (int i = 0; i < path.size(); i++)
+    {
+        robot_state::RobotStatePtr state(new robot_state::RobotState(_rmodel));
+        state->setJointGroupPositions(_jmg, roadmap.getNode(path[i]));
+        state->update(true);
+        traj->addSuffixWayPoint(state, 0);
+    }
+    if (stats != NULL) stats->wpts_planned = traj->getWayPointCount();
+
+    // Same post-processing as planner paths
+    boost::posix_time::ptime stage_start = boost::posix_time::microsec_clock::universal_time();
+    robot_trajectory::RobotTrajectoryPtr traj_opt(new robot_trajectory::RobotTrajectory(_rmodel, UR5_GROUP_NAME));
+    int shortcut_checks = 0;
+    optimizeTrajectory(traj_opt, traj, &shortcut_checks);
+    _time_parametizer->computeTimeStamps(*traj_opt);
+    computeVelocities(traj_opt);
+    if (stats != NULL)
+    {
+        stats->optimize_time += elapsedSec(stage_start);
+        stats->shortcut_checks += shortcut_checks;
+        stats->wpts_optimized = traj_opt->getWayPointCount();
+    }
+
+    if (!_plan_scene->isPathValid(*traj_opt, UR5_GROUP_NAME, true))
+    {
+        ROS_ERROR("Post-processed roadmap path invalid.");
+        if (stats != NULL) stats->invalid_optimized++;
+        return false;
+    }
 
+    // Pack motion plan struct
+    moveit::core::robotStateToRobotStateMsg(traj_opt->getFirstWayPoint(), plan.start_state);
+    moveit::core::robotStateToRobotStateMsg(traj_opt->getLastWayPoint(), plan.end_state);
+    plan.num_wpts = traj_opt->getWayPointCount();
+    plan.duration = traj_opt->getWaypointDurationFromStart(plan.num_wpts-1);
+    traj_opt->getRobotTrajectoryMsg(plan.trajectory);
+    if (stats != NULL) stats->planner = "roadmap";
     return true;
 }
 
-bool TrajectoryLibrary::fitPlan(ur5_motion_plan& plan, const joint_values_t &start_jvals, const joint_values_t &end_jvals)
+static bool targetsConnected(const Roadmap& roadmap, const std::vector< std::vector<int> >& target_nodes)
 {
-    // First find similar plan in database
-    _kdtree->setTargets(start_jvals, end_jvals);
-    bool success;
-    bool lookup_success;
-    int proximity_index = 0;
-    do
+    int first = -1;
+    for (int i = 0; i < target_nodes.size(); i++)
     {
-        std::cout << "Looking up plan at position " << proximity_index << " in priority queue." << std::endl;
-        lookup_success = _kdtree->lookup(plan, proximity_index);
-        if (!lookup_success)
+        for (int n = 0; n < target_nodes[i].size(); n++)
         {
-            ROS_ERROR("All plans failed.");
-            return false;
+            if (first < 0)
+            {
+                first = target_nodes[i][n];
+            }
+            else if (!roadmap.connected(first, target_nodes[i][n]))
+            {
+                return false;
+            }
         }
-        success = gradientDescentWarp(plan, start_jvals, end_jvals);
-        ++proximity_index;
-    } while (!success);
-
-    std::cout << "Found plan.\n";
+    }
     return true;
 }
 
-void TrajectoryLibrary::build()
+void TrajectoryLibrary::buildRoadmap(const roadmap_params& params)
 {
+    TRACE_SPAN("buildRoadmap");
+
     /* Check that target groups have been generated */
     if (_num_target_groups == 0)
     {
-        ROS_ERROR("No target groups defined.");
-        return;
+        ROS_ERROR("No target groups defined.");
+        return;
+    }
+
+    /* Size travel time matrix to the generated targets */
+    std::vector<int> group_sizes;
+    for (int i = 0; i < _num_target_groups; i++)
+    {
+        group_sizes.push_back(_target_groups[i].target_count);
+    }
+    {
+        boost::mutex::scoped_lock lock(_library_data_mutex);
+        _duration_matrix.resize(group_sizes);
+        _build_report.clear();
+    }
+
+    /* Seed the roadmap with every target, so each pair's endpoints are nodes */
+    boost::posix_time::ptime roadmap_start = boost::posix_time::microsec_clock::universal_time();
+    Roadmap roadmap;
+    int edge_checks = 0;
+    std::vector< std::vector<int> > target_nodes(_num_target_groups);
+    for (int i = 0; i < _num_target_groups; i++)
+    {
+        for (int n = 0; n < _target_groups[i].target_count; n++)
+        {
+            int node = roadmap.addNode(_target_groups[i].jvals[n]);
+            connectRoadmapNode(roadmap, node, params, &edge_checks);
+            target_nodes[i].push_back(node);
+        }
+    }
+
+    /* Grow it with random valid configurations until the targets are joined */
+    robot_state::RobotState sample_state(_rmodel);
+    joint_values_t sample_jvals;
+    int samples = 0;
+    while (samples < params.max_samples)
+    {
+        if (samples >= params.min_samples && targetsConnected(roadmap, target_nodes))
+        {
+            break;
+        }
+        for (int b = 0; b < ROADMAP_BATCH && samples < params.max_samples; b++)
+        {
+            samples++;
+            sample_state.setToRandomPositions(_jmg);
+            if (!stateValid(sample_state))
+            {
+                continue;
+            }
+            sample_state.copyJointGroupPositions(_jmg, sample_jvals);
+            int node = roadmap.addNode(sample_jvals);
+            connectRoadmapNode(roadmap, node, params, &edge_checks);
+        }
+    }
+    ROS_INFO("Roadmap built in %f s from %d samples with %d edge checks.", elapsedSec(roadmap_start), samples, edge_checks);
+    roadmap.printInfo(std::cout);
+    if (!targetsConnected(roadmap, target_nodes))
+    {
+        ROS_WARN("Roadmap leaves some targets apart; their pairs will fail.");
     }
 
-    /* Iterate through target groups for trajectory start location */
+    /* One shortest path tree per start target serves every end target */
+    std::vector<int> parents;
+    std::vector<int> path;
     for (int i = 0; i < _num_target_groups; i++)
     {
-        ROS_INFO("START GROUP: %d", i);
-
-        /* Iterate through target groups again for end location */
-        for (int j = 0; j < _num_target_groups; j++)
+        for (int n = 0; n < _target_groups[i].target_count; n++)
         {
-            if (j == i)
+            ROS_INFO("START TARGET: %d:%d", i, n);
+            boost::posix_time::ptime search_start = boost::posix_time::microsec_clock::universal_time();
+            roadmap.shortestPathTree(target_nodes[i][n], parents);
+            double search_time = elapsedSec(search_start);
+
+            for (int j = 0; j < _num_target_groups; j++)
             {
-                if (!_target_groups[i].vol.allow_internal_paths)
+                if (j == i && !_target_groups[i].vol.allow_internal_paths)
                 {
                     // We don't want to generate paths between targets in the same group
                     continue;
                 }
-                else
-                {
-                    ROS_INFO("INTERNAL");
-                }
-            }
-            else
-            {
-                ROS_INFO("END GROUP: %d", j);
-            }
-
-            // APPLE: If we are moving from place target to pick target, we need to attach an apple
-//            moveit_msgs::AttachedCollisionObject aco_msg;
-//            if (i == PLACE_TARGET && j == PICK_TARGET)
-//            {
-//                aco_msg = getAppleObjectMsg();
-//            }
-//            else
-//            {
-//                aco_msg = getAppleObjectMsg();
-//                aco_msg.object.operation = aco_msg.object.REMOVE;
-//            }
-//            _plan_scene->processAttachedCollisionObjectMsg(getAppleObjectMsg());
-
-            /* Pick particular start target */
-            for (int n = 0; n < _target_groups[i].target_count; n++)
-            {
-                ROS_INFO("START TARGET: %d", n);
-
-                // Construct trajectory start state
-                robot_state::RobotState start_state(_rmodel);
-                start_state.setJointGroupPositions(UR5_GROUP_NAME, _target_groups[i].jvals[n]);
-
-                // Update planning scene with start state
-                _plan_scene->setCurrentState(start_state);
-                // Publish planning scene
-                moveit_msgs::PlanningScene scene_msg;
-                _plan_scene->getPlanningSceneMsg(scene_msg);
-                _plan_scene_publisher.publish(scene_msg);
-
-                /* Now pick particular end target */
                 for (int m = 0; m < _target_groups[j].target_count; m++)
                 {
                     if (i == j && n == m)
@@ -862,47 +2429,43 @@ void TrajectoryLibrary::build()
                         // The start and end targets are the same.
                         continue;
                     }
-                    ROS_INFO("END TARGET: %d", m);
 
-                    // Generate constraint from target joint values
-                    std::vector<moveit_msgs::Constraints> v_constraints;
-                    v_constraints.push_back( genJointValueConstraint( _target_groups[j].jvals[m] ) );
-                    // Generate trajectory
                     ur5_motion_plan plan;
-                    bool success = planTrajectory(plan, v_constraints);
-                    if (!success)
+                    build_pair_stats pair_stats;
+                    initPairStats(pair_stats, i, n, j, m);
+                    boost::posix_time::ptime pair_start = boost::posix_time::microsec_clock::universal_time();
+                    pair_stats.attempts = 1;
+                    pair_stats.planner_time = search_time;
+                    bool success = false;
+                    if (roadmap.tracePath(parents, target_nodes[i][n], target_nodes[j][m], path))
                     {
-                        ROS_ERROR("Planner failed to generate plan for end target %d. Skipping.", m);
-                        continue;
+                        success = roadmapPlan(plan, roadmap, path, &pair_stats);
                     }
-
-                    // Publish trajectory
-                    moveit_msgs::DisplayTrajectory display_trajectory;
-                    display_trajectory.trajectory.push_back(plan.trajectory);
-                    display_trajectory.trajectory_start = plan.start_state;
-                    _trajectory_publisher.publish(display_trajectory);
-
-                    // Now record start and stop locations
-                    plan.start_target_index = n;
-                    plan.end_target_index = m;
-
-                    // Store trajectory in KD tree
-                    try { _kdtree->add(plan); }
-                    catch (std::string& s)
+                    else
                     {
-                        ROS_ERROR("KDTree::add() exception: %s.", s.c_str());
+                        pair_stats.planner_failures++;
                     }
+                    pair_stats.total_time = elapsedSec(pair_start) + search_time;
+                    pair_stats.success = success;
+                    pair_stats.duration = success ? plan.duration : -1;
+                    recordTargetPair(plan, pair_stats);
+
+                    // The tree is charged to the first pair it serves, so report totals stay honest
+                    search_time = 0;
                 }
             }
         }
     }
 
     _kdtree->printInfo(std::cout);
+    _duration_matrix.printInfo(std::cout);
+    _build_report.printInfo(std::cout);
+    reserveWorkspaces();
 
     return;
 }
 
-void TrajectoryLibrary::demo()
+void TrajectoryLibrary::demo(double deadline, int parallel_hits)
 {
     // Initialize trajectory manager
     _execution_manager.reset(new trajectory_execution_manager::TrajectoryExecutionManager(_rmodel));
@@ -942,7 +2505,7 @@ void TrajectoryLibrary::demo()
 
         ROS_INFO("Running gradient fit.");
         ur5_motion_plan plan;
-        bool success = fitPlan(plan, start_jvals, end_jvals);
+        bool success = fitPlanConfigured(plan, start_jvals, end_jvals, deadline, parallel_hits);
         if (!success)
         {
             ROS_ERROR("Plan fitting failed. Trying new target.");
@@ -952,6 +2515,7 @@ void TrajectoryLibrary::demo()
         // Computation time
         boost::posix_time::ptime compute_time_end = boost::posix_time::microsec_clock::universal_time();
         ROS_INFO("KD lookup time: = %d usec.", (int) (compute_time_end - compute_time_start).total_microseconds());
+        printValidityCacheInfo(std::cout);
 
         // Get RobotTrajectory object from msg
         robot_trajectory::RobotTrajectoryPtr traj(new robot_trajectory::RobotTrajectory(_rmodel, UR5_GROUP_NAME));
@@ -1011,238 +2575,244 @@ void TrajectoryLibrary::demo()
     return;
 }
 
-bool TrajectoryLibrary::filewrite(const std::vector<ur5_motion_plan>& plans, const char* filename, bool debug = false)
+void TrajectoryLibrary::getLibraryTargets(std::vector< std::vector<joint_values_t> >& targets)
 {
-    int plan_count = plans.size();
-    int node_count;
-
-    std::ofstream file;
-    file.open (filename, std::ofstream::out | std::ofstream::binary);
-
-    // If file didn't open correctly
-    if (!file.is_open())
+    targets.assign(_num_target_groups, std::vector<joint_values_t>());
+    for (int g = 0; g < _num_target_groups && g < _duration_matrix.getGroupCount(); g++)
     {
-        return false;
+        targets[g] = _target_groups[g].jvals;
+        targets[g].resize(_duration_matrix.getGroupSize(g));
     }
 
-    // First write plan_group meta info
-    file.write((char *)(&plan_count),sizeof(plan_count));                   // number of plans
-
-    if (debug == 1) ROS_INFO("%d",plan_count);
-    for (size_t n = 0; n < plan_count; n++)
+    // A library loaded from file has no target lists, but its plans end on the targets. Plans do not
+    // record their group, so this only works when there is a single one.
+    if (_num_target_groups != 1 || _duration_matrix.getGroupCount() != 1 || !_target_groups[0].jvals.empty())
     {
-        const ur5_motion_plan& plan = plans[n];
-
-        //RobotTrajectory -> JointTrajectory -> JointTrajectoryPoints
-        node_count = plan.trajectory.joint_trajectory.points.size();
-        ROS_INFO("%d",node_count);
-        file.write((char *)(&node_count),sizeof(node_count));
-        for (size_t idx = 0; idx < node_count; idx++)
+        return;
+    }
+    std::vector<ur5_motion_plan> plans;
+    _kdtree->copyPlanData(plans);
+    for (std::size_t i = 0; i < plans.size(); i++)
+    {
+        int start_target = plans[i].start_target_index;
+        int end_target = plans[i].end_target_index;
+        if (start_target >= 0 && start_target < targets[0].size())
         {
-            for (size_t i=0; i < 6; i++)
-            {
-                file.write((char *)(&plan.trajectory.joint_trajectory.points[idx].positions[i]),sizeof(double));
-                file.write((char *)(&plan.trajectory.joint_trajectory.points[idx].velocities[i]),sizeof(double));
-            }
-            file.write((char *)(&plan.trajectory.joint_trajectory.points[idx].time_from_start),sizeof(ros::Duration));
+            targets[0][start_target] = plans[i].start_state.joint_state.position;
         }
-
-        //RobotTrajectory -> JointTrajectory -> Header
-        file.write((char *)(&plan.trajectory.joint_trajectory.header.seq),sizeof(uint32_t));
-        file.write((char *)(&plan.trajectory.joint_trajectory.header.stamp),sizeof(ros::Time));
-        file << plan.trajectory.joint_trajectory.header.frame_id << '\n';
-
-        //RobotTrajectory -> JointTrajectory -> joint_names
-        for (size_t i=0; i < 6; i++) file << plan.trajectory.joint_trajectory.joint_names[i] << '\n';
-
-
-        //start_state
-        //RobotState -> JointState -> Header
-        file.write((char *)(&plan.start_state.joint_state.header.seq),sizeof(uint32_t));
-        file.write((char *)(&plan.start_state.joint_state.header.stamp),sizeof(ros::Time));
-        file << plan.start_state.joint_state.header.frame_id << '\n';
-        //RobotState -> JointState -> string & position
-        for (size_t j = 0; j < 6; j++)
+        if (end_target >= 0 && end_target < targets[0].size())
         {
-            file << plan.start_state.joint_state.name[j] << '\n';
-            file.write((char *)(&plan.start_state.joint_state.position[j]),sizeof(double));
+            targets[0][end_target] = plans[i].end_state.joint_state.position;
         }
+    }
+    return;
+}
 
-        //end_state
-        //RobotState -> JointState -> Header
-        file.write((char *)(&plan.end_state.joint_state.header.seq),sizeof(uint32_t));
-        file.write((char *)(&plan.end_state.joint_state.header.stamp),sizeof(ros::Time));
-        file << plan.end_state.joint_state.header.frame_id << '\n';
-        //RobotState -> JointState -> stirng & position
-        for (size_t j = 0; j < 6; j++)
-        {
-            file << plan.end_state.joint_state.name[j] << '\n';
-            file.write((char *)(&plan.end_state.joint_state.position[j]),sizeof(double));
-        }
+double TrajectoryLibrary::sequenceTargets(std::vector<joint_values_t>& targets, const joint_values_t& start_jvals)
+{
+    TargetSequencer sequencer(_kdtree);
+    if (_duration_matrix.getTargetCount() > 0)
+    {
+        std::vector< std::vector<joint_values_t> > library_targets;
+        getLibraryTargets(library_targets);
+        sequencer.setDurationMatrix(&_duration_matrix, library_targets);
+    }
+    sequencer.setTargets(start_jvals, targets);
 
-        //index
-        file.write((char *)(&plan.start_target_index),sizeof(unsigned int));
-        file.write((char *)(&plan.end_target_index),sizeof(unsigned int));
+    // Estimated cost of the order we were given
+    std::vector<std::size_t> order;
+    for (std::size_t i = 0; i < targets.size(); i++)
+    {
+        order.push_back(i);
+    }
+    double given_cost = sequencer.orderCost(order);
 
-        //duration
-        file.write((char *) &plan.duration, sizeof(ur5_motion_plan::duration));
+    double cost = sequencer.solve(order);
+    ROS_INFO("Sequenced %d targets: estimated %f sec (%f sec in given order).", (int) targets.size(), cost, given_cost);
 
-        //write an apple
-        if (plan.start_state.attached_collision_objects.size() > 0)
-        {
-            file << "apple\n";
-        }
-        else
-        {
-            file << "no apple\n";
-        }
+    std::vector<joint_values_t> sorted;
+    sorted.reserve(targets.size());
+    for (std::size_t i = 0; i < order.size(); i++)
+    {
+        sorted.push_back(targets[ order[i] ]);
     }
+    targets.swap(sorted);
 
-    file.close();
-
-    return true;
+    return cost;
 }
 
-bool TrajectoryLibrary::fileread(std::vector<ur5_motion_plan>& plans, const char* filename, bool debug = false)
+void TrajectoryLibrary::demoPipelined(double deadline, int parallel_hits, int batch_size)
 {
-    int wpt_count;
-    int plan_count;
-
-    //int nodeset = 10;
-    double temp_double;
-    std::string temp_string;
-    std::string blank_string;
-    ros::Duration temp_duration;
+    // Initialize trajectory manager
+    _execution_manager.reset(new trajectory_execution_manager::TrajectoryExecutionManager(_rmodel));
+    if (!_execution_manager->ensureActiveControllersForGroup(UR5_GROUP_NAME))
+    {
+        ROS_ERROR("Controllers for joint group are not active.");
+    }
 
-    ur5_motion_plan temp_plan;
-    ur5_motion_plan empty;
-    std::vector<int> temp;
-    trajectory_msgs::JointTrajectoryPoint temp_points;
-    trajectory_msgs::JointTrajectoryPoint blank;
+    ROS_INFO("Generating start target.");
+    joint_values_t start_jvals;
+    joint_values_t target_jvals;
+    //////////////////////
+    /// This is specific to WEEDING with single target group
+    generateRandomJointTarget(start_jvals, _target_groups[0].vol);
+    //////////////////////
 
-    std::ifstream info;
-    info.open(filename,std::ifstream::in | std::ofstream::binary);
+    // The planning worker fits trajectory k+1 while trajectory k executes
+    PlanPipeline pipeline(this, deadline, parallel_hits, PIPELINE_QUEUE_SIZE, PIPELINE_MAX_TARGETS);
+    pipeline.start(start_jvals);
 
-    if(!info.is_open())
+    // Last target handed to the pipeline, where the next batch tour starts
+    joint_values_t tour_start = start_jvals;
+    // Rest of the current batch, in tour order, while the pipeline is full
+    std::deque<joint_values_t> held_targets;
+    std::vector< std::vector<joint_values_t> > library_targets;
+    if (batch_size > 0)
     {
-        return false;
+        getLibraryTargets(library_targets);
     }
 
-    // First read meta data
-    info.read((char*)(&plan_count), sizeof(plan_count));                    // Number of plans
-    plans.reserve(plan_count);
-
-    if (debug == 1) ROS_INFO("%d",plan_count);
-    for (size_t n = 0; n < plan_count; n++)
+    while (ros::ok())
     {
-        // Iterate through waypoints
-        info.read((char*)(&wpt_count),sizeof(wpt_count));
-        temp.push_back(wpt_count);
-        if (debug == 1) ROS_INFO("%d",wpt_count);
-        for (size_t wpt_idx = 0; wpt_idx < wpt_count; wpt_idx++)
+        // Keep the planner fed
+        if (batch_size > 0)
         {
-            for (size_t i=0; i<6; i++)
+            // Treat each batch as a freshly detected set of weeds and visit them in tour order
+            if (held_targets.empty() && pipeline.getPendingTargetCount() == 0)
+            {
+                std::vector<joint_values_t> batch(batch_size);
+                for (int i = 0; i < batch_size; i++)
+                {
+                    // Weeds at library targets, when the library knows them, so tours use the build-time durations
+                    const joint_values_t* grid_target = NULL;
+                    if (!library_targets.empty() && !library_targets[0].empty())
+                    {
+                        grid_target = &library_targets[0][ rand() % library_targets[0].size() ];
+                    }
+                    if (grid_target != NULL && !grid_target->empty())
+                    {
+                        batch[i] = *grid_target;
+                    }
+                    else
+                    {
+                        generateRandomJointTarget(batch[i], _target_groups[0].vol);
+                    }
+                }
+                sequenceTargets(batch, tour_start);
+                held_targets.assign(batch.begin(), batch.end());
+                tour_start = batch.back();
+            }
+            while (!held_targets.empty() && pipeline.pushTarget(held_targets.front()))
             {
-                info.read((char *)(&temp_double),sizeof(temp_double));
-                temp_points.positions.push_back(temp_double);
-                info.read((char *)(&temp_double),sizeof(temp_double));
-                temp_points.velocities.push_back(temp_double);
+                held_targets.pop_front();
             }
-            info.read((char *)(&temp_duration),sizeof(temp_duration));
-            //ros::Duration d(z);
-            temp_points.time_from_start = temp_duration;
-            temp_plan.trajectory.joint_trajectory.points.push_back(temp_points);
-            temp_points = blank;
         }
-
-        //RobotTrajectory -> JointTrajectory -> Header
-        info.read((char *)(&temp_plan.trajectory.joint_trajectory.header.seq),sizeof(uint32_t));
-        info.read((char *)(&temp_plan.trajectory.joint_trajectory.header.stamp),sizeof(ros::Time));
-        getline (info,temp_plan.trajectory.joint_trajectory.header.frame_id);
-
-        //RobotTrajectory -> JointTrajectory -> joint_names
-        for (size_t i=0; i < 6; i++)
-        {
-            getline(info,temp_string);
-            temp_plan.trajectory.joint_trajectory.joint_names.push_back(temp_string);
-            temp_string = blank_string;
-        }
-
-        //start_state
-        //RobotState -> JointState -> Header
-        info.read((char *)(&temp_plan.start_state.joint_state.header.seq),sizeof(uint32_t));
-        info.read((char *)(&temp_plan.start_state.joint_state.header.stamp),sizeof(ros::Time));
-        getline(info, temp_plan.start_state.joint_state.header.frame_id);
-
-        //RobotState -> JointState -> stirng & position
-        for (size_t j = 0; j < 6; j++)
+        else
         {
-            getline(info, temp_string);
-            temp_plan.start_state.joint_state.name.push_back(temp_string);
-            temp_string = blank_string;
-
-            info.read((char *)(&temp_double),sizeof(temp_double));
-            temp_plan.start_state.joint_state.position.push_back(temp_double);
+            while (pipeline.getPendingTargetCount() < PIPELINE_QUEUE_SIZE)
+            {
+                generateRandomJointTarget(target_jvals, _target_groups[0].vol);
+                pipeline.pushTarget(target_jvals);
+            }
         }
 
-        //end_state
-        //RobotState -> JointState -> Header
-        info.read((char *)(&temp_plan.end_state.joint_state.header.seq),sizeof(uint32_t));
-        info.read((char *)(&temp_plan.end_state.joint_state.header.stamp),sizeof(ros::Time));
-        getline (info,temp_plan.end_state.joint_state.header.frame_id);
-
-        //RobotState -> JointState -> stirng & position
-        for (size_t j = 0; j < 6; j++)
+        // Time out now and then so failed targets get replaced
+        pipeline_item item;
+        if (!pipeline.popPlan(item, 1.0))
         {
-            getline(info,temp_string);
-            temp_plan.end_state.joint_state.name.push_back(temp_string);
-            temp_string = blank_string;
-
-            info.read((char *)(&temp_double),sizeof(temp_double));
-            temp_plan.end_state.joint_state.position.push_back(temp_double);
-
+            continue;
         }
+        ROS_INFO("Trajectory %d has %d nodes and takes %f seconds.", item.sequence, item.plan.num_wpts, item.plan.duration);
 
-        //Index
-        info.read((char *)(&temp_plan.start_target_index),sizeof(unsigned int));
-        info.read((char *)(&temp_plan.end_target_index),sizeof(unsigned int));
+        // Publish trajectory and end state. The planning scene is left alone since the
+        // worker is reading it.
+        moveit_msgs::DisplayRobotState state_msg;
+        state_msg.state = item.plan.end_state;
+        _robot_state_publisher.publish(state_msg);
 
-        // Duration
-        info.read((char*) &(temp_plan.duration), sizeof(ur5_motion_plan::duration));
+        moveit_msgs::DisplayTrajectory display_trajectory;
+        display_trajectory.trajectory_start = item.plan.start_state;
+        display_trajectory.trajectory.push_back(item.plan.trajectory);
+        _trajectory_publisher.publish(display_trajectory);
 
-        // Now check for an apple
-        /* Define the attached object message*/
-        getline(info,temp_string);
-        if (debug) { std::cout << temp_string << '\n'; }
-        if (temp_string == "apple")
+        // Execute trajectory; the worker keeps planning ahead while we wait for the controller
+        if (!_execution_manager->pushAndExecute(item.plan.trajectory))
         {
-            std::cout << "Adding apple for this trajectory.\n";
-            temp_plan.start_state.attached_collision_objects.push_back(getAppleObjectMsg());
-            temp_plan.end_state.attached_collision_objects.push_back(getAppleObjectMsg());
+            // Queued plans start from where we expected to be, not where we are
+            ROS_ERROR("Execution was rejected. Replanning from trajectory start.");
+            pipeline.cancel(item.start_jvals, &item);
+            continue;
         }
-        else
+        moveit_controller_manager::ExecutionStatus status = _execution_manager->waitForExecution();
+        if (status != moveit_controller_manager::ExecutionStatus::SUCCEEDED)
         {
-            ROS_ASSERT(temp_string == "no apple");
+            // An abort or preemption leaves the arm short of the planned end state
+            ROS_ERROR("Execution %s. Replanning from trajectory start.", status.asString().c_str());
+            pipeline.cancel(item.start_jvals, &item);
+            continue;
         }
+    }
+
+    pipeline.stop();
+    return;
+}
+
+std::size_t TrajectoryLibrary::compactLibrary(double warp_radius, double traj_tolerance, std::vector<ur5_motion_plan>* dropped_plans)
+{
+    std::vector<ur5_motion_plan> plans;
+    std::vector<ur5_motion_plan> kept;
+    _kdtree->copyPlanData(plans);
 
-        // Other parameters
-        temp_plan.num_wpts = wpt_count;
+    LibraryCompactor compactor(_kdtree, warp_radius, traj_tolerance);
+    std::size_t dropped = compactor.compact(plans, kept, dropped_plans);
 
-        plans.push_back(temp_plan);
-        temp_plan = empty;
+    // Rebuild tree from the survivors
+    _kdtree->clear();
+    for (int i=0; i < kept.size(); i++)
+    {
+        try { _kdtree->add(kept[i]); }
+        catch (std::string& s)
+        {
+            ROS_ERROR("KDTree::add() exception: %s.", s.c_str());
+        }
     }
 
-    info.close();
+    // The duration matrix is kept as built: every dropped plan is within the warp radius of a kept one,
+    // so its planned duration still estimates the travel time, and failed pairs stay failed.
 
-    return true;
+    ROS_INFO("Compaction kept %d of %d plans.", (int) kept.size(), (int) plans.size());
+    _kdtree->printInfo(std::cout);
+    return dropped;
+}
 
+target_volume weedingSoilVolume()
+{
+    target_volume weedSoilVol;
+    weedSoilVol.type = GRID_RECT;
+    weedSoilVol.grid.orientation.w = sqrt(0.5);
+    weedSoilVol.grid.orientation.x = 0;
+    weedSoilVol.grid.orientation.y = -sqrt(0.5);
+    weedSoilVol.grid.orientation.z = 0;
+    weedSoilVol.grid.xlim_low = -0.35;
+    weedSoilVol.grid.xlim_high = 0.35;
+    weedSoilVol.grid.xres = 4;
+    weedSoilVol.grid.ylim_high = -0.25;
+    weedSoilVol.grid.ylim_low = 0.25;
+    weedSoilVol.grid.yres = 2;
+    weedSoilVol.grid.zlim_low = 0.80;
+    weedSoilVol.grid.zlim_high = 0.89;
+    weedSoilVol.grid.zres = 1;
+    weedSoilVol.allow_internal_paths = true;
+    return weedSoilVol;
 }
 
 void TrajectoryLibrary::exportToFile(const char* filename)
 {
     // SAVE DATA TO .dat FILE
     ROS_INFO("--------------SAVING!!!!-------------------");
-    if ( filewrite(_kdtree->getPlanData(), filename, false) )
+    std::vector<ur5_motion_plan> plans;
+    _kdtree->copyPlanData(plans);
+    if ( writePlanFile(plans, filename) )
     {
         ROS_INFO("Trajectories written to file.");
     }
@@ -1250,6 +2820,32 @@ void TrajectoryLibrary::exportToFile(const char* filename)
     {
         ROS_ERROR("Trajectories not saved to file.");
     }
+
+    // Travel time matrix goes next to the library; the flush thread may get here mid build
+    boost::mutex::scoped_lock lock(_library_data_mutex);
+    std::string matrix_filename = std::string(filename) + ".dur";
+    if ( _duration_matrix.write(matrix_filename.c_str()) )
+    {
+        ROS_INFO("Duration matrix written to %s.", matrix_filename.c_str());
+    }
+    else
+    {
+        ROS_ERROR("Duration matrix not saved to file.");
+    }
+
+    // So is the profile of the build that produced it, if this process ran one
+    if (_build_report.size() > 0)
+    {
+        std::string report_filename = std::string(filename) + ".build.csv";
+        if ( _build_report.writeCsv(report_filename.c_str()) )
+        {
+            ROS_INFO("Build report written to %s.", report_filename.c_str());
+        }
+        else
+        {
+            ROS_ERROR("Build report not saved to file.");
+        }
+    }
     return;
 }
 
@@ -1258,7 +2854,7 @@ void TrajectoryLibrary::importFromFile(const char *filename)
     //LOAD DATA FROM .dat FILE
     ROS_INFO("--------------LOADING!!!!-------------------");
     std::vector<ur5_motion_plan> plans;
-    if ( fileread(plans, filename, false) )
+    if ( readPlanFile(plans, filename) )
     {
         for (int i=0; i < plans.size(); i++)
         {
@@ -1274,55 +2870,33 @@ void TrajectoryLibrary::importFromFile(const char *filename)
         ROS_ERROR("File import failed.");
     }
 
-    _kdtree->printInfo(std::cout);
-    return;
-}
-
- moveit_msgs::AttachedCollisionObject TrajectoryLibrary::getAppleObjectMsg()
-{
-    moveit_msgs::AttachedCollisionObject apple;
-    apple.link_name = "ee_link";
-    apple.object.header.frame_id = "ee_link";
-    apple.object.id = "apple";
-
-    geometry_msgs::Pose pose;
-    shape_msgs::SolidPrimitive primitive;
-    pose.position.x = 0.05;
-    primitive.type = primitive.SPHERE;
-    primitive.dimensions.resize(1);
-    primitive.dimensions[0] = 0.05;
+    _library_filename = filename;
 
-    apple.object.primitives.push_back(primitive);
-    apple.object.primitive_poses.push_back(pose);
-    apple.object.operation = apple.object.ADD;
-    /* Publish and sleep (to view the visualized results)*/
+    std::string matrix_filename = std::string(filename) + ".dur";
+    boost::mutex::scoped_lock lock(_library_data_mutex);
+    if ( _duration_matrix.read(matrix_filename.c_str()) )
+    {
+        _duration_matrix.printInfo(std::cout);
+    }
+    else
+    {
+        ROS_WARN("No duration matrix found at %s.", matrix_filename.c_str());
+    }
+    lock.unlock();
 
-    return apple;
+    _kdtree->printInfo(std::cout);
+    reserveWorkspaces();
+    return;
 }
 
  void TrajectoryLibrary::generateRandomJointTarget(joint_values_t& jvals, const target_volume& vol)
  {
      if (vol.type == GRID_RECT)
      {
-         double dx = (vol.grid.xlim_high - vol.grid.xlim_low) / 1000.0;
-         double dy = (vol.grid.ylim_high - vol.grid.ylim_low) / 1000.0;
-         double dz = (vol.grid.zlim_high - vol.grid.zlim_low) / 1000.0;
-
-         bool success = false;
-         std::vector<joint_values_t> solutions;
-         while (!success)
+         geometry_msgs::Point position;
+         while (!sampleTarget(jvals, position, vol))
          {
-             geometry_msgs::Pose pose;
-             pose.orientation = vol.grid.orientation;
-             pose.position.x = (dx * (rand() % 1000)) + vol.grid.xlim_low;
-             pose.position.y = (dy * (rand() % 1000)) + vol.grid.ylim_low;
-             pose.position.z = (dz * (rand() % 1000)) + vol.grid.zlim_low;
-
-             success = doIK(solutions, pose);
          }
-
-         jvals = joint_values_t(solutions[0]);
-
      }
 
      else
@@ -1332,3 +2906,182 @@ void TrajectoryLibrary::importFromFile(const char *filename)
 
      return;
  }
+
+bool TrajectoryLibrary::sampleTarget(joint_values_t& jvals, geometry_msgs::Point& position, const target_volume& vol)
+{
+    double dx = (vol.grid.xlim_high - vol.grid.xlim_low) / 1000.0;
+    double dy = (vol.grid.ylim_high - vol.grid.ylim_low) / 1000.0;
+    double dz = (vol.grid.zlim_high - vol.grid.zlim_low) / 1000.0;
+
+    geometry_msgs::Pose pose;
+    pose.orientation = vol.grid.orientation;
+    pose.position.x = (dx * (rand() % 1000)) + vol.grid.xlim_low;
+    pose.position.y = (dy * (rand() % 1000)) + vol.grid.ylim_low;
+    pose.position.z = (dz * (rand() % 1000)) + vol.grid.zlim_low;
+
+    std::vector<joint_values_t> solutions;
+    if (!doIK(solutions, pose))
+    {
+        return false;
+    }
+    jvals = solutions[0];
+    position = pose.position;
+    return true;
+}
+
+void TrajectoryLibrary::analyzeCoverage(CoverageReport& report, int num_samples)
+{
+    // Group pairs the library is meant to connect, as in build()
+    std::vector< std::pair<int, int> > group_pairs;
+    for (int i = 0; i < _num_target_groups; i++)
+    {
+        if (_target_groups[i].vol.type != GRID_RECT)
+        {
+            continue;
+        }
+        for (int j = 0; j < _num_target_groups; j++)
+        {
+            if (_target_groups[j].vol.type != GRID_RECT || (i == j && !_target_groups[i].vol.allow_internal_paths))
+            {
+                continue;
+            }
+            group_pairs.push_back(std::make_pair(i, j));
+        }
+    }
+    if (group_pairs.empty())
+    {
+        ROS_ERROR("No target volumes to sample.");
+        return;
+    }
+
+    ROS_INFO("Sampling %d queries from the target volumes.", num_samples);
+    report.clear();
+    int failed_ik = 0;
+    int max_failures = COVERAGE_MAX_IK_FAILURES * num_samples;
+    while (report.size() < num_samples)
+    {
+        if (failed_ik >= max_failures)
+        {
+            ROS_ERROR("Coverage gave up after %d poses without IK solutions; are the target volumes reachable?", failed_ik);
+            break;
+        }
+
+        coverage_sample sample;
+        const std::pair<int, int>& groups = group_pairs[ rand() % group_pairs.size() ];
+        sample.start_group = groups.first;
+        sample.end_group = groups.second;
+        if (!sampleTarget(sample.start_jvals, sample.start_position, _target_groups[sample.start_group].vol) ||
+            !sampleTarget(sample.end_jvals, sample.end_position, _target_groups[sample.end_group].vol))
+        {
+            // Unreachable poses are not library gaps
+            failed_ik++;
+            continue;
+        }
+
+        std::size_t plan_index;
+        if (!_kdtree->nearest(plan_index, sample.distance, sample.start_jvals, sample.end_jvals))
+        {
+            sample.distance = -1;
+        }
+        report.add(sample);
+    }
+    ROS_INFO("Coverage sampled %d queries (%d poses without IK solutions discarded).", (int) report.size(), failed_ik);
+    return;
+}
+
+std::size_t TrajectoryLibrary::buildGaps(const CoverageReport& report, int max_gaps)
+{
+    std::vector<coverage_sample> gaps;
+    report.getGaps(gaps);
+    if (gaps.size() > max_gaps)
+    {
+        gaps.resize(max_gaps);
+    }
+    if (gaps.empty())
+    {
+        ROS_INFO("No coverage gaps to build.");
+        return 0;
+    }
+
+    // New targets go after every existing one. The duration matrix knows each group's count, but libraries
+    // without a .dur file have no matrix, so the loaded plans' target indices bound it too. Plans do not
+    // record their group, so that bound applies to all groups.
+    int first_free = 0;
+    std::vector<ur5_motion_plan> plans;
+    _kdtree->copyPlanData(plans);
+    for (std::size_t i = 0; i < plans.size(); i++)
+    {
+        first_free = std::max(first_free, plans[i].start_target_index + 1);
+        first_free = std::max(first_free, plans[i].end_target_index + 1);
+    }
+    std::vector<int> group_sizes(_num_target_groups, first_free);
+    if (_duration_matrix.getGroupCount() == _num_target_groups)
+    {
+        for (int g = 0; g < _num_target_groups; g++)
+        {
+            group_sizes[g] = std::max(first_free, _duration_matrix.getGroupSize(g));
+        }
+    }
+    std::vector<int> start_indices(gaps.size());
+    std::vector<int> end_indices(gaps.size());
+    for (std::size_t k = 0; k < gaps.size(); k++)
+    {
+        start_indices[k] = group_sizes[gaps[k].start_group]++;
+        end_indices[k] = group_sizes[gaps[k].end_group]++;
+
+        // Keep the target lists in step when they are populated
+        target_group& start_group = _target_groups[gaps[k].start_group];
+        if (start_group.jvals.size() == start_indices[k])
+        {
+            start_group.jvals.push_back(gaps[k].start_jvals);
+        }
+        target_group& end_group = _target_groups[gaps[k].end_group];
+        if (end_group.jvals.size() == end_indices[k])
+        {
+            end_group.jvals.push_back(gaps[k].end_jvals);
+        }
+    }
+    // target_count indexes jvals in build(), so it may only count targets that are really listed.
+    // A list that fell behind the matrix (gaps from an earlier run) stays a prefix of it.
+    for (int g = 0; g < _num_target_groups; g++)
+    {
+        _target_groups[g].target_count = _target_groups[g].jvals.size();
+        if (_target_groups[g].target_count < group_sizes[g])
+        {
+            ROS_WARN("Group %d lists %d of its %d targets; gap targets are kept in the duration matrix only.",
+                     g, _target_groups[g].target_count, group_sizes[g]);
+        }
+    }
+    {
+        boost::mutex::scoped_lock lock(_library_data_mutex);
+        if (!_duration_matrix.grow(group_sizes))
+        {
+            _duration_matrix.resize(group_sizes);
+        }
+        _build_report.clear();
+    }
+
+    // Plan each gap both ways, since queries chain end to start
+    ROS_INFO("Building %d coverage gaps.", (int) gaps.size());
+    std::size_t added = 0;
+    for (std::size_t k = 0; k < gaps.size(); k++)
+    {
+        const coverage_sample& gap = gaps[k];
+        ROS_INFO("GAP %d: distance %f.", (int) k, gap.distance);
+
+        setStartTarget(gap.start_jvals);
+        added += planTargetPair(gap.start_group, start_indices[k], gap.end_group, end_indices[k], gap.end_jvals);
+
+        setStartTarget(gap.end_jvals);
+        added += planTargetPair(gap.end_group, end_indices[k], gap.start_group, start_indices[k], gap.start_jvals);
+    }
+
+    _kdtree->printInfo(std::cout);
+    _build_report.printInfo(std::cout);
+    if (_portfolio_params.planner_ids.size() > 1)
+    {
+        printPortfolioInfo(std::cout);
+    }
+    reserveWorkspaces();
+    return added;
+}
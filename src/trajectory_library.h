@@ -2,6 +2,17 @@
 #define TRAJECTORY_LIBRARY_H
 
 #include "kd_tree.h"
+#include "validity_cache.h"
+#include "target_sequencer.h"
+#include "duration_matrix.h"
+#include "build_report.h"
+#include "coverage.h"
+#include "roadmap.h"
+#include "library_compactor.h"
+#include "warp_workspace.h"
+#include "plan_io.h"
+#include "query_trace.h"
+#include "metrics.h"
 
 #include <pluginlib/class_loader.h>
 #include <ros/ros.h>
@@ -29,9 +40,14 @@
 #include <moveit_msgs/PlanningScene.h>
 #include <moveit_msgs/DisplayRobotState.h>
 #include <moveit_msgs/AttachedCollisionObject.h>
+#include <std_msgs/String.h>
 #include <moveit/kdl_kinematics_plugin/kdl_kinematics_plugin.h>
 
 #include "boost/scoped_ptr.hpp"
+#include <boost/asio/io_service.hpp>
+#include <boost/atomic.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/thread.hpp>
 #include <iostream>
 
 #define UR5_GROUP_NAME "manipulator"
@@ -41,6 +57,21 @@
 
 #define IK_COMP_MIN_DIST 3.0
 
+#define GRADIENT_DELTA 0.001    // joint perturbation for finite-difference gradients (rad)
+#define GRADIENT_ACCEL_PASSES 4 // acceleration limit passes over the segments around a perturbed waypoint
+#define GDW_FIXED_STEP_SIZE 0.001       // rad, largest joint move per GDW_FIXED_STEP iteration
+#define GDW_FIXED_MIN_IMPROVEMENT 0.01  // s, GDW_FIXED_STEP stops once an iteration gains less
+
+#define FIT_MAX_HITS 10         // library candidates warped by a deadline-bounded fitPlan
+#define WARP_POOL_THREADS 4     // workers for speculative parallel warping
+#define PIPELINE_QUEUE_SIZE 2   // targets and plans buffered ahead of execution
+#define PIPELINE_MAX_TARGETS 16 // targets the pipeline accepts before the producer has to hold on to them
+#define ROADMAP_BATCH 100       // roadmap samples added between target connectivity checks
+#define SHORTCUT_BATCH 4        // shortcut end waypoints checked concurrently, furthest first
+#define PORTFOLIO_GRACE_TIME 1.0        // s past allowed_planning_time before racing planners are terminated
+#define COVERAGE_MAX_IK_FAILURES 10     // unreachable poses per requested sample before analyzeCoverage gives up
+#define WEEDING_BUSH_RADIUS 0.15        // m, default bush collision sphere of the weeding nodes
+
 typedef struct {
     double xlim_low;
     double xlim_high;
@@ -70,6 +101,9 @@ typedef struct {
     bool allow_internal_paths;
 } target_volume;
 
+// Soil grid the weeding library is built over; every weeding node must use the same one
+target_volume weedingSoilVolume();
+
 enum grid_type {
     GRID_RECT,
     GRID_SPHERE
@@ -86,8 +120,105 @@ enum target_groups {
     PLACE_TARGET
 };
 
+enum warp_method {
+    GDW_FIXED_STEP,     // original warp: normalized gradient step of GDW_FIXED_STEP_SIZE, stop on first rejected step
+    GDW_MOMENTUM        // heavy-ball momentum with backtracking line search
+};
+
+typedef struct {
+    int method;
+    int max_iterations;
+    double max_time;            // wall-clock budget per warp (s), <= 0 for none; deadline variants are bounded by their deadline anyway
+    double step;                // largest joint move per iteration (rad), GDW_MOMENTUM only
+    double min_step;            // line search gives up below this step (rad), GDW_MOMENTUM only
+    double momentum;            // GDW_MOMENTUM only
+    double min_improvement;     // stop once an iteration gains less than this (s), GDW_MOMENTUM only
+} warp_params;
+
+typedef struct {
+    double lookup_time;         // s spent in KDTree setTargets/lookup
+    double warp_time;           // s spent optimizing, excluding validation
+    double validation_time;     // s spent in path validity checks
+    int warp_iterations;        // gradient descent iterations, summed over all warped hits
+    int hits_tried;
+    bool deadline_hit;
+    bool used_fallback;         // straight joint-space path between targets was returned
+} fit_report;
+
+typedef struct {
+    bool enabled;
+    double novelty_dist;        // only learn plans at least this far (summed joint distance) from their nearest library plan
+    int max_cell_plans;         // only learn plans whose KDTree cell holds fewer plans than this
+    double flush_period;        // s between background library writes, <= 0 to never write
+    std::string filename;       // must not be the imported library, which would be overwritten
+} learning_params;
+
+typedef struct {
+    std::vector<std::string> planner_ids;   // e.g. "manipulator[RRTConnectkConfigDefault]"; more than one are raced
+    double allowed_time;                    // s per planner call
+    bool first_wins;                        // else wait out every planner and keep the shortest valid path
+} portfolio_params;
+
+typedef struct {
+    bool parallel;              // check shortcut candidates on the warp pool
+    int random_iterations;      // random shortcuts tried after the greedy pass, 0 for none
+    int bisections;             // a colliding random shortcut has its far end halved back this often
+    double max_time;            // s budget for the random shortcuts, <= 0 for none
+} shortcut_params;
+
+typedef struct {
+    int min_samples;            // random configurations added before targets may count as connected
+    int max_samples;            // sampling stops here even if some targets are still apart
+    int neighbors;              // nearest nodes each new node tries to connect to
+    double max_edge;            // longest edge tried, summed joint distance (rad)
+} roadmap_params;
+
+// How one portfolio planner has fared over the races it ran
+typedef struct {
+    std::string planner_id;
+    int races;
+    int solved;                 // returned a path
+    int valid;                  // returned a path that passed validation
+    int wins;                   // returned the path that was kept
+    double solve_time;          // s, summed over races
+} planner_stats;
+
+// Hot-path metrics, registered once in the constructor and bumped lock-free afterwards
+typedef struct {
+    MetricCounter* fit_queries;
+    MetricCounter* fit_failures;
+    MetricCounter* fallbacks;
+    MetricCounter* deadline_hits;
+    MetricCounter* warps;
+    MetricCounter* invalid_seeds;           // warps abandoned because the retargeted seed collides
+    MetricCounter* budget_exhausted;        // warps stopped by their time budget
+    MetricCounter* state_checks;            // full collision checks, i.e. validity cache misses
+    MetricCounter* ik_attempts;
+    MetricCounter* ik_solutions_checked;
+    MetricHistogram* hits_tried;
+    MetricHistogram* warp_iterations;       // per warp
+    MetricHistogram* lookup_time;           // us per query, and likewise below
+    MetricHistogram* warp_time;
+    MetricHistogram* validation_time;
+    MetricHistogram* fit_time;
+} library_metrics;
+
+typedef struct {
+    plan_handle_t seed;         // library plan, shared read-only
+    ur5_motion_plan plan;       // warped result, only written on success
+    bool success;
+    fit_report report;
+} warp_job;
+
+struct warp_batch;
+struct planner_race;
+struct shortcut_batch;
+
 class TrajectoryLibrary
 {
+    // Times the private collision and post-processing primitives (bench_primitives)
+    friend class PrimitiveBench;
+
     // Target positions
     int _num_target_groups;
     std::vector<target_group> _target_groups;
@@ -95,6 +226,40 @@ class TrajectoryLibrary
     // KD tree plan data structure
     KDTreePtr _kdtree;
 
+    // Travel time between every pair of library targets
+    DurationMatrix _duration_matrix;
+
+    // Planner cost of every pair in the last build
+    BuildReport _build_report;
+
+    // Guards _duration_matrix and _build_report, which the flush thread writes out while they change
+    boost::mutex _library_data_mutex;
+
+    // Last file passed to importFromFile()
+    std::string _library_filename;
+
+    // Online library learning
+    learning_params _learning_params;
+    boost::atomic<bool> _learned_dirty;
+    boost::thread _flush_thread;
+    void learnPlan(const ur5_motion_plan& plan);
+    void flushThread();
+
+    // Memoized collision checks
+    ValidityCachePtr _validity_cache;
+
+    // Optional log of every fitPlan query, for offline replay
+    QueryTraceRecorder _trace_recorder;
+
+    // Counters and histograms, dumped as JSON or published periodically
+    MetricsRegistry _metrics;
+    library_metrics _metric;
+    double _metrics_period;
+    boost::thread _metrics_thread;
+    void registerMetrics();
+    void recordFitMetrics(const fit_report& report, bool found, double fit_time);
+    void metricsThread();
+
     // MoveIt variables
     robot_model_loader::RobotModelLoaderPtr _rmodel_loader;
     robot_model::RobotModelPtr _rmodel;
@@ -104,6 +269,8 @@ class TrajectoryLibrary
     planning_interface::PlannerManagerPtr _planner;
     planning_pipeline::PlanningPipelinePtr _planning_pipeline;
     boost::shared_ptr<trajectory_processing::IterativeParabolicTimeParameterization> _time_parametizer;
+    std::vector<double> _max_velocity;          // per variable, as the time parameterizer reads them
+    std::vector<double> _max_acceleration;
     trajectory_execution_manager::TrajectoryExecutionManagerPtr _execution_manager;
 
     // Publisher
@@ -111,23 +278,73 @@ class TrajectoryLibrary
     ros::Publisher _plan_scene_publisher;
     ros::Publisher _robot_state_publisher;
     ros::Publisher _collision_object_publisher;
+    ros::Publisher _metrics_publisher;
 
     // Gradient descent warp
-    bool gradientDescentWarp(ur5_motion_plan& plan, const joint_values_t& jvals_start, const joint_values_t& jvals_end);
-    double calculateGradients(double* gradient_array, robot_trajectory::RobotTrajectoryPtr traj);
+    warp_params _warp_params;
+    bool gradientDescentWarp(const ur5_motion_plan& seed, ur5_motion_plan& plan, const joint_values_t& jvals_start, const joint_values_t& jvals_end, double max_time, fit_report* report, const boost::atomic<bool>* cancel);
+    bool gradientDescentWarp(WarpWorkspace& workspace, const ur5_motion_plan& seed, ur5_motion_plan& plan, const joint_values_t& jvals_start, const joint_values_t& jvals_end, double max_time, fit_report* report, const boost::atomic<bool>* cancel);
+    double calculateGradients(double* gradient_array, robot_trajectory::RobotTrajectoryPtr traj, WarpWorkspace& workspace);
+    double localSegmentTime(const robot_trajectory::RobotTrajectory& traj, int i, const double* positions);
+    void getTrajectoryPositions(double* positions, robot_trajectory::RobotTrajectoryPtr traj);
+    void setTrajectoryPositions(robot_trajectory::RobotTrajectoryPtr traj, const double* positions, const double* direction, double scale);
+
+    // Worker pool for speculative parallel warping
+    boost::asio::io_service _warp_service;
+    boost::scoped_ptr<boost::asio::io_service::work> _warp_work;
+    boost::thread_group _warp_threads;
+    void warpServiceThread();
+    void warpTask(warp_batch* batch, int job_index);
+
+    // Per-query scratch memory, one borrowed by each concurrent warp
+    boost::mutex _workspace_mutex;
+    std::vector<WarpWorkspacePtr> _free_workspaces;
+    WarpWorkspacePtr acquireWorkspace();
+    void releaseWorkspace(const WarpWorkspacePtr& workspace);
+    void reserveWorkspaces();
 
     // Trajectory post-processing
-    void optimizeTrajectory(robot_trajectory::RobotTrajectoryPtr traj_opt, robot_trajectory::RobotTrajectoryPtr traj);
+    shortcut_params _shortcut_params;
+    boost::random::mt19937 _shortcut_rng;
+    void optimizeTrajectory(robot_trajectory::RobotTrajectoryPtr traj_opt, robot_trajectory::RobotTrajectoryPtr traj, int* shortcut_checks = NULL);
+    std::size_t furthestShortcut(const robot_trajectory::RobotTrajectory& traj, std::size_t start, int* shortcut_checks);
+    void shortcutTask(shortcut_batch* batch, int index);
+    void randomShortcuts(std::vector<robot_state::RobotStatePtr>& path, int* shortcut_checks);
     void timeWarpTrajectory(robot_trajectory::RobotTrajectoryPtr traj, double slow_factor);
     void computeVelocities(robot_trajectory::RobotTrajectoryPtr traj);
+    bool straightLinePlan(ur5_motion_plan& plan, const joint_values_t& start_jvals, const joint_values_t& end_jvals);
 
     // Private methods
     std::size_t rectLinspace(std::vector<joint_values_t>& jvals, grid_rect& grid);
     std::size_t sphereLinspace(std::vector<joint_values_t>& jvals, grid_sphere& sphere);
+    bool stateValid(robot_state::RobotState& state);
     bool segmentValid(const robot_state::RobotState& start, const robot_state::RobotState& end, int res);
+    bool segmentValid(const robot_state::RobotState& start, const robot_state::RobotState& end, int res, robot_state::RobotState& inter_state);
     bool pathValid(const robot_trajectory::RobotTrajectoryPtr traj, int res);
+    bool pathValid(const robot_trajectory::RobotTrajectoryPtr traj, int res, robot_state::RobotState& inter_state);
+
+    bool planTrajectory(ur5_motion_plan& plan, std::vector<moveit_msgs::Constraints> constraints, build_pair_stats* stats = NULL);
+
+    // Joint values of every target in the duration matrix, per group; empty where unknown
+    void getLibraryTargets(std::vector< std::vector<joint_values_t> >& targets);
+
+    // Planner portfolio, raced by planTrajectory
+    portfolio_params _portfolio_params;
+    std::vector<planner_stats> _planner_stats;
+    bool solvePortfolio(const planning_interface::MotionPlanRequest& req, planning_interface::MotionPlanResponse& res, std::string& winner);
+    // Solves one query on every context at once; best is the index of the kept response, -1 if none was valid
+    bool racePlanners(const std::vector<planning_interface::PlanningContextPtr>& contexts, bool first_wins, double allowed_time,
+                      planning_interface::MotionPlanResponse& res, int& best, std::vector<planner_stats>* stats);
+    void raceTask(planner_race* race, int index);
+
+    void setStartTarget(const joint_values_t& jvals);
+    bool planTargetPair(int start_group, int start_target, int end_group, int end_target, const joint_values_t& end_jvals);
+    bool recordTargetPair(ur5_motion_plan& plan, const build_pair_stats& pair_stats);
 
-    bool planTrajectory(ur5_motion_plan& plan, std::vector<moveit_msgs::Constraints> constraints);
+    // Roadmap build engine
+    void connectRoadmapNode(Roadmap& roadmap, int node, const roadmap_params& params, int* edge_checks);
+    bool roadmapPlan(ur5_motion_plan& plan, const Roadmap& roadmap, const std::vector<int>& path, build_pair_stats* stats);
+    bool sampleTarget(joint_values_t& jvals, geometry_msgs::Point& position, const target_volume& vol);
 
     void printPose(const geometry_msgs::Pose& pose);
     void printJointValues(const joint_values_t& jvals);
@@ -138,26 +355,63 @@ class TrajectoryLibrary
     bool doIK(std::vector<joint_values_t>& solutions, const geometry_msgs::Pose& geo_pose);
     bool ikValidityCallback(const std::vector<joint_values_t>& comparison_values, robot_state::RobotState* p_state, const robot_model::JointModelGroup* p_jmg, const double* jvals);
 
-    moveit_msgs::AttachedCollisionObject getAppleObjectMsg();
-
-    // File write and read
-    bool filewrite(const std::vector<ur5_motion_plan> &plans, const char* filename, bool debug);
-    bool fileread(std::vector<ur5_motion_plan>& plans, const char* filename, bool debug);
+    // Shared by both constructors once _rmodel is set
+    void init();
 
 public:
     TrajectoryLibrary(ros::NodeHandle& nh);
+    TrajectoryLibrary(const robot_model::RobotModelPtr& rmodel);   // headless: no planner, no publishers
+    ~TrajectoryLibrary();
 
     void initWorkspaceBounds();
     void addSphereCollisionObject(double radius);
     void printCollisionWorldInfo(std::ostream& cout);
+    void printValidityCacheInfo(std::ostream& cout);
 
     void setTargetVolumes(const std::vector<target_volume> & vols);
     void generateTargets();
     void generateRandomJointTarget(joint_values_t& jvals, const target_volume& vol);
     void build();
-    void demo();
+    // Same pairs as build(), but every path comes from one collision-checked roadmap over all targets
+    void buildRoadmap(const roadmap_params& params);
+    inline const BuildReport& getBuildReport() { return _build_report; }
+
+    // Distance from random target volume queries to the nearest library plan
+    void analyzeCoverage(CoverageReport& report, int num_samples);
+    // Incremental build: adds the worst gaps of a report as targets and plans them both ways; returns plans added
+    std::size_t buildGaps(const CoverageReport& report, int max_gaps);
+    void demo(double deadline = 0, int parallel_hits = 0);
+    void demoPipelined(double deadline = 0, int parallel_hits = 0, int batch_size = 0);
+
+    double sequenceTargets(std::vector<joint_values_t>& targets, const joint_values_t& start_jvals);
+
+    void setWarpParams(const warp_params& params);
+    inline const warp_params& getWarpParams() { return _warp_params; }
+    void setLearningParams(const learning_params& params);
+    void setPortfolioParams(const portfolio_params& params);
+    void setShortcutParams(const shortcut_params& params);
+    inline const shortcut_params& getShortcutParams() { return _shortcut_params; }
+    inline const portfolio_params& getPortfolioParams() { return _portfolio_params; }
+    void printPortfolioInfo(std::ostream& cout);
 
     bool fitPlan(ur5_motion_plan& plan, const joint_values_t &start_jvals, const joint_values_t &end_jvals);
+    bool fitPlan(ur5_motion_plan& plan, const joint_values_t &start_jvals, const joint_values_t &end_jvals, double deadline, fit_report& report);
+    bool fitPlanParallel(ur5_motion_plan& plan, const joint_values_t &start_jvals, const joint_values_t &end_jvals, int num_hits, bool first_wins, double deadline, fit_report& report);
+    bool fitPlanConfigured(ur5_motion_plan& plan, const joint_values_t &start_jvals, const joint_values_t &end_jvals, double deadline, int parallel_hits);
+    void printFitReport(const fit_report& report);
+
+    // Metrics JSON goes out on the metrics topic every period s, <= 0 to stop
+    void setMetricsPeriod(double period);
+    inline MetricsRegistry& getMetrics() { return _metrics; }
+    bool writeMetrics(const std::string& filename);
+
+    // Append every subsequent fitPlan query to filename
+    bool recordTrace(const std::string& filename);
+
+    inline const DurationMatrix& getDurationMatrix() { return _duration_matrix; }
+
+    // Drops plans that fitPlan could warp a kept plan into
+    std::size_t compactLibrary(double warp_radius, double traj_tolerance, std::vector<ur5_motion_plan>* dropped = NULL);
 
     void exportToFile(const char* filename);
     void importFromFile(const char* filename);
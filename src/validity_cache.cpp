@@ -0,0 +1,160 @@
+#include "validity_cache.h"
+
+#include <cmath>
+
+ValidityCache::ValidityCache(double resolution, std::size_t max_entries)
+{
+    if (resolution <= 0)
+    {
+        throw std::string("Validity cache resolution must be positive.");
+    }
+
+    _resolution = resolution;
+    _max_entries = max_entries;
+
+    resetCounters();
+
+    return;
+}
+
+void ValidityCache::appendKey(validity_key_t& key, const robot_state::RobotState& state)
+{
+    const double* positions = state.getVariablePositions();
+    std::size_t num_vars = state.getVariableCount();
+    for (std::size_t i = 0; i < num_vars; i++)
+    {
+        key.push_back( (long) floor(positions[i] / _resolution + 0.5) );
+    }
+    return;
+}
+
+void ValidityCache::checkSize()
+{
+    // Crude bound on memory use: start over once we have seen too many states
+    if (_states.size() + _segments.size() > _max_entries)
+    {
+        _states.clear();
+        _segments.clear();
+    }
+    return;
+}
+
+bool ValidityCache::lookupState(const robot_state::RobotState& state, bool& valid)
+{
+    validity_key_t key;
+    key.reserve(state.getVariableCount());
+    appendKey(key, state);
+
+    boost::mutex::scoped_lock lock(_mutex);
+    boost::unordered_map<validity_key_t, bool>::const_iterator it = _states.find(key);
+    if (it == _states.end())
+    {
+        _state_misses++;
+        return false;
+    }
+
+    _state_hits++;
+    valid = it->second;
+    return true;
+}
+
+void ValidityCache::storeState(const robot_state::RobotState& state, bool valid)
+{
+    validity_key_t key;
+    key.reserve(state.getVariableCount());
+    appendKey(key, state);
+
+    boost::mutex::scoped_lock lock(_mutex);
+    checkSize();
+    _states[key] = valid;
+    return;
+}
+
+bool ValidityCache::lookupSegment(const robot_state::RobotState& start, const robot_state::RobotState& end, int res, bool& valid)
+{
+    validity_key_t key;
+    key.reserve(2 * start.getVariableCount() + 1);
+    appendKey(key, start);
+    appendKey(key, end);
+    key.push_back(res);
+
+    boost::mutex::scoped_lock lock(_mutex);
+    boost::unordered_map<validity_key_t, bool>::const_iterator it = _segments.find(key);
+    if (it == _segments.end())
+    {
+        _segment_misses++;
+        return false;
+    }
+
+    _segment_hits++;
+    valid = it->second;
+    return true;
+}
+
+void ValidityCache::storeSegment(const robot_state::RobotState& start, const robot_state::RobotState& end, int res, bool valid)
+{
+    validity_key_t key;
+    key.reserve(2 * start.getVariableCount() + 1);
+    appendKey(key, start);
+    appendKey(key, end);
+    key.push_back(res);
+
+    boost::mutex::scoped_lock lock(_mutex);
+    checkSize();
+    _segments[key] = valid;
+    return;
+}
+
+void ValidityCache::clear()
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    _states.clear();
+    _segments.clear();
+    return;
+}
+
+void ValidityCache::resetCounters()
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    _state_hits = 0;
+    _state_misses = 0;
+    _segment_hits = 0;
+    _segment_misses = 0;
+    return;
+}
+
+std::size_t ValidityCache::getStateHits()
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    return _state_hits;
+}
+
+std::size_t ValidityCache::getStateMisses()
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    return _state_misses;
+}
+
+std::size_t ValidityCache::getSegmentHits()
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    return _segment_hits;
+}
+
+std::size_t ValidityCache::getSegmentMisses()
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    return _segment_misses;
+}
+
+void ValidityCache::printInfo(std::ostream& cout)
+{
+    boost::mutex::scoped_lock lock(_mutex);
+    cout << "ValidityCache: " << std::endl;
+    cout << "  Resolution: " << _resolution << std::endl;
+    cout << "  Cached states: " << _states.size() << std::endl;
+    cout << "  Cached segments: " << _segments.size() << std::endl;
+    cout << "  State hits / misses: " << _state_hits << " / " << _state_misses << std::endl;
+    cout << "  Segment hits / misses: " << _segment_hits << " / " << _segment_misses << std::endl;
+    return;
+}
@@ -0,0 +1,66 @@
+#ifndef VALIDITY_CACHE_H
+#define VALIDITY_CACHE_H
+
+#include <moveit/robot_state/robot_state.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <iostream>
+#include <vector>
+
+#define VALIDITY_CACHE_RES 0.0001           // joint value quantization step (rad)
+#define VALIDITY_CACHE_MAX_ENTRIES 1000000  // cache is flushed when it grows past this
+
+typedef std::vector<long> validity_key_t;
+
+class ValidityCache
+{
+    // Quantization
+    double _resolution;
+    std::size_t _max_entries;
+
+    // Warps may run concurrently
+    boost::mutex _mutex;
+
+    // Cached results
+    boost::unordered_map<validity_key_t, bool> _states;
+    boost::unordered_map<validity_key_t, bool> _segments;
+
+    // Counters
+    std::size_t _state_hits;
+    std::size_t _state_misses;
+    std::size_t _segment_hits;
+    std::size_t _segment_misses;
+
+    // Helper functions
+    void appendKey(validity_key_t& key, const robot_state::RobotState& state);
+    void checkSize();
+
+public:
+    ValidityCache(double resolution, std::size_t max_entries);
+
+    // Single states
+    bool lookupState(const robot_state::RobotState& state, bool& valid);
+    void storeState(const robot_state::RobotState& state, bool valid);
+
+    // Interpolated segments, keyed by both endpoints and checker resolution
+    bool lookupSegment(const robot_state::RobotState& start, const robot_state::RobotState& end, int res, bool& valid);
+    void storeSegment(const robot_state::RobotState& start, const robot_state::RobotState& end, int res, bool valid);
+
+    // Must be called whenever the planning scene changes
+    void clear();
+    void resetCounters();
+
+    std::size_t getStateHits();
+    std::size_t getStateMisses();
+    std::size_t getSegmentHits();
+    std::size_t getSegmentMisses();
+
+    void printInfo(std::ostream& cout);
+};
+
+typedef boost::shared_ptr<ValidityCache> ValidityCachePtr;
+
+#endif // VALIDITY_CACHE_H
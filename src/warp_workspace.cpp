@@ -0,0 +1,78 @@
+#include "warp_workspace.h"
+
+WarpWorkspace::WarpWorkspace(const robot_model::RobotModelPtr& rmodel, const std::string& group_name, std::size_t capacity)
+{
+    _rmodel = rmodel;
+    _num_joints = _rmodel->getVariableCount();
+    _capacity = 0;
+
+    _reference.reset(new robot_state::RobotState(_rmodel));
+    _inter_state.reset(new robot_state::RobotState(_rmodel));
+    _traj.reset(new robot_trajectory::RobotTrajectory(_rmodel, group_name));
+    _perturbed.resize(_num_joints);
+
+    reserve(capacity);
+    return;
+}
+
+void WarpWorkspace::reserve(std::size_t num_wpts)
+{
+    if (num_wpts <= _capacity)
+    {
+        return;
+    }
+
+    _states.reserve(num_wpts);
+    while (_states.size() < num_wpts)
+    {
+        _states.push_back(robot_state::RobotStatePtr(new robot_state::RobotState(_rmodel)));
+    }
+    _positions.reserve(num_wpts * _num_joints);
+    _gradient_field.reserve(num_wpts * _num_joints);
+    _direction.reserve(num_wpts * _num_joints);
+    _capacity = num_wpts;
+    return;
+}
+
+robot_trajectory::RobotTrajectoryPtr WarpWorkspace::load(const ur5_motion_plan& seed)
+{
+    const trajectory_msgs::JointTrajectory& jtraj = seed.trajectory.joint_trajectory;
+    std::size_t num_wpts = jtraj.points.size();
+    reserve(num_wpts);
+
+    // Same waypoint count as the last query: the trajectory already refers to the right states
+    bool rebuild = (_traj->getWayPointCount() != num_wpts);
+    if (rebuild)
+    {
+        _traj->clear();
+    }
+
+    // Same as RobotTrajectory::setRobotTrajectoryMsg, but into preallocated states
+    moveit::core::robotStateMsgToRobotState(seed.start_state, *_reference);
+    double last_time = 0;
+    for (std::size_t i = 0; i < num_wpts; i++)
+    {
+        robot_state::RobotState& state = *_states[i];
+        state = *_reference;
+        state.setVariablePositions(jtraj.joint_names, jtraj.points[i].positions);
+        state.update();
+
+        double time = jtraj.points[i].time_from_start.toSec();
+        if (rebuild)
+        {
+            _traj->addSuffixWayPoint(_states[i], time - last_time);
+        }
+        else
+        {
+            _traj->setWayPointDurationFromPrevious(i, time - last_time);
+        }
+        last_time = time;
+    }
+
+    // Within capacity, so these never reallocate
+    _positions.assign(num_wpts * _num_joints, 0.0);
+    _gradient_field.assign(num_wpts * _num_joints, 0.0);
+    _direction.assign(num_wpts * _num_joints, 0.0);
+
+    return _traj;
+}
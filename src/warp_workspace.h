@@ -0,0 +1,55 @@
+#ifndef WARP_WORKSPACE_H
+#define WARP_WORKSPACE_H
+
+#include "kd_tree.h"
+
+#include <moveit/robot_model/robot_model.h>
+#include <moveit/robot_state/robot_state.h>
+#include <moveit/robot_state/conversions.h>
+#include <moveit/robot_trajectory/robot_trajectory.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+// Scratch memory for one gradient descent warp. Waypoint states and flat buffers are allocated up
+// front for the longest plan in the library and reused by every query that borrows the workspace.
+class WarpWorkspace
+{
+    robot_model::RobotModelPtr _rmodel;
+    std::size_t _num_joints;
+    std::size_t _capacity;                              // waypoints
+
+    // Preallocated states; the trajectory refers to the first num_wpts of them
+    std::vector<robot_state::RobotStatePtr> _states;
+    robot_state::RobotStatePtr _reference;              // seed start state, including attached bodies
+    robot_state::RobotStatePtr _inter_state;            // for interpolated validity checks
+    robot_trajectory::RobotTrajectoryPtr _traj;
+    std::vector<double> _perturbed;                     // one waypoint's positions, moved by calculateGradients
+
+    // Flat num_wpts * num_joints buffers
+    std::vector<double> _positions;
+    std::vector<double> _gradient_field;
+    std::vector<double> _direction;
+
+public:
+    WarpWorkspace(const robot_model::RobotModelPtr& rmodel, const std::string& group_name, std::size_t capacity);
+
+    // Grow to hold plans of num_wpts waypoints; no-op once large enough
+    void reserve(std::size_t num_wpts);
+
+    // Load seed into the workspace trajectory and size the buffers to match
+    robot_trajectory::RobotTrajectoryPtr load(const ur5_motion_plan& seed);
+
+    inline std::size_t getCapacity() { return _capacity; }
+    inline robot_state::RobotState& getInterState() { return *_inter_state; }
+    inline std::vector<double>& getPerturbed() { return _perturbed; }
+    inline std::vector<double>& getPositions() { return _positions; }
+    inline std::vector<double>& getGradientField() { return _gradient_field; }
+    inline std::vector<double>& getDirection() { return _direction; }
+};
+
+typedef boost::shared_ptr<WarpWorkspace> WarpWorkspacePtr;
+
+#endif // WARP_WORKSPACE_H